@@ -0,0 +1,242 @@
+// $VER: fiobench.cpp V1.0 (17.10.2026)
+
+/* <COMPILE>
+g++ -O2 -pthread -o fiobench fiobench.cpp
+</COMPILE> */
+
+// Benchmarks the fio primitives and prints the results as JSON.
+// usage: fiobench [directory] [max size in MiB] [warm|cold|both]
+//  Element reads/writes (fread_u*, fwrite_u*), fileLoadBytes/fileSaveBytes
+//  from 4 KiB up to the max size (default 1024 MiB) and the latency of the
+//  metadata calls are measured. With "cold" the page cache of a file is
+//  dropped before every save and load, "both" runs them warm and cold.
+//  Every result has the median and the 99th percentile of the time of one
+//  operation (or one element) in nanoseconds and the GB/s of the median.
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string.h>
+#include "fio.h"
+
+static bool firstResult = true;
+static volatile uint64_t sink; // keeps the read loops from being optimized out
+
+static double nowNs() {
+  return std::chrono::duration<double, std::nano>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void dropCache(const char *fname) {
+#ifdef __linux__
+  int fd = open(fname, O_RDONLY);
+  if (fd >= 0) {
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+#endif
+}
+
+// Prints one result; ns holds the time of one operation per repetition
+static void report(const char *name, const char *cache, int64_t bytes,
+                   const char *per, std::vector<double> &ns) {
+  if (ns.empty()) return;
+  std::sort(ns.begin(), ns.end());
+  const double median = ns[ns.size() / 2];
+  size_t k = (size_t)(ns.size() * 0.99 + 0.5);
+  if (k >= ns.size()) k = ns.size() - 1;
+  const double p99 = ns[k];
+  printf("%s\n    {\"name\": \"%s\", \"cache\": \"%s\", \"bytes\": %" PRId64
+         ", \"per\": \"%s\", \"reps\": %u, \"median_ns\": %.1f,"
+         " \"p99_ns\": %.1f, \"gbps\": %.3f}",
+         firstResult ? "" : ",", name, cache, bytes, per,
+         (unsigned)ns.size(), median, p99,
+         median > 0 ? bytes / median : 0.0);
+  firstResult = false;
+  fflush(stdout);
+}
+
+// fread_u*/fwrite_u* cost per element of n elements of type T
+template <typename T>
+static void benchElements(const char *fname, const char *rname,
+                          const char *wname, size_t n, int reps,
+                          bool (*rd)(FILE *, bool, T &),
+                          bool (*wr)(FILE *, bool, T)) {
+  std::vector<double> rns, wns;
+  for (int r = 0; r < reps; r++) {
+    FILE *fp = fileOpen(fname, "wb");
+    if (!fp) return;
+    double t0 = nowNs();
+    for (size_t i = 0; i < n; i++) {
+      wr(fp, ENDIAN_BIG, (T)i);
+    }
+    fflush(fp);
+    wns.push_back((nowNs() - t0) / n);
+    fileClose(fp);
+    fp = fileOpen(fname, "rb");
+    if (!fp) return;
+    T v = 0;
+    uint64_t sum = 0;
+    t0 = nowNs();
+    for (size_t i = 0; i < n; i++) {
+      rd(fp, ENDIAN_BIG, v);
+      sum += v;
+    }
+    rns.push_back((nowNs() - t0) / n);
+    fileClose(fp);
+    sink = sum;
+  }
+  report(wname, "warm", sizeof(T), "element", wns);
+  report(rname, "warm", sizeof(T), "element", rns);
+}
+
+// Array and FileReader reads of the same n uint32_t elements
+static void benchBulkElements(const char *fname, size_t n, int reps) {
+  std::vector<double> ans, bns;
+  std::vector<uint32_t> dst(n);
+  for (int r = 0; r < reps; r++) {
+    FILE *fp = fileOpen(fname, "rb");
+    if (!fp) return;
+    double t0 = nowNs();
+    fread_u32_array(fp, ENDIAN_BIG, &dst[0], n);
+    ans.push_back((nowNs() - t0) / n);
+    fseeko64(fp, 0, SEEK_SET);
+    FileReader rd;
+    rd.open(fp);
+    uint64_t sum = 0;
+    t0 = nowNs();
+    for (size_t i = 0; i < n; i++) {
+      sum += rd.readU32(ENDIAN_BIG);
+    }
+    bns.push_back((nowNs() - t0) / n);
+    rd.close();
+    fileClose(fp);
+    sink = sum;
+  }
+  report("fread_u32_array", "warm", 4, "element", ans);
+  report("FileReader::readU32", "warm", 4, "element", bns);
+}
+
+// fileSaveBytes of size bytes, cold drops the cache of the old file first
+static void benchSave(const char *fname, int64_t size, int reps, bool cold) {
+  std::vector<uint8_t> v((size_t)size);
+  for (size_t i = 0; i < v.size(); i += 4096) {
+    v[i] = (uint8_t)i;
+  }
+  std::vector<double> ns;
+  for (int r = 0; r < reps; r++) {
+    if (cold) dropCache(fname);
+    FILE *fp = fileOpen(fname, "wb");
+    if (!fp) return;
+    const double t0 = nowNs();
+    fileSaveBytes(fp, v);
+    fileClose(fp);
+    ns.push_back(nowNs() - t0);
+  }
+  report("fileSaveBytes", cold ? "cold" : "warm", size, "call", ns);
+}
+
+// fileLoadBytes variants of the file fname of size bytes
+static void benchLoad(const char *fname, int64_t size, int reps, bool cold) {
+  const char *cache = cold ? "cold" : "warm";
+  const char *names[4] = { "fileLoadBytes", "fileLoadBytesParallel",
+                           "fileLoadBytes(FILEIO_DIRECT)",
+                           "fileLoadBytes(FILEIO_DROPBEHIND)" };
+  fioBuffer buf;
+  for (int mode = 0; mode < 4; mode++) {
+    std::vector<double> ns;
+    if (!cold) fileLoadBytes(fname, buf, FILEIO_BUFFERED); // warm up
+    for (int r = 0; r < reps; r++) {
+      if (cold) dropCache(fname);
+      double t0 = nowNs();
+      int64_t n = -1;
+      if (mode == 0 || mode == 1) {
+        FILE *fp = fileOpen(fname, "rb");
+        if (!fp) return;
+        t0 = nowNs();
+        n = (mode == 0) ? fileLoadBytes(fp, buf)
+                        : fileLoadBytesParallel(fp, buf);
+        fileClose(fp);
+      } else {
+        n = fileLoadBytes(fname, buf, mode == 2 ? FILEIO_DIRECT
+                                                : FILEIO_DROPBEHIND);
+      }
+      ns.push_back(nowNs() - t0);
+      if (n != size) {
+        fprintf(stderr, "fiobench: %s of %s returned %" PRId64
+                " instead of %" PRId64 " bytes\n", names[mode], fname, n, size);
+        return;
+      }
+    }
+    report(names[mode], cache, size, "call", ns);
+  }
+}
+
+// Latency of the metadata calls on an existing file
+static void benchMetadata(const char *fname, int reps) {
+  std::vector<double> ns[5];
+  FileStat st;
+  for (int r = 0; r < reps; r++) {
+    double t0 = nowNs();
+    fileSize(fname);
+    double t1 = nowNs();
+    ns[0].push_back(t1 - t0);
+    fileExists(fname);
+    t0 = nowNs();
+    ns[1].push_back(t0 - t1);
+    fileType(fname);
+    t1 = nowNs();
+    ns[2].push_back(t1 - t0);
+    fileModificationTime(fname);
+    t0 = nowNs();
+    ns[3].push_back(t0 - t1);
+    fileStat(fname, st);
+    ns[4].push_back(nowNs() - t0);
+  }
+  const char *names[5] = { "fileSize", "fileExists", "fileType",
+                           "fileModificationTime", "fileStat" };
+  for (int i = 0; i < 5; i++) {
+    report(names[i], "warm", 0, "call", ns[i]);
+  }
+}
+
+int main(int argc, char **argv) {
+  const std::string dir = (argc > 1) ? argv[1] : ".";
+  const int64_t maxMib = (argc > 2) ? atoll(argv[2]) : 1024;
+  const char *mode = (argc > 3) ? argv[3] : "warm";
+  const bool warm = (strcmp(mode, "cold") != 0);
+  const bool cold = (strcmp(mode, "cold") == 0 || strcmp(mode, "both") == 0);
+  const std::string fname = dir + PATH_SEPARATOR + "fiobench.dat";
+
+  printf("{\n  \"benchmark\": \"fiobench\",\n  \"max_bytes\": %" PRId64
+         ",\n  \"results\": [", maxMib * 1024 * 1024);
+  const size_t elements = 1 << 20;
+  benchElements<uint16_t>(fname.c_str(), "fread_u16", "fwrite_u16",
+                          elements, 15, fread_u16, fwrite_u16);
+  benchElements<uint64_t>(fname.c_str(), "fread_u64", "fwrite_u64",
+                          elements, 15, fread_u64, fwrite_u64);
+  benchElements<uint32_t>(fname.c_str(), "fread_u32", "fwrite_u32",
+                          elements, 15, fread_u32, fwrite_u32);
+  benchBulkElements(fname.c_str(), elements, 15);
+  benchMetadata(fname.c_str(), 10000);
+
+  for (int64_t size = 4096; size <= maxMib * 1024 * 1024; size *= 4) {
+    int reps = (int)((256LL * 1024 * 1024) / size);
+    reps = std::max(5, std::min(reps, 1000));
+    if (cold) reps = std::min(reps, 100);
+    if (warm) {
+      benchSave(fname.c_str(), size, reps, false);
+      benchLoad(fname.c_str(), size, reps, false);
+    }
+    if (cold) {
+      benchSave(fname.c_str(), size, reps, true);
+      benchLoad(fname.c_str(), size, reps, true);
+    }
+  }
+  printf("\n  ]\n}\n");
+  fileDelete(fname.c_str());
+  return 0;
+}
+
+// EOF
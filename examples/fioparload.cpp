@@ -0,0 +1,85 @@
+// $VER: fioparload.cpp V1.0 (17.10.2026)
+
+/* <COMPILE>
+g++ -O2 -pthread -o fioparload fioparload.cpp
+</COMPILE> */
+
+// Measures how fileLoadBytesParallel scales with the number of threads.
+// usage: fioparload [file] [size in MiB] [cold]
+//  The file is created with the given size if it does not exist.
+//  With "cold" the page cache of the file is dropped before every run.
+
+#include <chrono>
+#include <iostream>
+#include <string.h>
+#include "fio.h"
+
+static void dropCache(const char *fname) {
+#ifdef __linux__
+  int fd = open(fname, O_RDONLY);
+  if (fd >= 0) {
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+#endif
+}
+
+static double loadSeconds(const char *fname, int threads, int64_t &bytes) {
+  FILE *fp = fileOpen(fname, "rb");
+  if (!fp) return -1;
+  fioBuffer buf;
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  if (threads == 0) {
+    bytes = fileLoadBytes(fp, buf);
+  } else {
+    bytes = fileLoadBytesParallel(fp, buf, 0, threads);
+  }
+  std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+  fileClose(fp);
+  return dt.count();
+}
+
+int main(int argc, char **argv) {
+  const char *fname = (argc > 1) ? argv[1] : "fioparload.dat";
+  const int64_t mib = (argc > 2) ? atoll(argv[2]) : 512;
+  const bool cold = (argc > 3 && strcmp(argv[3], "cold") == 0);
+  if (!fileExists(fname)) {
+    FILE *fp = fileOpen(fname, "wb");
+    if (!fp) {
+      std::cerr << "cannot create " << fname << std::endl;
+      return 1;
+    }
+    std::vector<uint8_t> block(1024 * 1024);
+    for (size_t i = 0; i < block.size(); i++) {
+      block[i] = (uint8_t)(i * 31);
+    }
+    for (int64_t i = 0; i < mib; i++) {
+      fileSaveBytes(fp, block);
+    }
+    fileClose(fp);
+  }
+  if (!cold) {
+    int64_t bytes = 0;
+    loadSeconds(fname, 0, bytes); // warm up the page cache
+  }
+  std::cout << "threads  seconds   GB/s  (" << fileSize(fname) << " bytes, "
+            << (cold ? "cold" : "warm") << " cache)" << std::endl;
+  const int threads[] = { 0, 1, 2, 4, 8, 16, 32 };
+  for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+    if (cold) dropCache(fname);
+    int64_t bytes = 0;
+    const double s = loadSeconds(fname, threads[i], bytes);
+    if (s < 0 || bytes < 0) {
+      std::cerr << "load failed" << std::endl;
+      return 1;
+    }
+    char line[80];
+    snprintf(line, sizeof(line), "%7s %8.3f %6.2f", threads[i] == 0
+             ? "seq" : std::to_string(threads[i]).c_str(), s,
+             bytes / s / 1e9);
+    std::cout << line << std::endl;
+  }
+  return 0;
+}
+// EOF
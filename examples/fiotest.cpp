@@ -4,7 +4,7 @@
 wflags="-W -Wall -Wextra -Wno-unused-parameter"
 oflags="-Os -fno-exceptions -ffunction-sections -fdata-sections -fno-math-errno -fno-ident"
 lflags="-Wl,--gc-sections"
-g++ $wflags -pedantic $oflags -o fiotest fiotest.cpp -DSELFTEST
+g++ $wflags -pedantic $oflags -pthread -o fiotest fiotest.cpp -DSELFTEST
 </COMPILE> */
 
 /* <COMPILE_WIN>
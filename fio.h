@@ -64,6 +64,12 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <time.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <utility>
 #include <vector>
 #include <inttypes.h> // for selftest
 
@@ -72,9 +78,33 @@
 // Linux specific
 // ***************
 #include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define FIO_HAVE_URING
+#endif
+#endif
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
 
 typedef struct stat64 ststat64;
 
@@ -110,6 +140,8 @@ typedef struct stat64 ststat64;
 #define _WIN32_WINNT 0x0601
 
 #include <windows.h>
+#include <io.h>
+#include <fcntl.h>
 #include <string>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -159,6 +191,19 @@ static std::wstring utf8_to_wstring(const std::string &str) {
 #error unsupported platform
 #endif
 
+// SIMD kernels are compiled per function and selected at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FIO_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Instrumentation is compiled in only with -DFIO_STATS
+#ifdef FIO_STATS
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#endif
+
 // undef bswap...
 #ifdef bswap_16
 #undef bswap_16
@@ -192,9 +237,43 @@ static std::wstring utf8_to_wstring(const std::string &str) {
 #define ENDIAN_LITTLE 0
 #define ENDIAN_BIG    1
 
+// Byte order of the host, known at compile time
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define FIO_HOST_ENDIAN ENDIAN_BIG
+#else
+#define FIO_HOST_ENDIAN ENDIAN_LITTLE
+#endif
+
 // The buffer size in bytes for catching the file input and output.
 #define FILEIOBUFSIZE 8192
 
+// The maximum number of bytes moved by a single read or write system call.
+#define FILEIOMAXCHUNK (1 << 30)
+
+// Allocator that leaves new elements uninitialised when a container grows,
+// so a buffer can be sized once and filled directly by the kernel.
+template <typename T>
+struct fioNoInitAllocator : std::allocator<T> {
+  template <typename U> struct rebind { typedef fioNoInitAllocator<U> other; };
+  fioNoInitAllocator() {}
+  template <typename U> fioNoInitAllocator(const fioNoInitAllocator<U> &) {}
+  template <typename U> void construct(U *p) {
+    ::new((void *)p) U;
+  }
+  template <typename U, typename... Args> void construct(U *p, Args&&... args) {
+    ::new((void *)p) U(std::forward<Args>(args)...);
+  }
+};
+
+// Byte buffer without zero initialisation, reusable across loads.
+typedef std::vector<uint8_t, fioNoInitAllocator<uint8_t> > fioBuffer;
+
+// One buffer of a gather write (see fileWriteGather).
+struct fioIoVec {
+  const void *data;
+  size_t size;
+};
+
 size_t strSize(const char *s);
 bool isBigEndian(void);
 
@@ -214,8 +293,335 @@ bool fwrite_u16(FILE *fp, bool bBigEndian, uint16_t v);
 bool fwrite_u32(FILE *fp, bool bBigEndian, uint32_t v);
 bool fwrite_u64(FILE *fp, bool bBigEndian, uint64_t v);
 
-std::vector<uint8_t> fileLoadBytes(FILE *fp, int64_t len=0);
-bool fileSaveBytes(FILE *fp, std::vector<uint8_t> &v, int64_t len=0);
+// Byte swaps of unsigned integers, compiled to single instructions
+static inline uint8_t fioBswap(uint8_t v) {
+  return v;
+}
+static inline uint16_t fioBswap(uint16_t v) {
+#if defined(__GNUC__)
+  return __builtin_bswap16(v);
+#elif defined(_MSC_VER)
+  return _byteswap_ushort(v);
+#else
+  return (uint16_t)((v >> 8) | (v << 8));
+#endif
+}
+static inline uint32_t fioBswap(uint32_t v) {
+#if defined(__GNUC__)
+  return __builtin_bswap32(v);
+#elif defined(_MSC_VER)
+  return _byteswap_ulong(v);
+#else
+  return ((v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24));
+#endif
+}
+static inline uint64_t fioBswap(uint64_t v) {
+#if defined(__GNUC__)
+  return __builtin_bswap64(v);
+#elif defined(_MSC_VER)
+  return _byteswap_uint64(v);
+#else
+  return ((uint64_t)fioBswap((uint32_t)v) << 32)
+         | fioBswap((uint32_t)(v >> 32));
+#endif
+}
+
+// Unsigned integer type with the size of T
+template <size_t N> struct fioUInt;
+template <> struct fioUInt<1> { typedef uint8_t type; };
+template <> struct fioUInt<2> { typedef uint16_t type; };
+template <> struct fioUInt<4> { typedef uint32_t type; };
+template <> struct fioUInt<8> { typedef uint64_t type; };
+
+// Loads a T stored in byte order Endian from p (any alignment).
+// Same endian loads are a plain load, others a load plus bswap.
+template <typename T, int Endian>
+inline T fioLoad(const uint8_t *p) {
+  typename fioUInt<sizeof(T)>::type u;
+  memcpy(&u, p, sizeof(T));
+  if (Endian != FIO_HOST_ENDIAN) u = fioBswap(u);
+  T v;
+  memcpy(&v, &u, sizeof(T));
+  return v;
+}
+
+// Stores v in byte order Endian at p (any alignment)
+template <typename T, int Endian>
+inline void fioStore(uint8_t *p, T v) {
+  typename fioUInt<sizeof(T)>::type u;
+  memcpy(&u, &v, sizeof(T));
+  if (Endian != FIO_HOST_ENDIAN) u = fioBswap(u);
+  memcpy(p, &u, sizeof(T));
+}
+
+// Reads a T (integer, float or double) in byte order Endian from file
+template <typename T, int Endian>
+bool fread_endian(FILE *fp, T &rv) {
+  if (!fp) return false;
+  uint8_t b[sizeof(T)];
+  if (1 != fread(b, sizeof(T), 1, fp)) {
+    return false;
+  }
+  rv = fioLoad<T, Endian>(b);
+  return true;
+}
+
+// Writes a T (integer, float or double) in byte order Endian to file
+template <typename T, int Endian>
+bool fwrite_endian(FILE *fp, T v) {
+  if (!fp) return false;
+  uint8_t b[sizeof(T)];
+  fioStore<T, Endian>(b, v);
+  return (1 == fwrite(b, sizeof(T), 1, fp));
+}
+
+void bswap_u16_array(uint16_t *v, size_t n);
+void bswap_u32_array(uint32_t *v, size_t n);
+void bswap_u64_array(uint64_t *v, size_t n);
+
+bool fread_u16_array(FILE *fp, bool bBigEndian, uint16_t *dst, size_t n);
+bool fread_i16_array(FILE *fp, bool bBigEndian, int16_t *dst, size_t n);
+bool fread_u32_array(FILE *fp, bool bBigEndian, uint32_t *dst, size_t n);
+bool fread_i32_array(FILE *fp, bool bBigEndian, int32_t *dst, size_t n);
+bool fread_f32_array(FILE *fp, bool bBigEndian, float *dst, size_t n);
+bool fread_u64_array(FILE *fp, bool bBigEndian, uint64_t *dst, size_t n);
+bool fread_i64_array(FILE *fp, bool bBigEndian, int64_t *dst, size_t n);
+bool fread_f64_array(FILE *fp, bool bBigEndian, double *dst, size_t n);
+bool fwrite_u16_array(FILE *fp, bool bBigEndian, const uint16_t *src, size_t n);
+bool fwrite_i16_array(FILE *fp, bool bBigEndian, const int16_t *src, size_t n);
+bool fwrite_u32_array(FILE *fp, bool bBigEndian, const uint32_t *src, size_t n);
+bool fwrite_i32_array(FILE *fp, bool bBigEndian, const int32_t *src, size_t n);
+bool fwrite_f32_array(FILE *fp, bool bBigEndian, const float *src, size_t n);
+bool fwrite_u64_array(FILE *fp, bool bBigEndian, const uint64_t *src, size_t n);
+bool fwrite_i64_array(FILE *fp, bool bBigEndian, const int64_t *src, size_t n);
+bool fwrite_f64_array(FILE *fp, bool bBigEndian, const double *src, size_t n);
+
+// Checksums of FileHasher
+#define FILEHASH_CRC32C 0 // CRC-32C (Castagnoli), 32 bit digest
+#define FILEHASH_XXH64  1 // XXH64, fast non-cryptographic 64 bit digest
+
+// Chunk size of the fused load/save and hash paths in bytes
+#define FILEHASHCHUNK (256 * 1024)
+
+// Streaming checksum over one or more buffers
+class FileHasher {
+public:
+  FileHasher(int algo=FILEHASH_CRC32C, uint64_t seed=0);
+  void reset();
+  void update(const void *data, size_t len);
+  uint64_t digest() const;
+  int algo() const { return m_algo; }
+private:
+  int m_algo;
+  uint64_t m_seed;
+  uint32_t m_crc;
+  uint64_t m_v[4];
+  uint8_t m_mem[32];
+  size_t m_memSize;
+  uint64_t m_total;
+};
+
+int64_t fileHash(FILE *fp, FileHasher &h, int64_t len=0);
+
+int64_t fileReadBytes(FILE *fp, void *dst, int64_t len,
+                      FileHasher *hasher=0);
+std::vector<uint8_t> fileLoadBytes(FILE *fp, int64_t len=0,
+                                   FileHasher *hasher=0);
+int64_t fileLoadBytes(FILE *fp, fioBuffer &buf, int64_t len=0,
+                      FileHasher *hasher=0);
+
+// Default chunk size of the parallel loader in bytes
+#define FILEPARALLELCHUNK (8 * 1024 * 1024)
+
+std::vector<uint8_t> fileLoadBytesParallel(FILE *fp, int64_t len=0,
+                                           int threads=0,
+                                           size_t chunk=FILEPARALLELCHUNK);
+int64_t fileLoadBytesParallel(FILE *fp, fioBuffer &buf, int64_t len=0,
+                              int threads=0, size_t chunk=FILEPARALLELCHUNK);
+bool fileSaveBytes(FILE *fp, const std::vector<uint8_t> &v, int64_t len=0,
+                   FileHasher *hasher=0);
+bool fileWriteBytes(FILE *fp, const void *src, int64_t len,
+                    FileHasher *hasher=0);
+bool fileWriteGather(FILE *fp, const fioIoVec *iov, int count);
+
+// Positional I/O on a file descriptor: pread/pwrite never use or move the
+// file position, so any number of threads can share one descriptor (on
+// windows the position is restored and the calls run one at a time)
+int64_t fileReadAt(int fd, int64_t offset, void *dst, int64_t len);
+bool fileWriteAt(int fd, int64_t offset, const void *src, int64_t len);
+
+// Byte range of fileLoadRanges
+struct FileRange {
+  int64_t offset;
+  int64_t length;
+  void *dst;       // length bytes of caller memory
+  int64_t result;  // bytes read (short at the end of the file) or -1
+};
+
+// Default largest gap between two ranges that are read in one request
+#define FILERANGEGAP (32 * 1024)
+
+int64_t fileLoadRanges(int fd, FileRange *ranges, size_t count,
+                       int64_t maxGap=FILERANGEGAP);
+int64_t fileLoadRanges(FILE *fp, FileRange *ranges, size_t count,
+                       int64_t maxGap=FILERANGEGAP);
+
+// Typed positional reads and writes on one shared descriptor. All methods
+// are const and keep no state besides the descriptor, so threads may use
+// one object concurrently (e.g. random lookups into an index file; on
+// windows the calls are serialized, see fileReadAt).
+class FilePositional {
+public:
+  FilePositional() : m_fd(-1), m_own(false) {}
+  ~FilePositional() { close(); }
+  bool open(const char *fullpath, bool writable=false);
+  bool open(FILE *fp);
+  bool open(int fd);
+  void close();
+
+  int64_t readAt(int64_t offset, void *dst, int64_t len) const {
+    return fileReadAt(m_fd, offset, dst, len);
+  }
+  bool writeAt(int64_t offset, const void *src, int64_t len) const {
+    return fileWriteAt(m_fd, offset, src, len);
+  }
+  template <typename T, int Endian> bool readAt(int64_t offset, T &v) const {
+    uint8_t b[sizeof(T)];
+    if ((int64_t)sizeof(T) != fileReadAt(m_fd, offset, b, sizeof(T))) {
+      return false;
+    }
+    v = fioLoad<T, Endian>(b);
+    return true;
+  }
+  template <typename T, int Endian> bool writeAt(int64_t offset, T v) const {
+    uint8_t b[sizeof(T)];
+    fioStore<T, Endian>(b, v);
+    return fileWriteAt(m_fd, offset, b, sizeof(T));
+  }
+  bool readU8At(int64_t offset, uint8_t &v) const {
+    return readAt<uint8_t, ENDIAN_BIG>(offset, v);
+  }
+  bool readU16At(int64_t offset, bool bBigEndian, uint16_t &v) const {
+    return bBigEndian ? readAt<uint16_t, ENDIAN_BIG>(offset, v)
+                      : readAt<uint16_t, ENDIAN_LITTLE>(offset, v);
+  }
+  bool readU32At(int64_t offset, bool bBigEndian, uint32_t &v) const {
+    return bBigEndian ? readAt<uint32_t, ENDIAN_BIG>(offset, v)
+                      : readAt<uint32_t, ENDIAN_LITTLE>(offset, v);
+  }
+  bool readU64At(int64_t offset, bool bBigEndian, uint64_t &v) const {
+    return bBigEndian ? readAt<uint64_t, ENDIAN_BIG>(offset, v)
+                      : readAt<uint64_t, ENDIAN_LITTLE>(offset, v);
+  }
+  bool writeU8At(int64_t offset, uint8_t v) const {
+    return writeAt<uint8_t, ENDIAN_BIG>(offset, v);
+  }
+  bool writeU16At(int64_t offset, bool bBigEndian, uint16_t v) const {
+    return bBigEndian ? writeAt<uint16_t, ENDIAN_BIG>(offset, v)
+                      : writeAt<uint16_t, ENDIAN_LITTLE>(offset, v);
+  }
+  bool writeU32At(int64_t offset, bool bBigEndian, uint32_t v) const {
+    return bBigEndian ? writeAt<uint32_t, ENDIAN_BIG>(offset, v)
+                      : writeAt<uint32_t, ENDIAN_LITTLE>(offset, v);
+  }
+  bool writeU64At(int64_t offset, bool bBigEndian, uint64_t v) const {
+    return bBigEndian ? writeAt<uint64_t, ENDIAN_BIG>(offset, v)
+                      : writeAt<uint64_t, ENDIAN_LITTLE>(offset, v);
+  }
+  int64_t size() const;
+  int fd() const { return m_fd; }
+private:
+  FilePositional(const FilePositional &);
+  FilePositional& operator=(const FilePositional &);
+  int m_fd;
+  bool m_own;   // m_fd was opened by open(fullpath)
+};
+
+// I/O modes of the path based load and save functions
+#define FILEIO_BUFFERED   0 // page cache (default)
+#define FILEIO_DIRECT     1 // O_DIRECT, bypass the page cache (linux only)
+#define FILEIO_DROPBEHIND 2 // page cache, pages are dropped behind the data
+#define FILEIO_SPARSE     4 // holes: skipped on load, zero runs on save
+
+// Shortest run of zero bytes that FILEIO_SPARSE saves as a hole
+#define FILEHOLEMIN (64 * 1024)
+
+// Alignment and transfer size of FILEIO_DIRECT and FILEIO_DROPBEHIND
+#define FILEDIRECTALIGN 4096
+#define FILEDIRECTCHUNK (4 * 1024 * 1024)
+
+int64_t fileLoadBytes(const char *fullpath, fioBuffer &buf, int ioflags);
+bool fileSaveBytes(const char *fullpath, const void *src, int64_t len,
+                   int ioflags);
+bool fileSaveAtomic(const char *fullpath, const void *src, int64_t len);
+bool fileReserve(FILE *fp, int64_t size, bool keepSize=false);
+
+// Data extent of a file (see FileExtents)
+struct FileExtent {
+  int64_t offset;
+  int64_t length;
+};
+
+// Iterates over the data extents of a file and skips its holes
+// (SEEK_DATA/SEEK_HOLE; the whole range is one extent elsewhere)
+class FileExtents {
+public:
+  FileExtents() : m_fd(-1), m_pos(0), m_end(0) {}
+  bool open(FILE *fp, int64_t offset=0, int64_t length=0);
+  bool open(int fd, int64_t offset=0, int64_t length=0);
+  bool next(FileExtent &e);
+private:
+  int m_fd;
+  int64_t m_pos;
+  int64_t m_end;
+};
+
+// Strategies of fileCopy, from fastest to slowest
+#define FILECOPY_ERROR   -1
+#define FILECOPY_CLONE    0 // reflink (FICLONE), shares the blocks
+#define FILECOPY_RANGE    1 // copy_file_range, in kernel copy
+#define FILECOPY_SENDFILE 2 // sendfile
+#define FILECOPY_BUFFER   3 // read/write loop with a large buffer
+
+// Options of fileCopy
+struct FileCopyOptions {
+  int64_t offset;  // first byte of the source to copy
+  int64_t length;  // bytes to copy (0 = up to the end of the source)
+  bool sparse;     // keep holes of the source as holes
+  int strategy;    // fastest strategy to try (FILECOPY_...)
+  FileCopyOptions() : offset(0), length(0), sparse(true),
+                      strategy(FILECOPY_CLONE) {}
+};
+
+int64_t fileCopy(const char *src, const char *dst,
+                 const FileCopyOptions &opt=FileCopyOptions(),
+                 int *strategy=0);
+
+#ifdef __linux__
+struct FioSaveItem;
+
+// Atomic saves that share their fsyncs in group commits
+class FileSaveGroup {
+public:
+  FileSaveGroup(bool useSyncfs=false);
+  ~FileSaveGroup();
+  bool save(const char *fullpath, const void *src, int64_t len);
+  bool add(const char *fullpath, const void *src, int64_t len);
+  bool commit();
+  uint64_t commits();
+private:
+  FileSaveGroup(const FileSaveGroup &);
+  FileSaveGroup& operator=(const FileSaveGroup &);
+  bool run(std::vector<FioSaveItem *> &items);
+  bool m_syncfs;
+  bool m_leader;
+  uint64_t m_commits;
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::vector<FioSaveItem *> m_pending; // written, waiting for a commit
+  std::vector<FioSaveItem *> m_staged;  // added, waiting for commit()
+};
+#endif
 
 FILE* fileOpen(const char *fullpath, const char *mode);
 int fileClose(FILE *fp);
@@ -227,10 +633,980 @@ int fileType(const char *fullpath);
 time_t fileModificationTime(const char *fullpath);
 bool fileDelete(const char *fullpath);
 
+// File types returned by fileType and fileStat
+#define FILETYPE_ERROR   -1
+#define FILETYPE_FILE     0
+#define FILETYPE_DIR      1
+#define FILETYPE_SYMLINK  2
+#define FILETYPE_OTHER    3
+
+// Metadata snapshot of a file (see fileStat)
+struct FileStat {
+  int64_t size;       // size in bytes
+  int type;           // FILETYPE_...
+  int64_t mtime;      // modification time in seconds since the epoch
+  int32_t mtimeNsec;  // nanosecond part of the modification time
+  uint32_t mode;      // st_mode (type and permission bits)
+  uint64_t inode;     // inode number (0 on windows)
+};
+
+bool fileStat(const char *fullpath, FileStat &st, bool followLinks=true);
+#ifdef __linux__
+size_t fileStatBatch(int dirfd, const char *const *paths, size_t n,
+                     FileStat *out, int threads=0, bool followLinks=true);
+
+// Longest path (in bytes) kept by the metadata cache
+#define FILECACHE_PATHMAX 231
+
+// Counters of the metadata cache (see fileCacheStats)
+struct FileCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t invalidations;
+};
+
+bool fileCacheEnable(int ttlMs=1000, size_t slots=4096);
+void fileCacheDisable();
+bool fileCacheEnabled();
+FileCacheStats fileCacheStats();
+bool fileStatCached(const char *fullpath, FileStat &st);
+#endif
+
+// Access pattern hints for FileView::advise
+#define FILEVIEW_NORMAL     0
+#define FILEVIEW_SEQUENTIAL 1
+#define FILEVIEW_RANDOM     2
+#define FILEVIEW_WILLNEED   3
+#define FILEVIEW_DONTNEED   4
+
+// Read-only memory mapped view of a whole file or of a window of a file.
+// The mapping is released by close() or by the destructor.
+class FileView {
+public:
+  FileView();
+  ~FileView();
+  bool open(const char *fullpath, int64_t offset=0, int64_t len=0);
+  bool open(FILE *fp, int64_t offset=0, int64_t len=0);
+  void close();
+  bool advise(int advice);
+  bool isOpen() const { return m_open; }
+  const uint8_t* data() const { return m_data; }
+  int64_t size() const { return m_size; }
+private:
+  FileView(const FileView &);
+  FileView& operator=(const FileView &);
+#ifdef __linux__
+  bool map(int fd, int64_t offset, int64_t len);
+#elif defined(_WIN32) || defined(WIN32)
+  bool map(HANDLE hFile, int64_t offset, int64_t len);
+#endif
+  bool m_open;
+  void *m_base;        // start of the mapping (page aligned)
+  size_t m_mapLen;     // length of the mapping
+  const uint8_t *m_data;
+  int64_t m_size;
+};
+
+// Default buffer size of FileReader and FileWriter in bytes
+#define FILEBUFFEREDSIZE (256 * 1024)
+
+// Sticky status of FileReader and FileWriter
+#define FIO_OK    0
+#define FIO_EOF   1
+#define FIO_ERROR 2
+
+// Buffered binary reader over a FILE* (from fileOpen) or a file descriptor.
+// Typed reads are inlined and only refill the buffer when it runs dry.
+// Failed reads return 0 and latch the status, so a whole record can be
+// parsed before checking ok() once.
+class FileReader {
+public:
+  FileReader(size_t bufsize=FILEBUFFEREDSIZE);
+  ~FileReader();
+  bool open(FILE *fp);
+  bool open(int fd);
+  void close();
+
+  uint8_t readU8() {
+    uint8_t v = 0;
+    if (m_pos < m_end || refill(1)) {
+      v = m_buf[m_pos++];
+    }
+    return v;
+  }
+  template <typename T, int Endian> T read() {
+    T v = T();
+    if (m_end - m_pos >= sizeof(T) || refill(sizeof(T))) {
+      v = fioLoad<T, Endian>(m_buf + m_pos);
+      m_pos += sizeof(T);
+    }
+    return v;
+  }
+  uint16_t readU16(bool bBigEndian) {
+    return bBigEndian ? read<uint16_t, ENDIAN_BIG>()
+                      : read<uint16_t, ENDIAN_LITTLE>();
+  }
+  uint32_t readU32(bool bBigEndian) {
+    return bBigEndian ? read<uint32_t, ENDIAN_BIG>()
+                      : read<uint32_t, ENDIAN_LITTLE>();
+  }
+  uint64_t readU64(bool bBigEndian) {
+    return bBigEndian ? read<uint64_t, ENDIAN_BIG>()
+                      : read<uint64_t, ENDIAN_LITTLE>();
+  }
+  bool readBytes(void *dst, size_t n);
+  bool skip(int64_t n);
+  bool seek(int64_t pos);
+  int64_t tell() const { return m_filePos - (int64_t)(m_end - m_pos); }
+  int status() const { return m_status; }
+  int error() const { return m_errno; }
+  bool ok() const { return m_status == FIO_OK; }
+private:
+  FileReader(const FileReader &);
+  FileReader& operator=(const FileReader &);
+  bool start(int64_t pos);
+  bool refill(size_t need);
+  int64_t fill(void *dst, size_t n);
+  void fail(int status, int err);
+  uint8_t *m_buf;
+  size_t m_cap;
+  size_t m_pos;       // next byte in the buffer
+  size_t m_end;       // end of valid bytes in the buffer
+  int64_t m_filePos;  // file offset of m_buf[m_end]
+  FILE *m_fp;
+  int m_fd;
+  bool m_seekable;
+  int m_status;
+  int m_errno;
+};
+
+
+// Buffered binary writer over a FILE* (from fileOpen) or a file descriptor.
+// Full buffers are flushed in chunks that end on an align boundary of the
+// file, the rest stays buffered. The first write error is latched with its
+// errno and file offset; all later writes are dropped.
+class FileWriter {
+public:
+  FileWriter(size_t bufsize=FILEBUFFEREDSIZE, size_t align=4096);
+  ~FileWriter();
+  bool open(FILE *fp);
+  bool open(int fd);
+  bool close();
+
+  bool writeU8(uint8_t v) {
+    if (m_len == m_cap && !drain(1)) return false;
+    m_buf[m_len++] = v;
+    return true;
+  }
+  template <typename T, int Endian> bool write(T v) {
+    if (m_cap - m_len < sizeof(T) && !drain(sizeof(T))) return false;
+    fioStore<T, Endian>(m_buf + m_len, v);
+    m_len += sizeof(T);
+    return true;
+  }
+  bool writeU16(bool bBigEndian, uint16_t v) {
+    return bBigEndian ? write<uint16_t, ENDIAN_BIG>(v)
+                      : write<uint16_t, ENDIAN_LITTLE>(v);
+  }
+  bool writeU32(bool bBigEndian, uint32_t v) {
+    return bBigEndian ? write<uint32_t, ENDIAN_BIG>(v)
+                      : write<uint32_t, ENDIAN_LITTLE>(v);
+  }
+  bool writeU64(bool bBigEndian, uint64_t v) {
+    return bBigEndian ? write<uint64_t, ENDIAN_BIG>(v)
+                      : write<uint64_t, ENDIAN_LITTLE>(v);
+  }
+  uint8_t* reserve(size_t n) {
+    if (n > m_cap || (m_cap - m_len < n && !drain(n))) return 0;
+    uint8_t *p = m_buf + m_len;
+    m_len += n;
+    return p;
+  }
+  bool writeBytes(const void *src, size_t n);
+  bool flush();
+  int64_t tell() const {
+    return m_filePos + (m_status == FIO_OK ? (int64_t)m_len : 0);
+  }
+  int status() const { return m_status; }
+  int error() const { return m_errno; }
+  int64_t errorOffset() const { return m_errorOffset; }
+  bool ok() const { return m_status == FIO_OK; }
+private:
+  FileWriter(const FileWriter &);
+  FileWriter& operator=(const FileWriter &);
+  bool start(int64_t pos);
+  bool drain(size_t need);
+  bool put(const uint8_t *p, size_t n);
+  uint8_t *m_buf;
+  size_t m_cap;
+  size_t m_align;
+  size_t m_len;       // buffered bytes (m_cap unless the status is FIO_OK)
+  int64_t m_filePos;  // file offset of m_buf[0]
+  FILE *m_fp;
+  int m_fd;
+  bool m_seekable;
+  int m_status;
+  int m_errno;
+  int64_t m_errorOffset;
+};
+
+// Default chunk size of fileForEachChunk and FileChunks in bytes
+#define FILECHUNKSIZE (4 * 1024 * 1024)
+
+// Read-only view of one chunk of a file (see FileChunks)
+struct FileChunk {
+  const uint8_t *data;  // overlap bytes of the previous chunk, then new bytes
+  size_t size;          // overlap + new bytes
+  size_t overlap;       // leading bytes repeated from the previous chunk
+  int64_t offset;       // file offset of data[0]
+};
+
+// Returns false to stop fileForEachChunk
+typedef std::function<bool(const FileChunk &c)> FileChunkCallback;
+
+// Streams a file opened with fileOpen in chunks of chunkSize new bytes,
+// each preceded by the last overlap bytes of the chunk before (lookback
+// for parsers). Two buffers are allocated once and used in turn, so the
+// memory stays the same for any file size and the previous chunk stays
+// valid until the next one is read. Usable with range-for:
+//   for (const FileChunk &c : FileChunks(fp)) ...
+class FileChunks {
+public:
+  FileChunks(FILE *fp, size_t chunkSize=FILECHUNKSIZE, size_t overlap=0);
+  ~FileChunks();
+  bool next();
+  const FileChunk& chunk() const { return m_chunk; }
+  int status() const { return m_status; }
+  int error() const { return m_errno; }
+  bool ok() const { return m_status != FIO_ERROR; }
+
+  class iterator {
+  public:
+    explicit iterator(FileChunks *owner) : m_owner(owner) {}
+    const FileChunk& operator*() const { return m_owner->m_chunk; }
+    const FileChunk* operator->() const { return &m_owner->m_chunk; }
+    iterator& operator++() {
+      if (!m_owner->next()) m_owner = 0;
+      return *this;
+    }
+    bool operator==(const iterator &o) const { return m_owner == o.m_owner; }
+    bool operator!=(const iterator &o) const { return m_owner != o.m_owner; }
+  private:
+    FileChunks *m_owner;  // 0 at the end
+  };
+  iterator begin() { return iterator(next() ? this : 0); }
+  iterator end() { return iterator(0); }
+private:
+  FileChunks(const FileChunks &);
+  FileChunks& operator=(const FileChunks &);
+  FILE *m_fp;
+  size_t m_chunkSize;
+  size_t m_overlap;
+  uint8_t *m_bufs[2];
+  int m_cur;            // buffer of the current chunk
+  int64_t m_filePos;    // file offset of the next new byte
+  FileChunk m_chunk;
+  int m_status;
+  int m_errno;
+};
+
+int64_t fileForEachChunk(FILE *fp, size_t chunkSize,
+                         const FileChunkCallback &cb, size_t overlap=0);
+
+#ifdef __linux__
+// Default number of buffers of FilePrefetchReader
+#define FILEPREFETCHBUFS 4
+
+// Sequential reader with read-ahead: a background thread keeps up to
+// buffers chunks of bufsize bytes filled while the consumer works on the
+// current one. The kernel is told with posix_fadvise(SEQUENTIAL) and
+// readahead() to fetch the next chunk while the current one is read.
+class FilePrefetchReader {
+public:
+  FilePrefetchReader(size_t bufsize=FILECHUNKSIZE,
+                     int buffers=FILEPREFETCHBUFS);
+  ~FilePrefetchReader();
+  bool open(FILE *fp);
+  bool open(int fd);
+  void close();
+  bool next(FileChunk &c);
+  int status() const { return m_status; }
+  int error() const { return m_errno; }
+  bool ok() const { return m_status != FIO_ERROR; }
+private:
+  FilePrefetchReader(const FilePrefetchReader &);
+  FilePrefetchReader& operator=(const FilePrefetchReader &);
+  bool start(int64_t pos);
+  void worker();
+  size_t m_cap;
+  int m_count;
+  uint8_t **m_bufs;
+  size_t *m_sizes;      // bytes in each buffer
+  FILE *m_fp;
+  int m_fd;
+  int64_t m_start;      // file offset of the first chunk (-1: not seekable)
+  int64_t m_pos;        // file offset after the last chunk handed out
+  uint64_t m_filled;    // chunks read by the worker
+  uint64_t m_consumed;  // chunks given back by the consumer
+  bool m_holding;       // the consumer holds chunk m_consumed
+  bool m_done;          // the worker reached the end or an error
+  bool m_stop;
+  int m_endStatus;      // FIO_EOF or FIO_ERROR of the worker
+  int m_status;
+  int m_errno;
+  std::thread m_thread;
+  std::mutex m_mtx;
+  std::condition_variable m_fullCv;
+  std::condition_variable m_freeCv;
+};
+
+// Default number of buffers of FileFlushWriter
+#define FILEFLUSHBUFS 4
+
+// Sequential writer that hands full buffers to a background thread, so
+// the producer only copies. The buffers come from a fixed pool; when all
+// of them wait for the disk the producer blocks (backpressure). With
+// syncEvery the written data is pushed out by sync_file_range every
+// syncEvery bytes, so dirty pages cannot pile up into long stalls.
+class FileFlushWriter {
+public:
+  FileFlushWriter(size_t bufsize=FILECHUNKSIZE, int buffers=FILEFLUSHBUFS,
+                  int64_t syncEvery=0);
+  ~FileFlushWriter();
+  bool open(FILE *fp);
+  bool open(int fd);
+  bool close();
+
+  template <typename T, int Endian> bool write(T v) {
+    if (m_cap - m_len < sizeof(T)) {
+      uint8_t b[sizeof(T)];
+      fioStore<T, Endian>(b, v);
+      return writeBytes(b, sizeof(T));
+    }
+    fioStore<T, Endian>(m_cur + m_len, v);
+    m_len += sizeof(T);
+    return true;
+  }
+  bool writeU8(uint8_t v) {
+    return write<uint8_t, ENDIAN_BIG>(v);
+  }
+  bool writeU16(bool bBigEndian, uint16_t v) {
+    return bBigEndian ? write<uint16_t, ENDIAN_BIG>(v)
+                      : write<uint16_t, ENDIAN_LITTLE>(v);
+  }
+  bool writeU32(bool bBigEndian, uint32_t v) {
+    return bBigEndian ? write<uint32_t, ENDIAN_BIG>(v)
+                      : write<uint32_t, ENDIAN_LITTLE>(v);
+  }
+  bool writeU64(bool bBigEndian, uint64_t v) {
+    return bBigEndian ? write<uint64_t, ENDIAN_BIG>(v)
+                      : write<uint64_t, ENDIAN_LITTLE>(v);
+  }
+  bool writeBytes(const void *src, size_t n);
+  bool flush();
+  int64_t tell() const { return m_filePos + (m_cur ? (int64_t)m_len : 0); }
+  int status() const { return m_status; }
+  int error() const { return m_errno; }
+  bool ok() const { return m_status == FIO_OK; }
+private:
+  FileFlushWriter(const FileFlushWriter &);
+  FileFlushWriter& operator=(const FileFlushWriter &);
+  bool start(int64_t pos);
+  bool submit();
+  void worker(int64_t pos);
+  size_t m_cap;
+  int m_count;
+  int64_t m_syncEvery;
+  uint8_t **m_bufs;
+  size_t *m_sizes;      // bytes of each queued buffer
+  uint8_t *m_cur;       // buffer being filled (0 while closed)
+  size_t m_len;         // bytes in m_cur (m_cap while closed)
+  FILE *m_fp;
+  int m_fd;
+  bool m_seekable;
+  int64_t m_filePos;    // file offset of m_cur[0]
+  uint64_t m_queued;    // buffers handed to the worker
+  uint64_t m_written;   // buffers written by the worker
+  bool m_stop;
+  std::atomic<int> m_status;  // latched by the worker
+  std::atomic<int> m_errno;
+  std::thread m_thread;
+  std::mutex m_mtx;
+  std::condition_variable m_queuedCv;
+  std::condition_variable m_writtenCv;
+};
+#endif
+
+#ifdef __linux__
+// Engines of FileAsync
+#define FILEASYNC_NONE    0
+#define FILEASYNC_URING   1
+#define FILEASYNC_THREADS 2
+
+// Completion callback: bytes transferred or a negative errno
+typedef std::function<void(int64_t result)> FileAsyncCallback;
+
+struct FioAsyncReq;
+
+// Asynchronous positional reads and writes plus whole file loads and saves.
+// Requests go to io_uring (raw system calls, no liburing) or, where that
+// is not available, to a pool of threads doing pread/pwrite. Short
+// transfers are resubmitted internally. Callbacks always run in the calling
+// thread: in poll(), wait() and drain(), and in read(), write(), loadFile()
+// and saveFile() when these wait for a free slot.
+class FileAsync {
+public:
+  FileAsync();
+  ~FileAsync();
+  bool open(unsigned int depth=32, int threads=4, bool useUring=true);
+  void close();
+  int engine() const { return m_engine; }
+  bool read(int fd, int64_t offset, void *dst, size_t len,
+            const FileAsyncCallback &cb);
+  bool write(int fd, int64_t offset, const void *src, size_t len,
+             const FileAsyncCallback &cb);
+  bool loadFile(const char *fullpath, fioBuffer &buf,
+                const FileAsyncCallback &cb);
+  bool saveFile(const char *fullpath, const void *src, size_t len,
+                const FileAsyncCallback &cb);
+  bool submit();
+  int poll();
+  int wait(size_t n=1);
+  void drain();
+  size_t pending() const { return m_pending; }
+private:
+  FileAsync(const FileAsync &);
+  FileAsync& operator=(const FileAsync &);
+  bool queue(FioAsyncReq *r);
+  bool push(FioAsyncReq *r);
+  int reap(size_t minComplete);
+  int finish(FioAsyncReq *r, int64_t res);
+  bool uringOpen(unsigned int depth);
+  void uringClose();
+  void worker();
+
+  int m_engine;
+  size_t m_pending;   // requests not completed yet
+  size_t m_inflight;  // requests handed to the engine
+  unsigned int m_depth;
+  // io_uring
+  int m_ringFd;
+  void *m_sqPtr;
+  size_t m_sqLen;
+  void *m_cqPtr;
+  size_t m_cqLen;
+  void *m_sqes;
+  size_t m_sqesLen;
+  unsigned int *m_sqHead;
+  unsigned int *m_sqTail;
+  unsigned int *m_sqMask;
+  unsigned int *m_sqArray;
+  unsigned int *m_cqHead;
+  unsigned int *m_cqTail;
+  unsigned int *m_cqMask;
+  void *m_cqes;
+  unsigned int m_toSubmit;
+  // thread pool
+  std::vector<std::thread> m_threads;
+  std::mutex m_mtx;
+  std::condition_variable m_workCv;
+  std::condition_variable m_doneCv;
+  std::deque<FioAsyncReq *> m_work;
+  std::deque<std::pair<FioAsyncReq *, int64_t> > m_done;
+  bool m_stop;
+};
+
+int64_t fileLoadRanges(FileAsync &async, int fd, FileRange *ranges,
+                       size_t count, int64_t maxGap=FILERANGEGAP);
+#endif
+
+#ifdef __linux__
+// Sync policies of FileAppendLog
+#define FILELOG_SYNC_NONE     0 // no fdatasync, waits end once written
+#define FILELOG_SYNC_INTERVAL 1 // fdatasync every syncInterval milliseconds
+#define FILELOG_SYNC_EVERY    2 // fdatasync every syncEvery records
+
+// Default and largest ring size of FileAppendLog in bytes (a power of 2)
+#define FILELOGRINGSIZE (4 * 1024 * 1024)
+#define FILELOGRINGMAX  ((size_t)1 << 30)
+
+// Options of FileAppendLog
+struct FileLogOptions {
+  size_t ringSize;      // bytes, rounded up to a power of 2 (<= 1 GiB)
+  int syncPolicy;       // FILELOG_SYNC_...
+  int syncInterval;     // milliseconds, at least 1 (FILELOG_SYNC_INTERVAL)
+  uint64_t syncEvery;   // records (FILELOG_SYNC_EVERY)
+  bool bigEndian;       // byte order of the length prefix
+  FileLogOptions()
+    : ringSize(FILELOGRINGSIZE), syncPolicy(FILELOG_SYNC_NONE),
+      syncInterval(100), syncEvery(1000), bigEndian(true) {}
+};
+
+// Append-only log of records framed by a 32 bit length (like fwrite_u32
+// followed by the bytes). Any number of threads append without a lock:
+// they reserve space in a ring with a compare and swap and copy their
+// record; one flusher thread writes all ready records with large writes
+// and syncs them by the policy. append() returns a ticket, wait(ticket)
+// blocks until that record is durable.
+class FileAppendLog {
+public:
+  FileAppendLog();
+  ~FileAppendLog();
+  bool open(const char *fullpath, const FileLogOptions &opt=FileLogOptions());
+  bool close();
+  uint64_t append(const void *src, uint32_t len);
+  bool wait(uint64_t ticket);
+  bool sync();
+  uint64_t written() const { return m_written.load(); }
+  uint64_t durable() const { return m_durable.load(); }
+  int error() const { return m_errno.load(); }
+private:
+  FileAppendLog(const FileAppendLog &);
+  FileAppendLog& operator=(const FileAppendLog &);
+  void copyIn(uint64_t pos, const void *src, size_t n);
+  void copyOut(uint64_t pos, void *dst, size_t n) const;
+  bool ready(uint64_t pos) const;
+  bool writeOut(uint64_t from, uint64_t to);
+  void wake();
+  void flusher();
+
+  FileLogOptions m_opt;
+  int m_fd;
+  uint8_t *m_ring;
+  uint64_t m_mask;
+  std::atomic<uint64_t> *m_ready;    // bit per ring byte: record starts here
+  std::atomic<uint64_t> m_head;      // end of the reserved bytes
+  std::atomic<uint64_t> m_tail;      // end of the bytes written to the file
+  std::atomic<uint64_t> m_written;
+  std::atomic<uint64_t> m_durable;
+  std::atomic<uint64_t> m_syncWanted;
+  std::atomic<int> m_errno;
+  std::atomic<bool> m_sleeping;
+  std::atomic<int> m_waiters;
+  bool m_stop;
+  std::thread m_thread;
+  std::mutex m_mtx;
+  std::condition_variable m_cv;      // wakes the flusher
+  std::condition_variable m_doneCv;  // wakes producers and waiters
+};
+#endif
+
+
+#ifdef __linux__
+// Entry of a directory listing (see FileDir::next)
+struct FileDirEntry {
+  const char *name;  // valid until the next call of FileDir::next
+  int type;          // FILETYPE_... (a symlink is FILETYPE_SYMLINK)
+  uint64_t inode;
+};
+
+// Directory listing with getdents64 and a large buffer. The entry type is
+// taken from d_type, so no stat is needed; sizes are fetched on request.
+class FileDir {
+public:
+  FileDir(size_t bufsize=65536);
+  ~FileDir();
+  bool open(const char *fullpath);
+  bool openAt(int dirfd, const char *name);
+  void close();
+  bool next(FileDirEntry &e);
+  int64_t size(const FileDirEntry &e) const;
+  int fd() const { return m_fd; }
+  int error() const { return m_errno; }
+private:
+  FileDir(const FileDir &);
+  FileDir& operator=(const FileDir &);
+  int m_fd;
+  uint8_t *m_buf;
+  size_t m_cap;
+  size_t m_pos;
+  size_t m_len;
+  int m_errno;
+};
+
+// Entry passed to the visitor of fileWalk
+struct FileWalkEntry {
+  const char *path;  // root + '/' + relative path of the entry
+  const char *name;
+  int type;          // FILETYPE_... (the target type if links are followed)
+  int depth;         // 0 for entries of root
+  int dirfd;         // descriptor of the parent directory
+  int64_t size() const;
+};
+
+// Options of fileWalk
+struct FileWalkOptions {
+  int maxDepth;      // deepest level to descend into (-1 = unlimited)
+  bool followLinks;  // descend into symlinked directories (loop safe)
+  int threads;       // 1 = calling thread only, 0 = one per cpu
+  FileWalkOptions() : maxDepth(-1), followLinks(false), threads(1) {}
+};
+
+// Returns false for a directory to skip its contents
+typedef std::function<bool(const FileWalkEntry &e)> FileWalkVisitor;
+
+int64_t fileWalk(const char *root, const FileWalkVisitor &visit,
+                 const FileWalkOptions &opt=FileWalkOptions());
+#endif
+
+// Functions counted by the instrumentation (compile with -DFIO_STATS)
+#define FIOSTAT_FILEOPEN         0
+#define FIOSTAT_FILECLOSE        1
+#define FIOSTAT_FREAD_U8         2
+#define FIOSTAT_FREAD_U16        3
+#define FIOSTAT_FREAD_U32        4
+#define FIOSTAT_FREAD_U64        5
+#define FIOSTAT_FWRITE_U8        6
+#define FIOSTAT_FWRITE_U16       7
+#define FIOSTAT_FWRITE_U32       8
+#define FIOSTAT_FWRITE_U64       9
+#define FIOSTAT_FREAD_ARRAY      10
+#define FIOSTAT_FWRITE_ARRAY     11
+#define FIOSTAT_FILEREADBYTES    12
+#define FIOSTAT_FILELOADBYTES    13
+#define FIOSTAT_FILELOADPARALLEL 14
+#define FIOSTAT_FILESAVEBYTES    15
+#define FIOSTAT_FILEWRITEBYTES   16
+#define FIOSTAT_FILEWRITEGATHER  17
+#define FIOSTAT_FILESAVEATOMIC   18
+#define FIOSTAT_FILEHASH         19
+#define FIOSTAT_FILESIZE         20
+#define FIOSTAT_FILEREADABLE     21
+#define FIOSTAT_FILEEXISTS       22
+#define FIOSTAT_FILETYPE         23
+#define FIOSTAT_FILEMTIME        24
+#define FIOSTAT_FILESTAT         25
+#define FIOSTAT_FILEDELETE       26
+#define FIOSTAT_FILEREADER       27 // kernel reads of the buffer
+#define FIOSTAT_FILEWRITER       28 // kernel writes of the buffer
+#define FIOSTAT_FILEVIEW         29
+#define FIOSTAT_FILESTATBATCH    30
+#define FIOSTAT_FILECOPY         31
+#define FIOSTAT_FILERESERVE      32
+#define FIOSTAT_FILEREADAT       33
+#define FIOSTAT_FILEWRITEAT      34
+#define FIOSTAT_FILELOADRANGES   35
+#define FIOSTAT_FILEASYNC        36 // queued requests
+#define FIOSTAT_FILEAPPENDLOG    37
+#define FIOSTAT_FILEWALK         38
+#define FIOSTAT_COUNT 39
+
+// Latency buckets: bucket i counts calls of less than 2^i nanoseconds
+#define FIOSTAT_BUCKETS 40
+
+// Counters of one function (see fileStatsSnapshot)
+struct FileStatsCounter {
+  const char *name;
+  uint64_t calls;
+  uint64_t bytes;   // bytes moved by successfull calls
+  uint64_t errors;
+  uint64_t hist[FIOSTAT_BUCKETS];
+};
+
+bool fileStatsSnapshot(std::vector<FileStatsCounter> &out);
+void fileStatsReset();
+uint64_t fileStatsPercentile(const FileStatsCounter &c, double q);
+bool fileStatsDump(FILE *fp);
+
 // ****************
 //  IMPLEMENTATION
 // ****************
 
+#ifdef FIO_STATS
+static const char *const fioStatNames[FIOSTAT_COUNT] = {
+  "fileOpen",
+  "fileClose",
+  "fread_u8",
+  "fread_u16",
+  "fread_u32",
+  "fread_u64",
+  "fwrite_u8",
+  "fwrite_u16",
+  "fwrite_u32",
+  "fwrite_u64",
+  "fread_*_array",
+  "fwrite_*_array",
+  "fileReadBytes",
+  "fileLoadBytes",
+  "fileLoadBytesParallel",
+  "fileSaveBytes",
+  "fileWriteBytes",
+  "fileWriteGather",
+  "fileSaveAtomic",
+  "fileHash",
+  "fileSize",
+  "fileReadable",
+  "fileExists",
+  "fileType",
+  "fileModificationTime",
+  "fileStat",
+  "fileDelete",
+  "FileReader::read",
+  "FileWriter::write",
+  "FileView::open",
+  "fileStatBatch",
+  "fileCopy",
+  "fileReserve",
+  "fileReadAt",
+  "fileWriteAt",
+  "fileLoadRanges",
+  "FileAsync::queue",
+  "FileAppendLog::append",
+  "fileWalk"
+};
+
+// Counters of one thread, written by their owner only
+struct FioStatBlock {
+  std::atomic<uint64_t> calls[FIOSTAT_COUNT];
+  std::atomic<uint64_t> bytes[FIOSTAT_COUNT];
+  std::atomic<uint64_t> errors[FIOSTAT_COUNT];
+  std::atomic<uint64_t> hist[FIOSTAT_COUNT][FIOSTAT_BUCKETS];
+  FioStatBlock() {
+    for (int i = 0; i < FIOSTAT_COUNT; i++) {
+      calls[i] = 0;
+      bytes[i] = 0;
+      errors[i] = 0;
+      for (int b = 0; b < FIOSTAT_BUCKETS; b++) {
+        hist[i][b] = 0;
+      }
+    }
+  }
+};
+
+// All blocks ever handed out; blocks of ended threads are reused, so the
+// sums stay exact. base holds the sums at the last fileStatsReset.
+struct FioStatRegistry {
+  std::mutex mtx;
+  std::vector<FioStatBlock *> blocks;
+  std::vector<FioStatBlock *> unused;
+  std::vector<FileStatsCounter> base;
+};
+
+// The registry is never destroyed, it outlives all thread exits
+static FioStatRegistry& fioStatRegistry() {
+  static FioStatRegistry *reg = new FioStatRegistry();
+  return *reg;
+}
+
+// Binds a block to the current thread for its lifetime
+struct FioStatOwner {
+  FioStatBlock *block;
+  FioStatOwner() {
+    FioStatRegistry &reg = fioStatRegistry();
+    std::lock_guard<std::mutex> lock(reg.mtx);
+    if (reg.unused.empty()) {
+      block = new FioStatBlock();
+      reg.blocks.push_back(block);
+    } else {
+      block = reg.unused.back();
+      reg.unused.pop_back();
+    }
+  }
+  ~FioStatOwner() {
+    FioStatRegistry &reg = fioStatRegistry();
+    std::lock_guard<std::mutex> lock(reg.mtx);
+    reg.unused.push_back(block);
+  }
+};
+
+static FioStatBlock* fioStatBlock() {
+  static thread_local FioStatOwner owner;
+  return owner.block;
+}
+
+// Single writer increment, no locked instruction needed
+static inline void fioStatAdd(std::atomic<uint64_t> &c, uint64_t v) {
+  c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+// Depth of the counted calls of the current thread
+static int& fioStatDepth() {
+  static thread_local int depth = 0;
+  return depth;
+}
+
+// Counts one call of a function with its latency, bytes and result.
+// Only the outermost call is counted: the fio functions that another one
+// calls on its way (e.g. fileSaveBytes -> fileWriteBytes) are not.
+class FioStatScope {
+public:
+  // bytes are counted on success; resultBytes takes them from the result
+  FioStatScope(int id, int64_t bytes, bool resultBytes)
+    : m_id(id), m_bytes(bytes), m_resultBytes(resultBytes), m_error(false),
+      m_outer(fioStatDepth()++ == 0) {
+    if (m_outer) m_t0 = std::chrono::steady_clock::now();
+  }
+  ~FioStatScope() {
+    fioStatDepth()--;
+    if (!m_outer) return;
+    const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - m_t0).count();
+    FioStatBlock *b = fioStatBlock();
+    fioStatAdd(b->calls[m_id], 1);
+    if (m_error) {
+      fioStatAdd(b->errors[m_id], 1);
+    } else if (m_bytes > 0) {
+      fioStatAdd(b->bytes[m_id], m_bytes);
+    }
+    int bucket = 0;
+    while (bucket < FIOSTAT_BUCKETS - 1 && (ns >> bucket) > 0) {
+      bucket++;
+    }
+    fioStatAdd(b->hist[m_id][bucket], 1);
+  }
+  void addBytes(int64_t n) { m_bytes += n; }
+  void error() { m_error = true; }
+  bool result(bool v) {
+    if (!v) m_error = true;
+    return v;
+  }
+  int result(int v) {
+    if (v < 0) m_error = true;
+    return v;
+  }
+  int64_t result(int64_t v) {
+    if (v < 0) {
+      m_error = true;
+    } else if (m_resultBytes) {
+      m_bytes = v;
+    }
+    return v;
+  }
+  FILE* result(FILE *v) {
+    if (!v) m_error = true;
+    return v;
+  }
+private:
+  int m_id;
+  int64_t m_bytes;
+  bool m_resultBytes;
+  bool m_error;
+  bool m_outer;  // not called from another counted function
+  std::chrono::steady_clock::time_point m_t0;
+};
+
+// Runs a caller's callback as if no fio function were active, so its
+// fio calls are counted
+class FioStatUser {
+public:
+  FioStatUser() : m_depth(fioStatDepth()) { fioStatDepth() = 0; }
+  ~FioStatUser() { fioStatDepth() = m_depth; }
+private:
+  int m_depth;
+};
+
+#define FIO_STAT_CALL(id) FioStatScope fioStat_(id, 0, false)
+#define FIO_STAT_IO(id, n) FioStatScope fioStat_(id, n, false)
+#define FIO_STAT_XFER(id) FioStatScope fioStat_(id, 0, true)
+#define FIO_STAT_ADDBYTES(n) fioStat_.addBytes(n)
+#define FIO_STAT_ERROR() fioStat_.error()
+#define FIO_STAT_RETURN(v) return fioStat_.result(v)
+#define FIO_STAT_USER() FioStatUser fioStatUser_
+#else
+#define FIO_STAT_CALL(id)
+#define FIO_STAT_IO(id, n)
+#define FIO_STAT_XFER(id)
+#define FIO_STAT_ADDBYTES(n)
+#define FIO_STAT_ERROR()
+#define FIO_STAT_RETURN(v) return v
+#define FIO_STAT_USER()
+#endif
+
+// Fills out with the counters of all functions since the last
+// fileStatsReset, summed over all threads.
+// Returns false if fio was compiled without FIO_STATS (out is empty).
+bool fileStatsSnapshot(std::vector<FileStatsCounter> &out) {
+  out.clear();
+#ifdef FIO_STATS
+  out.resize(FIOSTAT_COUNT);
+  memset(&out[0], 0, sizeof(FileStatsCounter) * FIOSTAT_COUNT);
+  FioStatRegistry &reg = fioStatRegistry();
+  std::lock_guard<std::mutex> lock(reg.mtx);
+  for (size_t k = 0; k < reg.blocks.size(); k++) {
+    const FioStatBlock *b = reg.blocks[k];
+    for (int i = 0; i < FIOSTAT_COUNT; i++) {
+      out[i].calls += b->calls[i].load(std::memory_order_relaxed);
+      out[i].bytes += b->bytes[i].load(std::memory_order_relaxed);
+      out[i].errors += b->errors[i].load(std::memory_order_relaxed);
+      for (int j = 0; j < FIOSTAT_BUCKETS; j++) {
+        out[i].hist[j] += b->hist[i][j].load(std::memory_order_relaxed);
+      }
+    }
+  }
+  for (int i = 0; i < FIOSTAT_COUNT; i++) {
+    out[i].name = fioStatNames[i];
+    if (reg.base.empty()) continue;
+    out[i].calls -= reg.base[i].calls;
+    out[i].bytes -= reg.base[i].bytes;
+    out[i].errors -= reg.base[i].errors;
+    for (int j = 0; j < FIOSTAT_BUCKETS; j++) {
+      out[i].hist[j] -= reg.base[i].hist[j];
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Starts counting from zero again
+void fileStatsReset() {
+#ifdef FIO_STATS
+  std::vector<FileStatsCounter> now;
+  fileStatsSnapshot(now);
+  FioStatRegistry &reg = fioStatRegistry();
+  std::lock_guard<std::mutex> lock(reg.mtx);
+  if (reg.base.empty()) {
+    reg.base = now;
+    return;
+  }
+  for (int i = 0; i < FIOSTAT_COUNT; i++) {
+    reg.base[i].calls += now[i].calls;
+    reg.base[i].bytes += now[i].bytes;
+    reg.base[i].errors += now[i].errors;
+    for (int j = 0; j < FIOSTAT_BUCKETS; j++) {
+      reg.base[i].hist[j] += now[i].hist[j];
+    }
+  }
+#endif
+}
+
+// Returns the latency in nanoseconds (upper bucket bound) below which the
+// fraction q (e.g. 0.99) of the calls in c lies, 0 if there are no calls.
+uint64_t fileStatsPercentile(const FileStatsCounter &c, double q) {
+  uint64_t total = 0;
+  for (int j = 0; j < FIOSTAT_BUCKETS; j++) {
+    total += c.hist[j];
+  }
+  if (total == 0) return 0;
+  const uint64_t rank = (uint64_t)(q * total + 0.5);
+  uint64_t seen = 0;
+  for (int j = 0; j < FIOSTAT_BUCKETS; j++) {
+    seen += c.hist[j];
+    if (seen >= rank && seen > 0) return (uint64_t)1 << j;
+  }
+  return (uint64_t)1 << (FIOSTAT_BUCKETS - 1);
+}
+
+// Writes the counters of all called functions as JSON into fp
+// Returns false if fio was compiled without FIO_STATS or on errors.
+bool fileStatsDump(FILE *fp) {
+  std::vector<FileStatsCounter> v;
+  if (!fp || !fileStatsSnapshot(v)) return false;
+  bool first = true;
+  fprintf(fp, "{");
+  for (size_t i = 0; i < v.size(); i++) {
+    if (v[i].calls == 0) continue;
+    fprintf(fp, "%s\n  \"%s\": {\"calls\": %" PRIu64 ", \"bytes\": %"
+            PRIu64 ", \"errors\": %" PRIu64 ", \"p50_ns\": %" PRIu64
+            ", \"p99_ns\": %" PRIu64 "}", first ? "" : ",", v[i].name,
+            v[i].calls, v[i].bytes, v[i].errors,
+            fileStatsPercentile(v[i], 0.5), fileStatsPercentile(v[i], 0.99));
+    first = false;
+  }
+  return fprintf(fp, "\n}\n") > 0;
+}
+
 // Returns string size in bytes
 size_t strSize(const char *s) {
   size_t ret = 0;
@@ -247,11 +1623,7 @@ size_t strSize(const char *s) {
 
 // Returns true on big endian computers otherwise false
 bool isBigEndian(void) {
-  union {
-    uint32_t i;
-    char c[4];
-  } bint = {0x01020304};
-  return (bint.c[0] == 1);
+  return (FIO_HOST_ENDIAN == ENDIAN_BIG);
 }
 
 // Swap little endian/big endian (int16_t)
@@ -261,7 +1633,7 @@ int16_t bswap_16(int16_t v) {
 
 // Swap little endian/big endian (uint16_t)
 uint16_t bswap_u16(uint16_t v) {
-  return ((((v)>>8)&0xff) | (((v)&0xff)<<8));
+  return fioBswap(v);
 }
 
 // Swap little endian/big endian (int32_t)
@@ -271,758 +1643,6702 @@ int32_t bswap_32(int32_t v) {
 
 // Swap little endian/big endian (uint32_t)
 uint32_t bswap_u32(uint32_t v) {
-  return ((((v) & 0xff000000) >> 24)
-          | (((v) & 0x00ff0000) >>  8) |
-          (((v) & 0x0000ff00) << 8)
-          | (((v) & 0x000000ff) << 24));
+  return fioBswap(v);
 }
 
 // Swap little endian/big endian (int64_t)
 int64_t bswap_64(int64_t v) {
-  return (int64_t)bswap_u32((uint64_t)(v));
+  return (int64_t)bswap_u64((uint64_t)(v));
 }
 
 // Swap little endian/big endian (uint64_t)
 uint64_t bswap_u64(uint64_t v) {
-  v = ((v<<8) & 0xFF00FF00FF00FF00ULL)
-    | ((v>>8) & 0x00FF00FF00FF00FFULL);
-  v = ((v<<16) & 0xFFFF0000FFFF0000ULL)
-    | ((v>>16) & 0x0000FFFF0000FFFFULL);
-  return ((v<<32) | ((v>>32) & 0xFFFFFFFFULL));
+  return fioBswap(v);
 }
 
 // Read single byte from file
 bool fread_u8(FILE *fp, uint8_t &rv) {
- if (!fp) return false;
+  FIO_STAT_IO(FIOSTAT_FREAD_U8, 1);
+ if (!fp) FIO_STAT_RETURN(false);
 
   uint16_t v = 0;
   if (1 != fread(&v, sizeof(uint8_t), 1, fp)) {
-    return false;
+    FIO_STAT_RETURN(false);
   }
   rv=v;
 
-  return true;
+  FIO_STAT_RETURN(true);
 }
 
 // Read unsigned short (2 bytes) from file
 bool fread_u16(FILE *fp, bool bBigEndian, uint16_t &rv) {
-  if (!fp) return false;
-
-  uint16_t v = 0;
-  if (1 != fread(&v, sizeof(uint16_t), 1, fp)) {
-    return false;
-  }
-  if (isBigEndian() != bBigEndian) {
-    v = bswap_u16(v);
-  }
-  rv=v;
-
-  return true;
+  FIO_STAT_IO(FIOSTAT_FREAD_U16, 2);
+  const bool ret = bBigEndian ? fread_endian<uint16_t, ENDIAN_BIG>(fp, rv)
+                              : fread_endian<uint16_t, ENDIAN_LITTLE>(fp, rv);
+  FIO_STAT_RETURN(ret);
 }
 
 // Read unsigned int (4 bytes) from file
 bool fread_u32(FILE *fp, bool bBigEndian, uint32_t &rv) {
-  if (!fp) return false;
-
-  uint32_t v = 0;
-  if (1 != fread(&v, sizeof(uint32_t), 1, fp)) {
-    return false;
-  }
-  if (isBigEndian() != bBigEndian) {
-    v = bswap_u32(v);
-  }
-  rv=v;
-
-  return true;
+  FIO_STAT_IO(FIOSTAT_FREAD_U32, 4);
+  const bool ret = bBigEndian ? fread_endian<uint32_t, ENDIAN_BIG>(fp, rv)
+                              : fread_endian<uint32_t, ENDIAN_LITTLE>(fp, rv);
+  FIO_STAT_RETURN(ret);
 }
 
 // Read uint64_t (8 bytes) from file
 bool fread_u64(FILE *fp, bool bBigEndian, uint64_t &rv) {
-  if (!fp) return false;
-
-  uint64_t v=0;
-  if (1 != fread(&v, sizeof(uint64_t), 1, fp)) {
-    return false;
-  }
-  if (isBigEndian() != bBigEndian) {
-    v = bswap_u64(v);
-  }
-  rv=v;
-
-  return true;
+  FIO_STAT_IO(FIOSTAT_FREAD_U64, 8);
+  const bool ret = bBigEndian ? fread_endian<uint64_t, ENDIAN_BIG>(fp, rv)
+                              : fread_endian<uint64_t, ENDIAN_LITTLE>(fp, rv);
+  FIO_STAT_RETURN(ret);
 }
 
 // Write single byte to file
 bool fwrite_u8(FILE *fp, uint8_t v) {
-  if (!fp) return false;
+  FIO_STAT_IO(FIOSTAT_FWRITE_U8, 1);
+  if (!fp) FIO_STAT_RETURN(false);
 
   if (1 != fwrite(&v, sizeof(uint8_t), 1, fp)) {
-    return false;
+    FIO_STAT_RETURN(false);
   }
 
-  return true;
+  FIO_STAT_RETURN(true);
 }
 
 // Write unsigned short (2 bytes) to file
 bool fwrite_u16(FILE *fp, bool bBigEndian, uint16_t v) {
-  if (!fp) return false;
+  FIO_STAT_IO(FIOSTAT_FWRITE_U16, 2);
+  const bool ret = bBigEndian ? fwrite_endian<uint16_t, ENDIAN_BIG>(fp, v)
+                              : fwrite_endian<uint16_t, ENDIAN_LITTLE>(fp, v);
+  FIO_STAT_RETURN(ret);
+}
 
-  if (isBigEndian() != bBigEndian) {
-    v = bswap_u16(v);
-  }
-  if (1 != fwrite(&v, sizeof(uint16_t), 1, fp)) {
-    return false;
+// Write unsigned int (4 bytes) to file
+bool fwrite_u32(FILE *fp, bool bBigEndian, uint32_t v) {
+  FIO_STAT_IO(FIOSTAT_FWRITE_U32, 4);
+  const bool ret = bBigEndian ? fwrite_endian<uint32_t, ENDIAN_BIG>(fp, v)
+                              : fwrite_endian<uint32_t, ENDIAN_LITTLE>(fp, v);
+  FIO_STAT_RETURN(ret);
+}
+
+// Write uint64_t (8 bytes) to file
+bool fwrite_u64(FILE *fp, bool bBigEndian, uint64_t v) {
+  FIO_STAT_IO(FIOSTAT_FWRITE_U64, 8);
+  const bool ret = bBigEndian ? fwrite_endian<uint64_t, ENDIAN_BIG>(fp, v)
+                              : fwrite_endian<uint64_t, ENDIAN_LITTLE>(fp, v);
+  FIO_STAT_RETURN(ret);
+}
+
+// CRC-32C (reflected polynomial 0x82F63B78) lookup tables for slicing-by-8
+struct FioCrc32cTable {
+  uint32_t t[8][256];
+  FioCrc32cTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : (c >> 1);
+      }
+      t[0][i] = c;
+    }
+    for (int k = 1; k < 8; k++) {
+      for (int i = 0; i < 256; i++) {
+        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+      }
+    }
   }
+};
 
-  return true;
+// Updates the (inverted) CRC-32C crc with len bytes (slicing-by-8 version)
+static uint32_t fioCrc32cSlice8(uint32_t crc, const uint8_t *p, size_t len) {
+  static const FioCrc32cTable tab;
+  const uint32_t (*t)[256] = tab.t;
+  if (FIO_HOST_ENDIAN == ENDIAN_LITTLE) {
+    for (; len >= 8; len -= 8, p += 8) {
+      uint32_t lo, hi;
+      memcpy(&lo, p, 4);
+      memcpy(&hi, p + 4, 4);
+      lo ^= crc;
+      crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+            t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+            t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+  }
+  for (; len > 0; len--) {
+    crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
 }
 
-// Write unsigned int (4 bytes) to file
-bool fwrite_u32(FILE *fp, bool bBigEndian, uint32_t v) {
-  if (!fp) return false;
+typedef uint32_t (*fioCrc32cKernel)(uint32_t crc, const uint8_t *p,
+                                    size_t len);
 
-  if (isBigEndian() != bBigEndian) {
-    v = bswap_u32(v);
+#ifdef FIO_X86_SIMD
+__attribute__((target("sse4.2")))
+static uint32_t fioCrc32cSse42(uint32_t crc, const uint8_t *p, size_t len) {
+  for (; len > 0 && ((uintptr_t)p & 7); len--) {
+    crc = _mm_crc32_u8(crc, *p++);
   }
-  if (1 != fwrite(&v, sizeof(uint32_t), 1, fp)) {
-    return false;
+#ifdef __x86_64__
+  uint64_t c = crc;
+  for (; len >= 8; len -= 8, p += 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    c = _mm_crc32_u64(c, v);
+  }
+  crc = (uint32_t)c;
+#endif
+  for (; len >= 4; len -= 4, p += 4) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    crc = _mm_crc32_u32(crc, v);
+  }
+  for (; len > 0; len--) {
+    crc = _mm_crc32_u8(crc, *p++);
   }
+  return crc;
+}
+#endif
 
-  return true;
+// Selects the crc instruction if the running cpu has it
+static fioCrc32cKernel fioCrc32cSelect() {
+#ifdef FIO_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) return fioCrc32cSse42;
+#endif
+  return fioCrc32cSlice8;
 }
 
-// Write uint64_t (8 bytes) to file
-bool fwrite_u64(FILE *fp, bool bBigEndian, uint64_t v) {
-  if (!fp) return false;
+// XXH64 primes and helpers
+static const uint64_t FIO_XXH_P1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t FIO_XXH_P2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t FIO_XXH_P3 = 0x165667B19E3779F9ULL;
+static const uint64_t FIO_XXH_P4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t FIO_XXH_P5 = 0x27D4EB2F165667C5ULL;
 
-  if (isBigEndian() != bBigEndian) {
-    v = bswap_u64(v);
+static inline uint64_t fioRotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fioXxhRound(uint64_t acc, uint64_t v) {
+  acc += v * FIO_XXH_P2;
+  return fioRotl64(acc, 31) * FIO_XXH_P1;
+}
+
+static inline uint64_t fioXxhMerge(uint64_t acc, uint64_t v) {
+  acc ^= fioXxhRound(0, v);
+  return acc * FIO_XXH_P1 + FIO_XXH_P4;
+}
+
+// Creates a hasher for algo (FILEHASH_...), the seed is used by XXH64
+FileHasher::FileHasher(int algo /* =FILEHASH_CRC32C */,
+                       uint64_t seed /* =0 */)
+  : m_algo(algo == FILEHASH_XXH64 ? FILEHASH_XXH64 : FILEHASH_CRC32C),
+    m_seed(seed) {
+  reset();
+}
+
+// Starts a new digest
+void FileHasher::reset() {
+  m_crc = 0xFFFFFFFF;
+  m_v[0] = m_seed + FIO_XXH_P1 + FIO_XXH_P2;
+  m_v[1] = m_seed + FIO_XXH_P2;
+  m_v[2] = m_seed;
+  m_v[3] = m_seed - FIO_XXH_P1;
+  m_memSize = 0;
+  m_total = 0;
+}
+
+// Adds len bytes of data to the digest
+void FileHasher::update(const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  m_total += len;
+  if (m_algo == FILEHASH_CRC32C) {
+    static const fioCrc32cKernel kernel = fioCrc32cSelect();
+    m_crc = kernel(m_crc, p, len);
+    return;
   }
-  if (1 != fwrite(&v, sizeof(uint64_t), 1, fp)) {
-    return false;
+  if (m_memSize + len < 32) {
+    if (len > 0) memcpy(m_mem + m_memSize, p, len);
+    m_memSize += len;
+    return;
   }
-
-  return true;
+  if (m_memSize > 0) {
+    const size_t fill = 32 - m_memSize;
+    memcpy(m_mem + m_memSize, p, fill);
+    for (int i = 0; i < 4; i++) {
+      m_v[i] = fioXxhRound(m_v[i],
+                           fioLoad<uint64_t, ENDIAN_LITTLE>(m_mem + 8 * i));
+    }
+    p += fill;
+    len -= fill;
+    m_memSize = 0;
+  }
+  uint64_t v0 = m_v[0], v1 = m_v[1], v2 = m_v[2], v3 = m_v[3];
+  for (; len >= 32; len -= 32, p += 32) {
+    v0 = fioXxhRound(v0, fioLoad<uint64_t, ENDIAN_LITTLE>(p));
+    v1 = fioXxhRound(v1, fioLoad<uint64_t, ENDIAN_LITTLE>(p + 8));
+    v2 = fioXxhRound(v2, fioLoad<uint64_t, ENDIAN_LITTLE>(p + 16));
+    v3 = fioXxhRound(v3, fioLoad<uint64_t, ENDIAN_LITTLE>(p + 24));
+  }
+  m_v[0] = v0;
+  m_v[1] = v1;
+  m_v[2] = v2;
+  m_v[3] = v3;
+  if (len > 0) memcpy(m_mem, p, len);
+  m_memSize = len;
 }
 
-// Loads len bytes into an vector of bytes.
-// If len is zero, then the whole file is loaded up to the end of the file.
-std::vector<uint8_t> fileLoadBytes(FILE *fp, int64_t len /* =0 */) {
-  std::vector<uint8_t> v;
-  if (len == 0) {
-    len = fileSize(fp);
-  }
-  const int64_t n = len;
-  uint8_t buf[FILEIOBUFSIZE];
-  while(len > 0 && !feof(fp)) {
-    size_t bytes = 0;
-    if (len >= FILEIOBUFSIZE) {
-      bytes = fread(buf, 1, FILEIOBUFSIZE, fp);
-    } else {
-      bytes = fread(buf, 1, len, fp);
+// Returns the digest of all bytes added since the last reset
+// (the CRC-32C is returned in the lower 32 bits).
+uint64_t FileHasher::digest() const {
+  if (m_algo == FILEHASH_CRC32C) {
+    return m_crc ^ 0xFFFFFFFF;
+  }
+  uint64_t h;
+  if (m_total >= 32) {
+    h = fioRotl64(m_v[0], 1) + fioRotl64(m_v[1], 7) +
+        fioRotl64(m_v[2], 12) + fioRotl64(m_v[3], 18);
+    for (int i = 0; i < 4; i++) {
+      h = fioXxhMerge(h, m_v[i]);
     }
-    for (size_t i = 0; i < bytes; i++) {
-      v.push_back(buf[i]);
+  } else {
+    h = m_seed + FIO_XXH_P5;
+  }
+  h += m_total;
+  const uint8_t *p = m_mem;
+  size_t len = m_memSize;
+  for (; len >= 8; len -= 8, p += 8) {
+    h ^= fioXxhRound(0, fioLoad<uint64_t, ENDIAN_LITTLE>(p));
+    h = fioRotl64(h, 27) * FIO_XXH_P1 + FIO_XXH_P4;
+  }
+  if (len >= 4) {
+    h ^= (uint64_t)fioLoad<uint32_t, ENDIAN_LITTLE>(p) * FIO_XXH_P1;
+    h = fioRotl64(h, 23) * FIO_XXH_P2 + FIO_XXH_P3;
+    p += 4;
+    len -= 4;
+  }
+  for (; len > 0; len--) {
+    h ^= (*p++) * FIO_XXH_P5;
+    h = fioRotl64(h, 11) * FIO_XXH_P1;
+  }
+  h ^= h >> 33;
+  h *= FIO_XXH_P2;
+  h ^= h >> 29;
+  h *= FIO_XXH_P3;
+  h ^= h >> 32;
+  return h;
+}
+
+// Reads up to len bytes from the current position of fp into dst with
+// large read calls. The file position of fp is advanced accordingly.
+// With a hasher the file is read in FILEHASHCHUNK pieces, which are hashed
+// while they are still in the cache.
+// Returns the number of bytes read (less than len on end of file)
+// or -1 on errors.
+int64_t fileReadBytes(FILE *fp, void *dst, int64_t len,
+                      FileHasher *hasher /* =0 */) {
+  FIO_STAT_XFER(FIOSTAT_FILEREADBYTES);
+  if (!fp || (!dst && len > 0) || len < 0) FIO_STAT_RETURN(-1);
+  uint8_t *p = (uint8_t *)dst;
+  int64_t n = 0;
+  const int64_t maxChunk = hasher ? FILEHASHCHUNK : FILEIOMAXCHUNK;
+#ifdef __linux__
+  fflush(fp);
+  const int64_t pos = ftello64(fp);
+  if (pos >= 0) {
+    // bypass the stdio buffer and read at the stream position
+    const int fd = fileno(fp);
+    bool err = false;
+    while (n < len) {
+      const size_t chunk = (len - n > maxChunk) ? maxChunk
+                                                : (size_t)(len - n);
+      const ssize_t rc = pread64(fd, p + n, chunk, pos + n);
+      if (rc < 0) {
+        if (errno == EINTR) continue;
+        err = true;
+        break;
+      }
+      if (rc == 0) break; // end of file
+      if (hasher) hasher->update(p + n, rc);
+      n += rc;
     }
-    bytes > 0 ? len -= bytes : len=0;
+    fseeko64(fp, pos + n, SEEK_SET);
+    FIO_STAT_RETURN((err && n == 0) ? -1 : n);
   }
-  if (v.size() != (size_t)n) {
-    v.clear();
+#endif
+  // stream is not seekable
+  while (n < len) {
+    const size_t chunk = (len - n > maxChunk) ? maxChunk : (size_t)(len - n);
+    const size_t bytes = fread(p + n, 1, chunk, fp);
+    if (hasher) hasher->update(p + n, bytes);
+    n += bytes;
+    if (bytes != chunk) break;
   }
-  return v;
+  FIO_STAT_RETURN((n == 0 && ferror(fp)) ? -1 : n);
 }
 
-// Saves len bytes from the given vector v into file fp.
-// If len is zero, then write the whole vector into the file fp.
-// Returns true if successfull, otherwise false.
-bool fileSaveBytes(FILE *fp, std::vector<uint8_t> &v, int64_t len /* =0 */) {
-  if (len == 0 || (size_t)len > v.size()) {
-    len = v.size();
+// Adds up to len bytes from the current position of fp to hasher h
+// (len=0 -> up to the end of the file). The file position is advanced.
+// Returns the number of bytes hashed or -1 on errors.
+int64_t fileHash(FILE *fp, FileHasher &h, int64_t len /* =0 */) {
+  FIO_STAT_XFER(FIOSTAT_FILEHASH);
+  if (!fp || len < 0) FIO_STAT_RETURN(-1);
+  const bool toEnd = (len == 0);
+  fioBuffer buf(FILEHASHCHUNK);
+  int64_t n = 0;
+  while (toEnd || n < len) {
+    int64_t chunk = FILEHASHCHUNK;
+    if (!toEnd && len - n < chunk) chunk = len - n;
+    const int64_t rc = fileReadBytes(fp, &buf[0], chunk, &h);
+    if (rc < 0) FIO_STAT_RETURN(n > 0 ? n : -1);
+    n += rc;
+    if (rc < chunk) break;
   }
-  uint8_t buf[FILEIOBUFSIZE];
-  size_t n = 0;
-  while(len > 0 && !feof(fp)) {
-    size_t wbytes = 0; // current bytes in buffer
-    size_t bytes  = 0;  // successfully written bytes
-    if (len >= FILEIOBUFSIZE) {
-      wbytes = FILEIOBUFSIZE;
-    } else {
-      wbytes = len;
+  FIO_STAT_RETURN(n);
+}
+
+// Byte swaps bytes/esize elements from s into d (scalar version)
+static void fioBswapScalar(uint8_t *d, const uint8_t *s, size_t bytes,
+                           int esize) {
+  size_t i = 0;
+  switch(esize) {
+  case 2:
+    for (; i + 2 <= bytes; i += 2) {
+      uint16_t v;
+      memcpy(&v, s + i, 2);
+      v = bswap_u16(v);
+      memcpy(d + i, &v, 2);
     }
-    // copy to buf
-    for (size_t i = 0; i < wbytes; i++) {
-      buf[i] = v[n++];
+    break;
+  case 4:
+    for (; i + 4 <= bytes; i += 4) {
+      uint32_t v;
+      memcpy(&v, s + i, 4);
+      v = bswap_u32(v);
+      memcpy(d + i, &v, 4);
     }
-    // write buf
-    bytes = fwrite(buf, 1, wbytes, fp);
-    if (bytes != wbytes) {
-      return false;
+    break;
+  case 8:
+    for (; i + 8 <= bytes; i += 8) {
+      uint64_t v;
+      memcpy(&v, s + i, 8);
+      v = bswap_u64(v);
+      memcpy(d + i, &v, 8);
     }
-    len -= bytes;
+    break;
   }
-  return true;
 }
 
-// Opens a file in 64-bit mode
-FILE* fileOpen(const char *fullpath, const char *mode) {
-#ifdef __linux__
-  return fopen64(fullpath, mode);
-#elif defined(_WIN32) || defined(WIN32)
-  return _wfopen(utf8_to_wstring(fullpath).c_str(),
-		 utf8_to_wstring(mode).c_str());
-#endif
+// Kernel type: swaps whole vectors and returns the number of bytes done
+typedef size_t (*fioBswapKernel)(uint8_t *d, const uint8_t *s, size_t bytes,
+                                 int esize);
+
+static size_t fioBswapNone(uint8_t *, const uint8_t *, size_t, int) {
+  return 0;
 }
 
-// Closes a file
-int fileClose(FILE *fp) {
-  int ret = 0;
-  if (fp == 0){
-    ret = EOF;
+#ifdef FIO_X86_SIMD
+__attribute__((target("ssse3")))
+static size_t fioBswapSsse3(uint8_t *d, const uint8_t *s, size_t bytes,
+                            int esize) {
+  __m128i mask;
+  if (esize == 2) {
+    mask = _mm_set_epi8(14,15,12,13,10,11,8,9,6,7,4,5,2,3,0,1);
+  } else if (esize == 4) {
+    mask = _mm_set_epi8(12,13,14,15,8,9,10,11,4,5,6,7,0,1,2,3);
   } else {
-    ret = fclose(fp);
+    mask = _mm_set_epi8(8,9,10,11,12,13,14,15,0,1,2,3,4,5,6,7);
   }
-  return ret;
+  size_t i = 0;
+  for (; i + 16 <= bytes; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+    _mm_storeu_si128((__m128i *)(d + i), _mm_shuffle_epi8(x, mask));
+  }
+  return i;
 }
 
-// Returns the size of a given file in bytes or -1 on errors.
-int64_t fileSize(const char *fullpath) {
-  if (strSize(fullpath) == 0) return -1;
-  ststat64 st_buf;
-#ifdef __linux__
-  size_t rc = stat64(fullpath, &st_buf);
-#elif defined(_WIN32) || defined(WIN32)
-  size_t rc = stat64(utf8_to_wstring(fullpath).c_str(), &st_buf);
+__attribute__((target("avx2")))
+static size_t fioBswapAvx2(uint8_t *d, const uint8_t *s, size_t bytes,
+                           int esize) {
+  __m256i mask;
+  if (esize == 2) {
+    mask = _mm256_set_epi8(14,15,12,13,10,11,8,9,6,7,4,5,2,3,0,1,
+                           14,15,12,13,10,11,8,9,6,7,4,5,2,3,0,1);
+  } else if (esize == 4) {
+    mask = _mm256_set_epi8(12,13,14,15,8,9,10,11,4,5,6,7,0,1,2,3,
+                           12,13,14,15,8,9,10,11,4,5,6,7,0,1,2,3);
+  } else {
+    mask = _mm256_set_epi8(8,9,10,11,12,13,14,15,0,1,2,3,4,5,6,7,
+                           8,9,10,11,12,13,14,15,0,1,2,3,4,5,6,7);
+  }
+  size_t i = 0;
+  for (; i + 64 <= bytes; i += 64) {
+    __m256i x0 = _mm256_loadu_si256((const __m256i *)(s + i));
+    __m256i x1 = _mm256_loadu_si256((const __m256i *)(s + i + 32));
+    _mm256_storeu_si256((__m256i *)(d + i), _mm256_shuffle_epi8(x0, mask));
+    _mm256_storeu_si256((__m256i *)(d + i + 32),
+                        _mm256_shuffle_epi8(x1, mask));
+  }
+  for (; i + 32 <= bytes; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(s + i));
+    _mm256_storeu_si256((__m256i *)(d + i), _mm256_shuffle_epi8(x, mask));
+  }
+  return i;
+}
+#endif
+
+// Selects the best kernel for the running cpu
+static fioBswapKernel fioBswapSelect() {
+#ifdef FIO_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return fioBswapAvx2;
+  if (__builtin_cpu_supports("ssse3")) return fioBswapSsse3;
 #endif
-  return (rc == 0 ? st_buf.st_size : -1);
+  return fioBswapNone;
 }
 
-// Returns the size of a given file descriptor in bytes or -1 on errors.
-int64_t fileSize(FILE *fp) {
-  ststat64 st_buf;
-  size_t rc = fstat64(fileno(fp), &st_buf);
-  return (rc == 0 ? st_buf.st_size : -1);
+// Byte swaps n elements of esize (2, 4 or 8) bytes from src into dst.
+// dst may be equal to src (in place).
+static void fioBswapArray(void *dst, const void *src, size_t n, int esize) {
+  static const fioBswapKernel kernel = fioBswapSelect();
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  const size_t bytes = n * esize;
+  const size_t done = kernel(d, s, bytes, esize);
+  fioBswapScalar(d + done, s + done, bytes - done, esize);
 }
 
-// Returns true if file or directory is readable
-bool fileReadable(const char *fullpath) {
-  if (strSize(fullpath) == 0) return false;
-#ifdef __linux__
-  if (access(fullpath, R_OK) != 0) return false;
-#elif defined(_WIN32) || defined(WIN32)
-  if (_waccess(utf8_to_wstring(fullpath).c_str(), 4) != 0) return false;
-#endif
-  return true;
+// Swap little endian/big endian of n uint16_t values in place
+void bswap_u16_array(uint16_t *v, size_t n) {
+  if (v) fioBswapArray(v, v, n, 2);
 }
 
-// Returns true if file exits, otherwise false
-bool fileExists(const char *fullpath) {
-  bool ret=false;
-  if (strSize(fullpath) > 0) {
-    ststat64 st_buf;
-    int rc;
-#ifdef __linux__
-    rc = stat64(fullpath, &st_buf);
-#elif defined(_WIN32) || defined(WIN32)
-    rc = stat64(utf8_to_wstring(fullpath).c_str(), &st_buf);
-#else
-    rc = -1;
-#endif
-    ret = (rc == 0);
+// Swap little endian/big endian of n uint32_t values in place
+void bswap_u32_array(uint32_t *v, size_t n) {
+  if (v) fioBswapArray(v, v, n, 4);
+}
+
+// Swap little endian/big endian of n uint64_t values in place
+void bswap_u64_array(uint64_t *v, size_t n) {
+  if (v) fioBswapArray(v, v, n, 8);
+}
+
+// Reads n elements of esize bytes in the given endianess into dst
+static bool fioReadArray(FILE *fp, bool bBigEndian, void *dst, size_t n,
+                         int esize) {
+  FIO_STAT_IO(FIOSTAT_FREAD_ARRAY, (int64_t)n * esize);
+  if (!fp || (!dst && n > 0)) FIO_STAT_RETURN(false);
+  if (n > (size_t)(INT64_MAX / esize)) FIO_STAT_RETURN(false);
+  const int64_t bytes = (int64_t)n * esize;
+  if (fileReadBytes(fp, dst, bytes) != bytes) {
+    FIO_STAT_RETURN(false);
   }
-  return ret;
+  if (isBigEndian() != bBigEndian) {
+    fioBswapArray(dst, dst, n, esize);
+  }
+  FIO_STAT_RETURN(true);
 }
 
-// Returns the type of a file
-// (-1=error, 0=file, 1=directory, 2=symlink)
-int fileType(const char *fullpath) {
-  if (strSize(fullpath) == 0) return -1;
-  ststat64 st_buf;
-#ifdef __linux__
-  int rc = stat64(fullpath, &st_buf);
-#elif defined(_WIN32) || defined(WIN32)
-  int rc = stat64(utf8_to_wstring(fullpath).c_str(), &st_buf);
-#endif
-  if (rc == 0) {
-    if (S_ISREG(st_buf.st_mode)) {
-      rc = 0; // regular file
-    } else if (S_ISDIR(st_buf.st_mode)) {
-      rc = 1; // directory
-    } else {
-#ifdef __linux__
-      if (S_ISLNK(st_buf.st_mode)) {
-        rc = 2; // symbolic link
-      }
-#endif
-      // S_ISLNK is not defined in windows!
+// Writes n elements of esize bytes in the given endianess from src
+static bool fioWriteArray(FILE *fp, bool bBigEndian, const void *src,
+                          size_t n, int esize) {
+  FIO_STAT_IO(FIOSTAT_FWRITE_ARRAY, (int64_t)n * esize);
+  if (!fp || (!src && n > 0)) FIO_STAT_RETURN(false);
+  if (n > (size_t)(INT64_MAX / esize)) FIO_STAT_RETURN(false);
+  if (isBigEndian() == bBigEndian) {
+    FIO_STAT_RETURN(fileWriteBytes(fp, src, (int64_t)n * esize));
+  }
+  // swap chunk by chunk, the caller's memory stays untouched
+  const size_t nmax = (size_t)FILEIOBUFSIZE * 64 / esize;
+  const size_t cap = ((n > nmax) ? nmax : n) * esize;
+  uint8_t *buf = (uint8_t *)malloc(cap ? cap : 1);
+  if (!buf) FIO_STAT_RETURN(false);
+  const uint8_t *s = (const uint8_t *)src;
+  bool ret = true;
+  while (n > 0 && ret) {
+    const size_t k = (n > nmax) ? nmax : n;
+    fioBswapArray(buf, s, k, esize);
+    ret = fileWriteBytes(fp, buf, (int64_t)k * esize);
+    s += k * esize;
+    n -= k;
+  }
+  free(buf);
+  FIO_STAT_RETURN(ret);
+}
+
+// Read n unsigned shorts (2 bytes each) from file
+bool fread_u16_array(FILE *fp, bool bBigEndian, uint16_t *dst, size_t n) {
+  return fioReadArray(fp, bBigEndian, dst, n, 2);
+}
+
+// Read n signed shorts (2 bytes each) from file
+bool fread_i16_array(FILE *fp, bool bBigEndian, int16_t *dst, size_t n) {
+  return fioReadArray(fp, bBigEndian, dst, n, 2);
+}
+
+// Read n unsigned ints (4 bytes each) from file
+bool fread_u32_array(FILE *fp, bool bBigEndian, uint32_t *dst, size_t n) {
+  return fioReadArray(fp, bBigEndian, dst, n, 4);
+}
+
+// Read n signed ints (4 bytes each) from file
+bool fread_i32_array(FILE *fp, bool bBigEndian, int32_t *dst, size_t n) {
+  return fioReadArray(fp, bBigEndian, dst, n, 4);
+}
+
+// Read n IEEE 754 floats (4 bytes each) from file
+bool fread_f32_array(FILE *fp, bool bBigEndian, float *dst, size_t n) {
+  return fioReadArray(fp, bBigEndian, dst, n, 4);
+}
+
+// Read n uint64_t (8 bytes each) from file
+bool fread_u64_array(FILE *fp, bool bBigEndian, uint64_t *dst, size_t n) {
+  return fioReadArray(fp, bBigEndian, dst, n, 8);
+}
+
+// Read n int64_t (8 bytes each) from file
+bool fread_i64_array(FILE *fp, bool bBigEndian, int64_t *dst, size_t n) {
+  return fioReadArray(fp, bBigEndian, dst, n, 8);
+}
+
+// Read n IEEE 754 doubles (8 bytes each) from file
+bool fread_f64_array(FILE *fp, bool bBigEndian, double *dst, size_t n) {
+  return fioReadArray(fp, bBigEndian, dst, n, 8);
+}
+
+// Write n unsigned shorts (2 bytes each) to file
+bool fwrite_u16_array(FILE *fp, bool bBigEndian, const uint16_t *src,
+                      size_t n) {
+  return fioWriteArray(fp, bBigEndian, src, n, 2);
+}
+
+// Write n signed shorts (2 bytes each) to file
+bool fwrite_i16_array(FILE *fp, bool bBigEndian, const int16_t *src,
+                      size_t n) {
+  return fioWriteArray(fp, bBigEndian, src, n, 2);
+}
+
+// Write n unsigned ints (4 bytes each) to file
+bool fwrite_u32_array(FILE *fp, bool bBigEndian, const uint32_t *src,
+                      size_t n) {
+  return fioWriteArray(fp, bBigEndian, src, n, 4);
+}
+
+// Write n signed ints (4 bytes each) to file
+bool fwrite_i32_array(FILE *fp, bool bBigEndian, const int32_t *src,
+                      size_t n) {
+  return fioWriteArray(fp, bBigEndian, src, n, 4);
+}
+
+// Write n IEEE 754 floats (4 bytes each) to file
+bool fwrite_f32_array(FILE *fp, bool bBigEndian, const float *src, size_t n) {
+  return fioWriteArray(fp, bBigEndian, src, n, 4);
+}
+
+// Write n uint64_t (8 bytes each) to file
+bool fwrite_u64_array(FILE *fp, bool bBigEndian, const uint64_t *src,
+                      size_t n) {
+  return fioWriteArray(fp, bBigEndian, src, n, 8);
+}
+
+// Write n int64_t (8 bytes each) to file
+bool fwrite_i64_array(FILE *fp, bool bBigEndian, const int64_t *src,
+                      size_t n) {
+  return fioWriteArray(fp, bBigEndian, src, n, 8);
+}
+
+// Write n IEEE 754 doubles (8 bytes each) to file
+bool fwrite_f64_array(FILE *fp, bool bBigEndian, const double *src,
+                      size_t n) {
+  return fioWriteArray(fp, bBigEndian, src, n, 8);
+}
+
+// Returns the bytes from the position of fp to the end of the file or -1
+static int64_t fioRestOfFile(FILE *fp) {
+  const int64_t fsize = fileSize(fp);
+  const int64_t pos = ftello64(fp);
+  if (fsize < 0) return -1;
+  const int64_t len = fsize - (pos > 0 ? pos : 0);
+  return (len > 0) ? len : 0;
+}
+
+// Loads len bytes into an vector of bytes.
+// If len is zero, then the rest of the file is loaded. The vector holds
+// the bytes read: fewer at the end of the file, none on errors (use the
+// fioBuffer overload to tell an error from an empty file).
+// A hasher, if given, is updated with the loaded bytes on the fly.
+std::vector<uint8_t> fileLoadBytes(FILE *fp, int64_t len /* =0 */,
+                                   FileHasher *hasher /* =0 */) {
+  FIO_STAT_CALL(FIOSTAT_FILELOADBYTES);
+  std::vector<uint8_t> v;
+  if (!fp) {
+    FIO_STAT_ERROR();
+    return v;
+  }
+  if (len == 0) {
+    len = fioRestOfFile(fp);
+  }
+  if (len <= 0 || (uint64_t)len > (uint64_t)SIZE_MAX) {
+    if (len < 0) {
+      FIO_STAT_ERROR();
     }
-  } else {
-    rc = -1;
+    return v;
+  }
+  v.resize((size_t)len);
+  const int64_t n = fileReadBytes(fp, &v[0], len, hasher);
+  if (n < 0) {
+    FIO_STAT_ERROR();
   }
-  return rc;
+  v.resize(n > 0 ? (size_t)n : 0);
+  FIO_STAT_ADDBYTES(v.size());
+  return v;
 }
 
-// Returns the modification time of a file
-time_t fileModificationTime(const char *fullpath) {
-  time_t ret=0;
-  if (strSize(fullpath) == 0) return ret;
-  ststat64 st_buf;
-#ifdef __linux__
-  int rc = stat64(fullpath, &st_buf);
-#elif defined(_WIN32) || defined(WIN32)
-  int rc = stat64(utf8_to_wstring(fullpath).c_str(), &st_buf);
-#endif
-  if (rc == 0) {
-    ret=st_buf.st_mtime;
+// Loads len bytes into the reusable buffer buf, which is sized once and
+// not zero initialised. If len is zero, then the rest of the file is loaded.
+// A hasher, if given, is updated with the loaded bytes on the fly.
+// Returns the number of bytes read (buf.size()) or -1 on errors.
+int64_t fileLoadBytes(FILE *fp, fioBuffer &buf, int64_t len /* =0 */,
+                      FileHasher *hasher /* =0 */) {
+  FIO_STAT_XFER(FIOSTAT_FILELOADBYTES);
+  buf.clear();
+  if (!fp || len < 0) FIO_STAT_RETURN(-1);
+  if (len == 0) {
+    len = fioRestOfFile(fp);
+    if (len < 0) FIO_STAT_RETURN(-1);
   }
-  return ret;
+  if ((uint64_t)len > (uint64_t)SIZE_MAX) FIO_STAT_RETURN(-1);
+  if (len == 0) FIO_STAT_RETURN(0);
+  buf.reserve((size_t)len);
+  buf.resize((size_t)len);
+  const int64_t n = fileReadBytes(fp, &buf[0], len, hasher);
+  buf.resize(n > 0 ? (size_t)n : 0);
+  FIO_STAT_RETURN(n);
 }
 
-// Deletes a file
-bool fileDelete(const char *fullpath) {
-  bool ret=false;
-  if (strSize(fullpath) == 0) return ret;
+// Reads len bytes from the current position of fp into dst with threads
+// threads, each filling chunk sized parts with pread.
+// Returns the number of bytes read or -1 on errors.
+static int64_t fioReadParallel(FILE *fp, uint8_t *dst, int64_t len,
+                               int threads, size_t chunk) {
 #ifdef __linux__
-  ret=(unlink(fullpath) != -1);
-#elif defined(_WIN32) || defined(WIN32)
-  ret=(_wunlink(utf8_to_wstring(fullpath).c_str()) != -1);
+  fflush(fp);
+  const int64_t pos = ftello64(fp);
+  if (pos < 0) return fileReadBytes(fp, dst, len); // not seekable
+  if (len == 0) return 0;
+  if (chunk < 4096) chunk = 4096;
+  const int64_t nchunks = (len + chunk - 1) / chunk;
+  if (threads <= 0) {
+    threads = (int)std::thread::hardware_concurrency();
+  }
+  if (threads > nchunks) threads = (int)nchunks;
+  if (threads < 1) threads = 1;
+  const int fd = fileno(fp);
+  std::atomic<int64_t> next(0);
+  std::atomic<int64_t> end(len); // first byte that could not be read
+  std::atomic<bool> failed(false);
+  auto worker = [&]() {
+    while (true) {
+      const int64_t c = next.fetch_add(1);
+      if (c >= nchunks) break;
+      const int64_t first = c * (int64_t)chunk;
+      const int64_t last = (first + (int64_t)chunk < len)
+                           ? first + (int64_t)chunk : len;
+      int64_t n = first;
+      while (n < last) {
+        const ssize_t rc = pread64(fd, dst + n, last - n, pos + n);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc <= 0) {
+          if (rc < 0) failed = true;
+          break;
+        }
+        n += rc;
+      }
+      if (n < last) {
+        int64_t e = end.load();
+        while (n < e && !end.compare_exchange_weak(e, n)) {}
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for (int t = 1; t < threads; t++) {
+    pool.push_back(std::thread(worker));
+  }
+  worker();
+  for (size_t t = 0; t < pool.size(); t++) {
+    pool[t].join();
+  }
+  const int64_t n = end;
+  if (n == 0 && failed) return -1;
+  fseeko64(fp, pos + n, SEEK_SET);
+  return n;
+#else
+  return fileReadBytes(fp, dst, len);
 #endif
-  return ret;
 }
 
+// Like fileLoadBytes, but the file is read by threads threads (0 = one
+// per cpu) in parallel, chunk bytes at a time.
+// If len is zero, then the rest of the file is loaded. The vector holds
+// the bytes read (fewer at the end of the file, none on errors).
+std::vector<uint8_t> fileLoadBytesParallel(FILE *fp, int64_t len /* =0 */,
+                                           int threads /* =0 */,
+                                           size_t chunk /* =FILEPARALLELCHUNK */) {
+  FIO_STAT_CALL(FIOSTAT_FILELOADPARALLEL);
+  std::vector<uint8_t> v;
+  if (!fp) {
+    FIO_STAT_ERROR();
+    return v;
+  }
+  if (len == 0) {
+    len = fioRestOfFile(fp);
+  }
+  if (len <= 0 || (uint64_t)len > (uint64_t)SIZE_MAX) {
+    if (len < 0) {
+      FIO_STAT_ERROR();
+    }
+    return v;
+  }
+  v.resize((size_t)len);
+  const int64_t n = fioReadParallel(fp, &v[0], len, threads, chunk);
+  if (n < 0) {
+    FIO_STAT_ERROR();
+  }
+  v.resize(n > 0 ? (size_t)n : 0);
+  FIO_STAT_ADDBYTES(v.size());
+  return v;
+}
 
-// ***************
-// Selftest
-// ***************
+// Loads len bytes into the reusable buffer buf with threads threads (0 =
+// one per cpu) in parallel. If len is zero, then the rest of the file is
+// loaded. Returns the number of bytes read (buf.size()) or -1 on errors.
+int64_t fileLoadBytesParallel(FILE *fp, fioBuffer &buf, int64_t len /* =0 */,
+                              int threads /* =0 */,
+                              size_t chunk /* =FILEPARALLELCHUNK */) {
+  FIO_STAT_XFER(FIOSTAT_FILELOADPARALLEL);
+  buf.clear();
+  if (!fp || len < 0) FIO_STAT_RETURN(-1);
+  if (len == 0) {
+    len = fioRestOfFile(fp);
+    if (len < 0) FIO_STAT_RETURN(-1);
+  }
+  if ((uint64_t)len > (uint64_t)SIZE_MAX) FIO_STAT_RETURN(-1);
+  if (len == 0) FIO_STAT_RETURN(0);
+  buf.reserve((size_t)len);
+  buf.resize((size_t)len);
+  const int64_t n = fioReadParallel(fp, &buf[0], len, threads, chunk);
+  buf.resize(n > 0 ? (size_t)n : 0);
+  FIO_STAT_RETURN(n);
+}
 
-// For selftest add -DSELFTEST to the compiler
-#ifdef SELFTEST
-void fioPerr(int m=0) {
-  switch(m) {
-  case 0:  fprintf(stderr, "fioSelftest:"); break;
-  case 1:  fprintf(stdout, "fioSelftest [PASSED]\n"); break;
-  case 2:  fprintf(stderr, "fioSelftest [FAILED]\n"); break;
+// Saves len bytes from the given vector v into file fp.
+// If len is zero, then write the whole vector into the file fp.
+// A hasher, if given, is updated with the saved bytes on the fly.
+// Returns true if successfull, otherwise false.
+bool fileSaveBytes(FILE *fp, const std::vector<uint8_t> &v,
+                   int64_t len /* =0 */, FileHasher *hasher /* =0 */) {
+  FIO_STAT_CALL(FIOSTAT_FILESAVEBYTES);
+  if (len == 0 || (size_t)len > v.size()) {
+    len = v.size();
+  }
+  FIO_STAT_ADDBYTES(len);
+  if (len == 0) FIO_STAT_RETURN(true);
+  FIO_STAT_RETURN(fileWriteBytes(fp, &v[0], len, hasher));
+}
+
+// Writes len bytes from caller memory src into file fp without copying
+// them through an intermediate buffer. With a hasher the bytes are
+// hashed and written in FILEHASHCHUNK pieces.
+// Returns true if successfull, otherwise false.
+bool fileWriteBytes(FILE *fp, const void *src, int64_t len,
+                    FileHasher *hasher /* =0 */) {
+  FIO_STAT_IO(FIOSTAT_FILEWRITEBYTES, len);
+  if (len < 0 || (uint64_t)len > (uint64_t)SIZE_MAX) FIO_STAT_RETURN(false);
+  if (!hasher) {
+    fioIoVec iov = { src, (size_t)len };
+    FIO_STAT_RETURN(fileWriteGather(fp, &iov, 1));
+  }
+  if (!src && len > 0) FIO_STAT_RETURN(false);
+  const uint8_t *p = (const uint8_t *)src;
+  for (int64_t n = 0; n < len; n += FILEHASHCHUNK) {
+    fioIoVec iov = { p + n, (size_t)(len - n > FILEHASHCHUNK
+                                     ? FILEHASHCHUNK : len - n) };
+    hasher->update(iov.data, iov.size);
+    if (!fileWriteGather(fp, &iov, 1)) FIO_STAT_RETURN(false);
+  }
+  FIO_STAT_RETURN(true);
+}
+
+// Writes count buffers (e.g. header and payload) one after another into
+// file fp with as few writev calls as possible.
+// Returns true if successfull, otherwise false.
+bool fileWriteGather(FILE *fp, const fioIoVec *iov, int count) {
+  FIO_STAT_CALL(FIOSTAT_FILEWRITEGATHER);
+  if (!fp || count < 0 || (!iov && count > 0)) FIO_STAT_RETURN(false);
+  for (int j = 0; j < count; j++) {
+    if (!iov[j].data && iov[j].size > 0) FIO_STAT_RETURN(false);
+    FIO_STAT_ADDBYTES(iov[j].size);
+  }
+#ifdef __linux__
+  // flush pending stdio data and write at the stream position
+  if (fflush(fp) != 0) FIO_STAT_RETURN(false);
+  const int fd = fileno(fp);
+  const int64_t pos = ftello64(fp);
+  if (pos >= 0 && lseek64(fd, pos, SEEK_SET) < 0) FIO_STAT_RETURN(false);
+  const int VECMAX = 64;
+  struct iovec vec[VECMAX];
+  int i = 0;       // current buffer
+  size_t done = 0; // bytes written of the current buffer
+  bool ret = true;
+  while (true) {
+    while (i < count && iov[i].size == done) {
+      i++;
+      done = 0;
+    }
+    if (i >= count) break;
+    int k = 0;
+    size_t budget = FILEIOMAXCHUNK;
+    for (int j = i; j < count && k < VECMAX && budget > 0; j++) {
+      const size_t off = (j == i) ? done : 0;
+      size_t bytes = iov[j].size - off;
+      if (bytes == 0) continue;
+      if (bytes > budget) bytes = budget;
+      vec[k].iov_base = (uint8_t *)iov[j].data + off;
+      vec[k].iov_len = bytes;
+      budget -= bytes;
+      k++;
+    }
+    const ssize_t rc = writev(fd, vec, k);
+    if (rc <= 0) {
+      if (rc < 0 && errno == EINTR) continue;
+      // nothing written for a non empty request would loop forever
+      if (rc == 0) errno = EIO;
+      ret = false;
+      break;
+    }
+    // advance over the written bytes
+    size_t adv = rc;
+    while (adv > 0) {
+      const size_t rem = iov[i].size - done;
+      if (adv >= rem) {
+        adv -= rem;
+        i++;
+        done = 0;
+      } else {
+        done += adv;
+        adv = 0;
+      }
+    }
+  }
+  if (pos >= 0) {
+    fseeko64(fp, lseek64(fd, 0, SEEK_CUR), SEEK_SET);
+  }
+  FIO_STAT_RETURN(ret);
+#else
+  for (int j = 0; j < count; j++) {
+    const uint8_t *p = (const uint8_t *)iov[j].data;
+    size_t len = iov[j].size;
+    while (len > 0) {
+      const size_t chunk = (len > FILEIOMAXCHUNK) ? FILEIOMAXCHUNK : len;
+      if (fwrite(p, 1, chunk, fp) != chunk) FIO_STAT_RETURN(false);
+      p += chunk;
+      len -= chunk;
+    }
+  }
+  FIO_STAT_RETURN(true);
+#endif
+}
+
+#ifdef __linux__
+// Opens fullpath for reading or for writing (created, truncated), with
+// O_DIRECT if ioflags has FILEIO_DIRECT and the file system accepts it.
+// Returns the descriptor or -1 on errors; direct tells if O_DIRECT is set.
+static int fioOpenIo(const char *fullpath, bool write, int ioflags,
+                     bool &direct) {
+  const int flags = (write ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY)
+                    | O_CLOEXEC | O_LARGEFILE;
+  direct = false;
+  if (ioflags & FILEIO_DIRECT) {
+    const int fd = open(fullpath, flags | O_DIRECT, 0666);
+    if (fd >= 0) {
+      direct = true;
+      return fd;
+    }
+    if (errno != EINVAL) return -1;
+  }
+  return open(fullpath, flags, 0666);
+}
+
+// Switches fd back to buffered I/O (O_DIRECT rejected by a transfer)
+static bool fioClearDirect(int fd) {
+  const int flags = fcntl(fd, F_GETFL);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags & ~O_DIRECT) == 0;
+}
+
+// Staging buffer aligned to FILEDIRECTALIGN for O_DIRECT transfers
+struct FioAlignedBuffer {
+  uint8_t *p;
+  FioAlignedBuffer(size_t size) : p(0) {
+    void *mem = 0;
+    if (size > 0 && posix_memalign(&mem, FILEDIRECTALIGN, size) == 0) {
+      p = (uint8_t *)mem;
+    }
+  }
+  ~FioAlignedBuffer() { free(p); }
+};
+
+// Starts the writeback of [off, off+len) and drops the pages written
+// before off from the cache once they reached the disk.
+static void fioDropBehind(int fd, int64_t &dropped, int64_t off, int64_t len) {
+  if (len > 0) sync_file_range(fd, off, len, SYNC_FILE_RANGE_WRITE);
+  if (off > dropped) {
+    sync_file_range(fd, dropped, off - dropped, SYNC_FILE_RANGE_WAIT_BEFORE
+                    | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, dropped, off - dropped, POSIX_FADV_DONTNEED);
+    dropped = off;
+  }
+}
+#endif
+
+// Returns true if the len bytes at p are all zero
+static bool fioIsZero(const uint8_t *p, size_t len) {
+  return len == 0 || (p[0] == 0 && memcmp(p, p + 1, len - 1) == 0);
+}
+
+// Finds the first run of at least FILEHOLEMIN zero bytes in p[pos, len)
+// made of whole FILEDIRECTALIGN blocks. Returns its start (len if there is
+// none) and sets runEnd to its end.
+static int64_t fioZeroRun(const uint8_t *p, int64_t pos, int64_t len,
+                          int64_t &runEnd) {
+  const int64_t A = FILEDIRECTALIGN;
+  int64_t run = -1;
+  int64_t off = (pos + A - 1) / A * A;
+  for (; off + A <= len; off += A) {
+    if (fioIsZero(p + off, A)) {
+      if (run < 0) run = off;
+    } else {
+      if (run >= 0 && off - run >= FILEHOLEMIN) break;
+      run = -1;
+    }
+  }
+  if (run >= 0 && off - run >= FILEHOLEMIN) {
+    runEnd = off;
+    return run;
+  }
+  runEnd = len;
+  return len;
+}
+
+// Loads the file fullpath into the reusable buffer buf.
+// FILEIO_DIRECT reads with O_DIRECT through an aligned staging buffer
+// (the file size need not be a multiple of the block size) and falls back
+// to buffered reads if the file system rejects it. FILEIO_DROPBEHIND
+// drops the pages from the cache after each FILEDIRECTCHUNK.
+// FILEIO_SPARSE reads only the data extents and zero fills the holes.
+// Returns the number of bytes read (buf.size()) or -1 on errors.
+int64_t fileLoadBytes(const char *fullpath, fioBuffer &buf, int ioflags) {
+  FIO_STAT_XFER(FIOSTAT_FILELOADBYTES);
+  buf.clear();
+  if (strSize(fullpath) == 0) FIO_STAT_RETURN(-1);
+#ifdef __linux__
+  bool direct;
+  const int fd = fioOpenIo(fullpath, false, ioflags, direct);
+  if (fd < 0) FIO_STAT_RETURN(-1);
+  ststat64 st_buf;
+  if (fstat64(fd, &st_buf) != 0
+      || (uint64_t)st_buf.st_size > (uint64_t)SIZE_MAX) {
+    close(fd);
+    FIO_STAT_RETURN(-1);
+  }
+  const int64_t len = st_buf.st_size;
+  buf.reserve((size_t)len);
+  buf.resize((size_t)len);
+  FioAlignedBuffer stage(direct ? FILEDIRECTCHUNK : 0);
+  if (direct && !stage.p && fioClearDirect(fd)) direct = false;
+  FileExtents extents;
+  const bool sparse = (ioflags & FILEIO_SPARSE) && extents.open(fd);
+  int64_t n = 0;
+  bool done = false;
+  bool err = false;
+  while (n < len && !done) {
+    int64_t stop = len; // end of the data to read
+    if (sparse) {
+      FileExtent e;
+      if (!extents.next(e)) {
+        e.offset = len;
+        e.length = 0;
+      }
+      if (e.offset > n) memset(&buf[n], 0, e.offset - n); // hole
+      n = e.offset;
+      stop = e.offset + e.length;
+    }
+    while (n < stop) {
+      const size_t want = (stop - n > FILEDIRECTCHUNK) ? FILEDIRECTCHUNK
+                                                       : (size_t)(stop - n);
+      ssize_t rc;
+      if (direct) {
+        // whole blocks, the last one is short at the end of the file
+        const size_t blocks = (want + FILEDIRECTALIGN - 1)
+                              & ~(size_t)(FILEDIRECTALIGN - 1);
+        rc = pread64(fd, stage.p, blocks, n);
+        if (rc < 0 && errno == EINVAL && fioClearDirect(fd)) {
+          direct = false;
+          continue;
+        }
+        if (rc > (ssize_t)want) rc = want;
+        if (rc > 0) memcpy(&buf[n], stage.p, rc);
+      } else {
+        rc = pread64(fd, &buf[n], want, n);
+      }
+      if (rc < 0 && errno == EINTR) continue;
+      if (rc <= 0) {
+        err = (rc < 0);
+        done = true;
+        break;
+      }
+      if (ioflags & FILEIO_DROPBEHIND) {
+        posix_fadvise(fd, n, rc, POSIX_FADV_DONTNEED);
+      }
+      n += rc;
+    }
+  }
+  close(fd);
+  buf.resize((size_t)n);
+  FIO_STAT_RETURN((err && n == 0) ? -1 : n);
+#else
+  FILE *fp = fileOpen(fullpath, "rb");
+  if (!fp) FIO_STAT_RETURN(-1);
+  const int64_t n = fileLoadBytes(fp, buf);
+  fileClose(fp);
+  FIO_STAT_RETURN(n);
+#endif
+}
+
+// Saves len bytes from src into the file fullpath (created or truncated).
+// FILEIO_DIRECT writes with O_DIRECT through an aligned staging buffer,
+// pads the last block and truncates the file to len afterwards; it falls
+// back to buffered writes if the file system rejects it.
+// FILEIO_DROPBEHIND writes back each FILEDIRECTCHUNK right away and drops
+// it from the cache once it reached the disk. FILEIO_SPARSE leaves block
+// aligned runs of at least FILEHOLEMIN zero bytes as holes.
+// Returns true if successfull, otherwise false.
+bool fileSaveBytes(const char *fullpath, const void *src, int64_t len,
+                   int ioflags) {
+  FIO_STAT_IO(FIOSTAT_FILESAVEBYTES, len);
+  if (strSize(fullpath) == 0 || len < 0 || (!src && len > 0)) {
+    FIO_STAT_RETURN(false);
+  }
+  const uint8_t *p = (const uint8_t *)src;
+#ifdef __linux__
+  bool direct;
+  const int fd = fioOpenIo(fullpath, true, ioflags, direct);
+  if (fd < 0) FIO_STAT_RETURN(false);
+  FioAlignedBuffer stage(direct ? FILEDIRECTCHUNK : 0);
+  if (direct && !stage.p && fioClearDirect(fd)) direct = false;
+  const bool sparse = (ioflags & FILEIO_SPARSE) != 0;
+  bool padded = false;
+  int64_t dropped = 0;
+  int64_t n = 0;
+  bool ret = true;
+  while (n < len && ret) {
+    int64_t stop = len;    // end of the data to write
+    int64_t holeEnd = len; // the zero run [stop, holeEnd) is left a hole
+    if (sparse) stop = fioZeroRun(p, n, len, holeEnd);
+    while (n < stop) {
+      const size_t want = (stop - n > FILEDIRECTCHUNK) ? FILEDIRECTCHUNK
+                                                       : (size_t)(stop - n);
+      ssize_t rc;
+      if (direct) {
+        const size_t blocks = (want + FILEDIRECTALIGN - 1)
+                              & ~(size_t)(FILEDIRECTALIGN - 1);
+        memcpy(stage.p, p + n, want);
+        memset(stage.p + want, 0, blocks - want);
+        rc = pwrite64(fd, stage.p, blocks, n);
+        if (rc < 0 && errno == EINVAL && fioClearDirect(fd)) {
+          direct = false;
+          continue;
+        }
+        if (rc > (ssize_t)want) {
+          rc = want;
+          padded = true;
+        }
+      } else {
+        rc = pwrite64(fd, p + n, want, n);
+      }
+      if (rc < 0 && errno == EINTR) continue;
+      if (rc <= 0) {
+        ret = false;
+        break;
+      }
+      if (ioflags & FILEIO_DROPBEHIND) fioDropBehind(fd, dropped, n, rc);
+      n += rc;
+    }
+    if (ret) n = holeEnd;
+  }
+  if (ret && (padded || sparse) && ftruncate64(fd, len) != 0) ret = false;
+  if (ioflags & FILEIO_DROPBEHIND) fioDropBehind(fd, dropped, n, 0);
+  if (close(fd) != 0) ret = false;
+  FIO_STAT_RETURN(ret);
+#else
+  FILE *fp = fileOpen(fullpath, "wb");
+  if (!fp) FIO_STAT_RETURN(false);
+  bool ret = fileWriteBytes(fp, p, len);
+  if (fileClose(fp) != 0) ret = false;
+  FIO_STAT_RETURN(ret);
+#endif
+}
+
+// Returns the directory part of fullpath ("." if there is none)
+static std::string fioParentDir(const char *fullpath) {
+  const std::string p(fullpath);
+#if defined(_WIN32) || defined(WIN32)
+  const size_t pos = p.find_last_of("/\\");
+#else
+  const size_t pos = p.rfind('/');
+#endif
+  if (pos == std::string::npos) return ".";
+  return p.substr(0, pos == 0 ? 1 : pos);
+}
+
+#ifdef __linux__
+// Temporary file of an atomic save, renamed over target on commit
+struct FioSaveItem {
+  std::string tmp;
+  std::string target;
+  int fd;
+  bool ok;
+  bool done;
+};
+
+// Writes len bytes from src to a new temporary file next to fullpath
+// ("<fullpath>.<pid>.<n>.tmp"). The descriptor stays open for the commit.
+// Returns the item or 0 on errors.
+static FioSaveItem* fioWriteTemp(const char *fullpath, const void *src,
+                                 int64_t len) {
+  static std::atomic<unsigned> counter(0);
+  if (strSize(fullpath) == 0 || len < 0 || (!src && len > 0)) return 0;
+  FioSaveItem *item = new FioSaveItem;
+  item->target = fullpath;
+  item->fd = -1;
+  item->ok = true;
+  item->done = false;
+  for (int tries = 0; item->fd < 0 && tries < 16; tries++) {
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), ".%d.%u.tmp", (int)getpid(),
+             counter++);
+    item->tmp = item->target + suffix;
+    item->fd = open(item->tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL
+                    | O_CLOEXEC | O_LARGEFILE, 0666);
+    if (item->fd < 0 && errno != EEXIST) break;
+  }
+  if (item->fd < 0) {
+    delete item;
+    return 0;
+  }
+  // keep the permissions of an existing target
+  ststat64 st_buf;
+  if (stat64(fullpath, &st_buf) == 0) {
+    fchmod(item->fd, st_buf.st_mode & 07777);
+  }
+  const uint8_t *p = (const uint8_t *)src;
+  int64_t n = 0;
+  while (n < len) {
+    const size_t chunk = (len - n > FILEIOMAXCHUNK) ? FILEIOMAXCHUNK
+                                                     : (size_t)(len - n);
+    const ssize_t rc = ::write(item->fd, p + n, chunk);
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) {
+      close(item->fd);
+      unlink(item->tmp.c_str());
+      delete item;
+      return 0;
+    }
+    n += rc;
+  }
+  return item;
+}
+
+// Makes the temporary files of items durable (one syncfs per file system
+// if useSyncfs and there is more than one item, else fdatasync each),
+// renames them over their targets and fsyncs each directory once.
+static void fioCommitTemps(std::vector<FioSaveItem *> &items, bool useSyncfs) {
+  if (useSyncfs && items.size() > 1) {
+    std::map<uint64_t, bool> synced; // device -> syncfs succeeded
+    for (size_t i = 0; i < items.size(); i++) {
+      ststat64 st_buf;
+      if (fstat64(items[i]->fd, &st_buf) != 0) {
+        items[i]->ok = false;
+        continue;
+      }
+      const uint64_t dev = st_buf.st_dev;
+      if (!synced.count(dev)) synced[dev] = (syncfs(items[i]->fd) == 0);
+      if (!synced[dev]) items[i]->ok = false;
+    }
+  } else {
+    for (size_t i = 0; i < items.size(); i++) {
+      if (fdatasync(items[i]->fd) != 0) items[i]->ok = false;
+    }
+  }
+  std::map<std::string, bool> dirs; // directory -> fsync succeeded
+  for (size_t i = 0; i < items.size(); i++) {
+    FioSaveItem *item = items[i];
+    if (close(item->fd) != 0) item->ok = false;
+    item->fd = -1;
+    if (item->ok && rename(item->tmp.c_str(), item->target.c_str()) != 0) {
+      item->ok = false;
+    }
+    if (!item->ok) {
+      unlink(item->tmp.c_str());
+      continue;
+    }
+    dirs[fioParentDir(item->target.c_str())] = true;
+  }
+  for (std::map<std::string, bool>::iterator it = dirs.begin();
+       it != dirs.end(); ++it) {
+    const int dfd = open(it->first.c_str(), O_RDONLY | O_DIRECTORY
+                         | O_CLOEXEC);
+    it->second = (dfd >= 0 && fsync(dfd) == 0);
+    if (dfd >= 0) close(dfd);
+  }
+  for (size_t i = 0; i < items.size(); i++) {
+    if (items[i]->ok && !dirs[fioParentDir(items[i]->target.c_str())]) {
+      items[i]->ok = false;
+    }
+  }
+}
+#endif
+
+// Replaces the file fullpath atomically and durably with len bytes from
+// src: the data goes to a temporary file in the same directory, which is
+// synced, renamed over fullpath and then the directory is synced.
+// Readers see either the old or the new file, also after a crash.
+// Returns true if successfull, otherwise false.
+bool fileSaveAtomic(const char *fullpath, const void *src, int64_t len) {
+  FIO_STAT_IO(FIOSTAT_FILESAVEATOMIC, len);
+#ifdef __linux__
+  FioSaveItem *item = fioWriteTemp(fullpath, src, len);
+  if (!item) FIO_STAT_RETURN(false);
+  std::vector<FioSaveItem *> items(1, item);
+  fioCommitTemps(items, false);
+  const bool ret = item->ok;
+  delete item;
+  FIO_STAT_RETURN(ret);
+#elif defined(_WIN32) || defined(WIN32)
+  static volatile LONG counter = 0;
+  if (strSize(fullpath) == 0 || len < 0 || (!src && len > 0)) {
+    FIO_STAT_RETURN(false);
+  }
+  char suffix[48];
+  snprintf(suffix, sizeof(suffix), ".%lu.%ld.tmp",
+           (unsigned long)GetCurrentProcessId(),
+           (long)InterlockedIncrement(&counter));
+  const std::string tmp = std::string(fullpath) + suffix;
+  FILE *fp = fileOpen(tmp.c_str(), "wb");
+  if (!fp) FIO_STAT_RETURN(false);
+  bool ret = fileWriteBytes(fp, src, len) && fflush(fp) == 0
+             && _commit(_fileno(fp)) == 0;
+  if (fileClose(fp) != 0) ret = false;
+  if (ret) {
+    ret = MoveFileExW(utf8_to_wstring(tmp.c_str()).c_str(),
+                      utf8_to_wstring(fullpath).c_str(),
+                      MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+  }
+  if (!ret) fileDelete(tmp.c_str());
+  FIO_STAT_RETURN(ret);
+#endif
+}
+
+#ifdef __linux__
+// Creates a group that syncs each file with fdatasync. useSyncfs syncs a
+// batch with one syncfs per file system instead; that also writes back
+// the dirty pages of other processes and, before linux 5.8, does not
+// report writeback errors.
+FileSaveGroup::FileSaveGroup(bool useSyncfs /* =false */)
+  : m_syncfs(useSyncfs), m_leader(false), m_commits(0) {
+}
+
+// Commits the files added but not yet committed
+FileSaveGroup::~FileSaveGroup() {
+  commit();
+}
+
+// Saves like fileSaveAtomic, but concurrent calls from several threads
+// share the fsyncs: one thread commits all files written meanwhile.
+// Returns true once the file is durable, otherwise false.
+bool FileSaveGroup::save(const char *fullpath, const void *src, int64_t len) {
+  FioSaveItem *item = fioWriteTemp(fullpath, src, len);
+  if (!item) return false;
+  std::vector<FioSaveItem *> items(1, item);
+  return run(items);
+}
+
+// Writes the temporary file of fullpath, which is renamed over fullpath
+// by the next commit(). Returns true if successfull, otherwise false.
+bool FileSaveGroup::add(const char *fullpath, const void *src, int64_t len) {
+  FioSaveItem *item = fioWriteTemp(fullpath, src, len);
+  if (!item) return false;
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_staged.push_back(item);
+  return true;
+}
+
+// Commits all files added so far in one group commit.
+// Returns true if all of them are durable, otherwise false.
+bool FileSaveGroup::commit() {
+  std::vector<FioSaveItem *> items;
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    items.swap(m_staged);
+  }
+  if (items.empty()) return true;
+  return run(items);
+}
+
+// Returns the number of group commits done so far
+uint64_t FileSaveGroup::commits() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return m_commits;
+}
+
+// Queues items and waits until they are committed. If no commit is
+// running, the calling thread commits everything queued (leader).
+bool FileSaveGroup::run(std::vector<FioSaveItem *> &items) {
+  std::unique_lock<std::mutex> lock(m_mtx);
+  m_pending.insert(m_pending.end(), items.begin(), items.end());
+  while (true) {
+    bool done = true;
+    for (size_t i = 0; i < items.size(); i++) {
+      if (!items[i]->done) done = false;
+    }
+    if (done) break;
+    if (m_leader) {
+      m_cv.wait(lock);
+      continue;
+    }
+    m_leader = true;
+    std::vector<FioSaveItem *> batch;
+    batch.swap(m_pending);
+    lock.unlock();
+    fioCommitTemps(batch, m_syncfs);
+    lock.lock();
+    for (size_t i = 0; i < batch.size(); i++) {
+      batch[i]->done = true;
+    }
+    m_commits++;
+    m_leader = false;
+    m_cv.notify_all();
+  }
+  lock.unlock();
+  bool ret = true;
+  for (size_t i = 0; i < items.size(); i++) {
+    if (!items[i]->ok) ret = false;
+    delete items[i];
+  }
+  return ret;
+}
+#endif
+
+// Iterates over the data extents of fp in [offset, offset+length)
+// (length=0 -> up to the end of the file).
+// Returns true if successfull, otherwise false.
+bool FileExtents::open(FILE *fp, int64_t offset /* =0 */,
+                       int64_t length /* =0 */) {
+  if (!fp) return false;
+  fflush(fp);
+  return open(fileno(fp), offset, length);
+}
+
+// Like open(FILE*), for the file descriptor fd
+bool FileExtents::open(int fd, int64_t offset /* =0 */,
+                       int64_t length /* =0 */) {
+  ststat64 st_buf;
+  m_fd = -1;
+  if (fd < 0 || offset < 0 || length < 0 || fstat64(fd, &st_buf) != 0) {
+    return false;
+  }
+  m_fd = fd;
+  m_end = st_buf.st_size;
+  m_pos = (offset < m_end) ? offset : m_end;
+  if (length > 0 && m_pos + length < m_end) m_end = m_pos + length;
+  return true;
+}
+
+// Returns the next data extent in e, false after the last one.
+// The file position of the descriptor is not changed.
+bool FileExtents::next(FileExtent &e) {
+  if (m_fd < 0 || m_pos >= m_end) return false;
+  int64_t data = m_pos;
+  int64_t hole = m_end;
+#ifdef __linux__
+  const int64_t cur = lseek64(m_fd, 0, SEEK_CUR);
+  data = lseek64(m_fd, m_pos, SEEK_DATA);
+  if (data >= 0) {
+    hole = lseek64(m_fd, data, SEEK_HOLE);
+    if (hole < 0 || hole > m_end) hole = m_end;
+  } else if (errno == ENXIO) {
+    data = m_end; // only a hole is left
+  } else {
+    data = m_pos; // no SEEK_DATA support, all data
+  }
+  if (cur >= 0) lseek64(m_fd, cur, SEEK_SET);
+#endif
+  if (data >= m_end) {
+    m_pos = m_end;
+    return false;
+  }
+  e.offset = data;
+  e.length = hole - data;
+  m_pos = hole;
+  return true;
+}
+
+// Preallocates disk space, so fp can grow to size bytes without
+// fragmenting. The file is extended to size unless keepSize is true
+// (fallocate only, e.g. for logs that are appended later); otherwise
+// posix_fallocate is used if fallocate is not supported.
+// Returns true if successfull, otherwise false.
+bool fileReserve(FILE *fp, int64_t size, bool keepSize /* =false */) {
+  FIO_STAT_CALL(FIOSTAT_FILERESERVE);
+  if (!fp || size < 0 || fflush(fp) != 0) FIO_STAT_RETURN(false);
+  const int64_t cur = fileSize(fp);
+  if (cur < 0) FIO_STAT_RETURN(false);
+  if (size <= cur) FIO_STAT_RETURN(true);
+#ifdef __linux__
+  const int fd = fileno(fp);
+  if (fallocate64(fd, keepSize ? FALLOC_FL_KEEP_SIZE : 0, cur,
+                  size - cur) == 0) {
+    FIO_STAT_RETURN(true);
+  }
+  if (keepSize) FIO_STAT_RETURN(false);
+  FIO_STAT_RETURN(posix_fallocate64(fd, cur, size - cur) == 0);
+#elif defined(_WIN32) || defined(WIN32)
+  if (keepSize) FIO_STAT_RETURN(false);
+  FIO_STAT_RETURN(_chsize_s(_fileno(fp), size) == 0);
+#endif
+}
+
+#ifdef __linux__
+// Copies len bytes from in at off to out at dstOff with strategy or, if
+// the file systems don't support it, with the next slower one.
+// Returns the number of bytes copied (short at the end of in) or -1.
+static int64_t fioCopyExtent(int in, int out, int64_t off, int64_t dstOff,
+                             int64_t len, int &strategy, fioBuffer &buf) {
+  int64_t n = 0;
+  while (n < len) {
+    const size_t chunk = (len - n > FILEIOMAXCHUNK) ? FILEIOMAXCHUNK
+                                                     : (size_t)(len - n);
+    ssize_t rc = -1;
+    if (strategy <= FILECOPY_RANGE) {
+      strategy = FILECOPY_RANGE;
+#ifdef SYS_copy_file_range
+      loff_t offIn = off + n;
+      loff_t offOut = dstOff + n;
+      rc = syscall(SYS_copy_file_range, in, &offIn, out, &offOut, chunk, 0);
+#else
+      errno = ENOSYS;
+#endif
+      if (rc < 0 && errno != EINTR && errno != EIO && errno != ENOSPC) {
+        strategy = FILECOPY_SENDFILE; // e.g. EXDEV, EINVAL, ENOSYS
+        continue;
+      }
+    } else if (strategy == FILECOPY_SENDFILE) {
+      off64_t offIn = off + n;
+      if (lseek64(out, dstOff + n, SEEK_SET) < 0) return -1;
+      rc = sendfile64(out, in, &offIn, chunk);
+      if (rc < 0 && errno != EINTR && errno != EIO && errno != ENOSPC) {
+        strategy = FILECOPY_BUFFER;
+        continue;
+      }
+    } else {
+      if (buf.empty()) buf.resize(FILEDIRECTCHUNK);
+      rc = pread64(in, &buf[0], chunk > buf.size() ? buf.size() : chunk,
+                   off + n);
+      for (ssize_t w = 0; rc > 0 && w < rc; ) {
+        const ssize_t wc = pwrite64(out, &buf[w], rc - w, dstOff + n + w);
+        if (wc < 0 && errno == EINTR) continue;
+        if (wc <= 0) return -1;
+        w += wc;
+      }
+    }
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc < 0) return -1;
+    if (rc == 0) break; // end of in
+    n += rc;
+  }
+  return n;
+}
+#endif
+
+// Copies the file src (or opt.length bytes from opt.offset) into the file
+// dst, which is created or truncated (dst must not be src). The fastest
+// strategy the file systems support is used: a reflink (FICLONE),
+// copy_file_range, sendfile and a read/write loop. With opt.sparse only
+// the data extents of src are copied (SEEK_DATA/SEEK_HOLE), so holes stay
+// holes in dst. strategy, if given, returns the slowest strategy that was
+// needed.
+// Returns the number of bytes copied (short if src got shorter) or -1 on
+// errors.
+int64_t fileCopy(const char *src, const char *dst,
+                 const FileCopyOptions &opt /* =FileCopyOptions() */,
+                 int *strategy /* =0 */) {
+  FIO_STAT_XFER(FIOSTAT_FILECOPY);
+  if (strategy) *strategy = FILECOPY_ERROR;
+  if (strSize(src) == 0 || strSize(dst) == 0 || opt.offset < 0
+      || opt.length < 0) {
+    FIO_STAT_RETURN(-1);
+  }
+#ifdef __linux__
+  const int in = open(src, O_RDONLY | O_CLOEXEC | O_LARGEFILE);
+  if (in < 0) FIO_STAT_RETURN(-1);
+  ststat64 st_buf;
+  if (fstat64(in, &st_buf) != 0) {
+    close(in);
+    FIO_STAT_RETURN(-1);
+  }
+  // truncated only after the check that dst is not src
+  const int out = open(dst, O_WRONLY | O_CREAT | O_CLOEXEC | O_LARGEFILE,
+                       st_buf.st_mode & 0777);
+  if (out < 0) {
+    close(in);
+    FIO_STAT_RETURN(-1);
+  }
+  ststat64 st_out;
+  if (fstat64(out, &st_out) != 0 || (st_out.st_dev == st_buf.st_dev
+                                     && st_out.st_ino == st_buf.st_ino)
+      || ftruncate64(out, 0) != 0) {
+    close(in);
+    close(out);
+    FIO_STAT_RETURN(-1);
+  }
+  const int64_t size = st_buf.st_size;
+  const int64_t begin = (opt.offset < size) ? opt.offset : size;
+  int64_t end = size;
+  if (opt.length > 0 && begin + opt.length < size) end = begin + opt.length;
+  int used = (opt.strategy < FILECOPY_CLONE) ? FILECOPY_CLONE : opt.strategy;
+  int64_t ret = -1;
+#ifdef FICLONERANGE
+  if (used == FILECOPY_CLONE && end > begin) {
+    struct file_clone_range r;
+    r.src_fd = in;
+    r.src_offset = begin;
+    r.src_length = (end == size) ? 0 : end - begin; // 0 = up to the end
+    r.dest_offset = 0;
+    if (ioctl(out, FICLONERANGE, &r) == 0) ret = end - begin;
+  }
+#endif
+  if (ret < 0) {
+    if (used == FILECOPY_CLONE) used = FILECOPY_RANGE;
+    fioBuffer buf;
+    FileExtents extents;
+    FileExtent e = { begin, end - begin };
+    bool more = (end > begin);
+    if (opt.sparse) {
+      more = extents.open(in, begin, end - begin) && extents.next(e);
+    } else if (more) {
+      fallocate64(out, 0, 0, end - begin); // one contiguous allocation
+    }
+    ret = 0;
+    bool complete = true;
+    while (more) {
+      const int64_t n = fioCopyExtent(in, out, e.offset, e.offset - begin,
+                                      e.length, used, buf);
+      if (n < 0) {
+        ret = -1;
+        break;
+      }
+      ret = e.offset + n - begin;
+      if (n < e.length) { // src got shorter
+        complete = false;
+        break;
+      }
+      more = opt.sparse && extents.next(e);
+    }
+    // trailing hole, only if every extent was copied in full
+    if (ret >= 0 && complete) {
+      ret = (ftruncate64(out, end - begin) == 0) ? end - begin : -1;
+    }
+  }
+  close(in);
+  if (close(out) != 0) ret = -1;
+  if (strategy && ret >= 0) *strategy = used;
+  FIO_STAT_RETURN(ret);
+#else
+  FILE *in = fileOpen(src, "rb");
+  if (!in) FIO_STAT_RETURN(-1);
+  FILE *out = fileOpen(dst, "wb");
+  if (!out) {
+    fileClose(in);
+    FIO_STAT_RETURN(-1);
+  }
+  int64_t ret = 0;
+  int64_t left = (opt.length > 0) ? opt.length : INT64_MAX;
+  std::vector<uint8_t> buf(FILEDIRECTCHUNK);
+  if (fseeko64(in, opt.offset, SEEK_SET) != 0) left = 0;
+  while (left > 0) {
+    const size_t chunk = (left > (int64_t)buf.size()) ? buf.size()
+                                                      : (size_t)left;
+    const size_t n = fread(&buf[0], 1, chunk, in);
+    if (n > 0 && fwrite(&buf[0], 1, n, out) != n) {
+      ret = -1;
+      break;
+    }
+    ret += n;
+    left -= n;
+    if (n < chunk) break;
+  }
+  fileClose(in);
+  if (fileClose(out) != 0) ret = -1;
+  if (strategy && ret >= 0) *strategy = FILECOPY_BUFFER;
+  FIO_STAT_RETURN(ret);
+#endif
+}
+
+// Opens a file in 64-bit mode
+FILE* fileOpen(const char *fullpath, const char *mode) {
+  FIO_STAT_CALL(FIOSTAT_FILEOPEN);
+#ifdef __linux__
+  FIO_STAT_RETURN(fopen64(fullpath, mode));
+#elif defined(_WIN32) || defined(WIN32)
+  FIO_STAT_RETURN(_wfopen(utf8_to_wstring(fullpath).c_str(),
+                          utf8_to_wstring(mode).c_str()));
+#endif
+}
+
+// Closes a file
+int fileClose(FILE *fp) {
+  FIO_STAT_CALL(FIOSTAT_FILECLOSE);
+  int ret = 0;
+  if (fp == 0){
+    ret = EOF;
+  } else {
+    ret = fclose(fp);
+  }
+  FIO_STAT_RETURN(ret);
+}
+
+// Returns the size of a given file in bytes or -1 on errors.
+int64_t fileSize(const char *fullpath) {
+  FIO_STAT_CALL(FIOSTAT_FILESIZE);
+  if (strSize(fullpath) == 0) FIO_STAT_RETURN(-1);
+#ifdef __linux__
+  if (fileCacheEnabled()) {
+    FileStat st;
+    FIO_STAT_RETURN((fileStatCached(fullpath, st) ? st.size : -1));
+  }
+#endif
+  ststat64 st_buf;
+#ifdef __linux__
+  size_t rc = stat64(fullpath, &st_buf);
+#elif defined(_WIN32) || defined(WIN32)
+  size_t rc = stat64(utf8_to_wstring(fullpath).c_str(), &st_buf);
+#endif
+  FIO_STAT_RETURN((rc == 0 ? st_buf.st_size : -1));
+}
+
+// Returns the size of a given file descriptor in bytes or -1 on errors.
+int64_t fileSize(FILE *fp) {
+  FIO_STAT_CALL(FIOSTAT_FILESIZE);
+  ststat64 st_buf;
+  size_t rc = fstat64(fileno(fp), &st_buf);
+  FIO_STAT_RETURN((rc == 0 ? st_buf.st_size : -1));
+}
+
+// Returns true if file or directory is readable
+bool fileReadable(const char *fullpath) {
+  FIO_STAT_CALL(FIOSTAT_FILEREADABLE);
+  if (strSize(fullpath) == 0) return false;
+#ifdef __linux__
+  if (access(fullpath, R_OK) != 0) return false;
+#elif defined(_WIN32) || defined(WIN32)
+  if (_waccess(utf8_to_wstring(fullpath).c_str(), 4) != 0) return false;
+#endif
+  return true;
+}
+
+// Returns true if file exits, otherwise false
+bool fileExists(const char *fullpath) {
+  FIO_STAT_CALL(FIOSTAT_FILEEXISTS);
+  bool ret=false;
+#ifdef __linux__
+  if (fileCacheEnabled()) {
+    FileStat st;
+    return fileStatCached(fullpath, st);
+  }
+#endif
+  if (strSize(fullpath) > 0) {
+    ststat64 st_buf;
+    int rc;
+#ifdef __linux__
+    rc = stat64(fullpath, &st_buf);
+#elif defined(_WIN32) || defined(WIN32)
+    rc = stat64(utf8_to_wstring(fullpath).c_str(), &st_buf);
+#else
+    rc = -1;
+#endif
+    ret = (rc == 0);
+  }
+  return ret;
+}
+
+// Maps st_mode to FILETYPE_...
+static int fioFileType(unsigned int mode) {
+  if (S_ISREG(mode)) return FILETYPE_FILE;
+  if (S_ISDIR(mode)) return FILETYPE_DIR;
+#ifdef __linux__
+  if (S_ISLNK(mode)) return FILETYPE_SYMLINK;
+#endif
+  // S_ISLNK is not defined in windows!
+  return FILETYPE_OTHER;
+}
+
+// Returns the type of a file
+// (-1=error, 0=file, 1=directory, 2=symlink, 3=other)
+int fileType(const char *fullpath) {
+  FIO_STAT_CALL(FIOSTAT_FILETYPE);
+  if (strSize(fullpath) == 0) FIO_STAT_RETURN(-1);
+#ifdef __linux__
+  if (fileCacheEnabled()) {
+    FileStat st;
+    fileStatCached(fullpath, st);
+    FIO_STAT_RETURN(st.type);
+  }
+#endif
+  ststat64 st_buf;
+#ifdef __linux__
+  int rc = stat64(fullpath, &st_buf);
+#elif defined(_WIN32) || defined(WIN32)
+  int rc = stat64(utf8_to_wstring(fullpath).c_str(), &st_buf);
+#endif
+  FIO_STAT_RETURN((rc == 0 ? fioFileType(st_buf.st_mode) : FILETYPE_ERROR));
+}
+
+// Returns the modification time of a file
+time_t fileModificationTime(const char *fullpath) {
+  FIO_STAT_CALL(FIOSTAT_FILEMTIME);
+  time_t ret=0;
+  if (strSize(fullpath) == 0) {
+    FIO_STAT_ERROR();
+    return ret;
+  }
+#ifdef __linux__
+  if (fileCacheEnabled()) {
+    FileStat st;
+    if (!fileStatCached(fullpath, st)) {
+      FIO_STAT_ERROR();
+      return ret;
+    }
+    return (time_t)st.mtime;
+  }
+#endif
+  ststat64 st_buf;
+#ifdef __linux__
+  int rc = stat64(fullpath, &st_buf);
+#elif defined(_WIN32) || defined(WIN32)
+  int rc = stat64(utf8_to_wstring(fullpath).c_str(), &st_buf);
+#endif
+  if (rc == 0) {
+    ret=st_buf.st_mtime;
+  } else {
+    FIO_STAT_ERROR();
+  }
+  return ret;
+}
+
+// Deletes a file
+bool fileDelete(const char *fullpath) {
+  FIO_STAT_CALL(FIOSTAT_FILEDELETE);
+  bool ret=false;
+  if (strSize(fullpath) == 0) FIO_STAT_RETURN(ret);
+#ifdef __linux__
+  ret=(unlink(fullpath) != -1);
+#elif defined(_WIN32) || defined(WIN32)
+  ret=(_wunlink(utf8_to_wstring(fullpath).c_str()) != -1);
+#endif
+  FIO_STAT_RETURN(ret);
+}
+
+#ifdef __linux__
+// Fills st for path relative to dirfd with one statx (or fstatat) call
+static bool fioStatAt(int dirfd, const char *path, FileStat &st,
+                      bool followLinks) {
+  const int flags = followLinks ? 0 : AT_SYMLINK_NOFOLLOW;
+#if defined(STATX_BASIC_STATS) && defined(__GLIBC__) \
+    && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 28)
+  struct statx stx;
+  const unsigned int mask = STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE
+                            | STATX_MTIME;
+  if (statx(dirfd, path, flags, mask, &stx) != 0) return false;
+  st.size = stx.stx_size;
+  st.mode = stx.stx_mode;
+  st.mtime = stx.stx_mtime.tv_sec;
+  st.mtimeNsec = stx.stx_mtime.tv_nsec;
+  st.inode = stx.stx_ino;
+#else
+  ststat64 st_buf;
+  if (fstatat64(dirfd, path, &st_buf, flags) != 0) return false;
+  st.size = st_buf.st_size;
+  st.mode = st_buf.st_mode;
+  st.mtime = st_buf.st_mtim.tv_sec;
+  st.mtimeNsec = st_buf.st_mtim.tv_nsec;
+  st.inode = st_buf.st_ino;
+#endif
+  st.type = fioFileType(st.mode);
+  return true;
+}
+#endif
+
+// Fills st with size, type, modification time, mode and inode of the file
+// fullpath with a single system call. Symbolic links are followed unless
+// followLinks is false.
+// Returns true if successfull, otherwise false (st.type is FILETYPE_ERROR).
+bool fileStat(const char *fullpath, FileStat &st, bool followLinks /* =true */) {
+  FIO_STAT_CALL(FIOSTAT_FILESTAT);
+  memset(&st, 0, sizeof(st));
+  st.type = FILETYPE_ERROR;
+  if (strSize(fullpath) == 0) FIO_STAT_RETURN(false);
+#ifdef __linux__
+  if (!fioStatAt(AT_FDCWD, fullpath, st, followLinks)) {
+    st.type = FILETYPE_ERROR;
+    FIO_STAT_RETURN(false);
+  }
+#elif defined(_WIN32) || defined(WIN32)
+  ststat64 st_buf;
+  if (stat64(utf8_to_wstring(fullpath).c_str(), &st_buf) != 0) {
+    FIO_STAT_RETURN(false);
+  }
+  st.size = st_buf.st_size;
+  st.mode = st_buf.st_mode;
+  st.mtime = st_buf.st_mtime;
+  st.type = fioFileType(st.mode);
+#endif
+  FIO_STAT_RETURN(true);
+}
+
+#ifdef __linux__
+// Stats n paths relative to the directory descriptor dirfd (AT_FDCWD for
+// the working directory) into out[0..n-1], spread over threads threads
+// (0 = one per cpu). Failed entries get the type FILETYPE_ERROR.
+// Returns the number of successfull stats.
+size_t fileStatBatch(int dirfd, const char *const *paths, size_t n,
+                     FileStat *out, int threads /* =0 */,
+                     bool followLinks /* =true */) {
+  FIO_STAT_CALL(FIOSTAT_FILESTATBATCH);
+  if (!paths || !out || n == 0) return 0;
+  if (threads <= 0) {
+    threads = (int)std::thread::hardware_concurrency();
+  }
+  // small batches are not worth a thread
+  const size_t BATCH = 64;
+  if ((size_t)threads > (n + BATCH - 1) / BATCH) {
+    threads = (int)((n + BATCH - 1) / BATCH);
+  }
+  if (threads < 1) threads = 1;
+  std::atomic<size_t> next(0);
+  std::atomic<size_t> okCount(0);
+  auto worker = [&]() {
+    size_t cnt = 0;
+    while (true) {
+      const size_t first = next.fetch_add(BATCH);
+      if (first >= n) break;
+      const size_t last = (first + BATCH < n) ? first + BATCH : n;
+      for (size_t i = first; i < last; i++) {
+        memset(&out[i], 0, sizeof(FileStat));
+        if (paths[i] && paths[i][0] != '\0'
+            && fioStatAt(dirfd, paths[i], out[i], followLinks)) {
+          cnt++;
+        } else {
+          out[i].type = FILETYPE_ERROR;
+        }
+      }
+    }
+    okCount += cnt;
+  };
+  std::vector<std::thread> pool;
+  for (int t = 1; t < threads; t++) {
+    pool.push_back(std::thread(worker));
+  }
+  worker();
+  for (size_t t = 0; t < pool.size(); t++) {
+    pool[t].join();
+  }
+  return okCount;
+}
+
+// Cache entry, copied word by word under the seqlock of its slot
+struct FioCacheEntry {
+  uint64_t hash;    // 0 = empty
+  int64_t expires;  // CLOCK_MONOTONIC milliseconds
+  FileStat st;
+  char path[FILECACHE_PATHMAX + 1];
+};
+
+#define FIOCACHE_WORDS ((sizeof(FioCacheEntry) + 7) / 8)
+
+struct FioCacheSlot {
+  std::atomic<uint32_t> seq; // odd while a writer updates the slot
+  std::atomic<uint64_t> w[FIOCACHE_WORDS];
+};
+
+// Per thread group hit/miss counters on separate cache lines
+struct FioCacheCounter {
+  std::atomic<uint64_t> hits;
+  std::atomic<uint64_t> misses;
+  char pad[48];
+};
+
+#define FIOCACHE_COUNTERS 16
+
+// Direct mapped path -> FileStat cache. Lookups are lock free (seqlock),
+// inserts and invalidations are serialised by a mutex. A watcher thread
+// invalidates entries on inotify events of their parent directories.
+class FioStatCache {
+public:
+  FioStatCache() : enabled(false), gen(0), invalidations(0), slots(0),
+                   nslots(0), ttl(0), ifd(-1) {
+    wakefd[0] = wakefd[1] = -1;
+  }
+  ~FioStatCache() {
+    disable();
+    delete[] slots;
+  }
+  bool enable(int ttlMs, size_t n);
+  void disable();
+  bool get(const char *path, uint64_t hash, FileStat &st);
+  void put(const char *path, uint64_t hash, const FileStat &st, uint64_t g);
+  void watchParent(const char *path);
+
+  std::atomic<bool> enabled;
+  std::atomic<uint64_t> gen; // bumped by every invalidation
+  std::atomic<uint64_t> invalidations;
+  FioCacheCounter counters[FIOCACHE_COUNTERS];
+private:
+  void store(FioCacheSlot &sl, const FioCacheEntry &e);
+  void invalidate(const std::string &path);
+  void invalidateAll();
+  void run();
+
+  FioCacheSlot *slots; // allocated once, never freed while running
+  size_t nslots;
+  int64_t ttl;
+  std::mutex mtx;
+  int ifd;
+  int wakefd[2];
+  std::thread watcher;
+  std::map<int, std::vector<std::string> > wdDirs;
+  std::map<std::string, int> dirWd;
+};
+
+static FioStatCache& fioStatCache() {
+  static FioStatCache cache;
+  return cache;
+}
+
+static int64_t fioMonotonicMs() {
+  struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// FNV-1a hash of a path (never 0)
+static uint64_t fioPathHash(const char *s) {
+  uint64_t h = 14695981039346656037ULL;
+  while (*s) {
+    h = (h ^ (uint8_t)*s++) * 1099511628211ULL;
+  }
+  return h ? h : 1;
+}
+
+bool FioStatCache::enable(int ttlMs, size_t n) {
+  std::lock_guard<std::mutex> lock(mtx);
+  if (enabled) return true;
+  if (!slots) {
+    nslots = 64;
+    while (nslots < n && nslots < ((size_t)1 << 24)) nslots <<= 1;
+    slots = new (std::nothrow) FioCacheSlot[nslots]();
+    if (!slots) return false;
+  }
+  ttl = ttlMs;
+  invalidateAll();
+  // without inotify the cache still works with the ttl alone
+  ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (ifd >= 0 && pipe2(wakefd, O_CLOEXEC) == 0) {
+    watcher = std::thread(&FioStatCache::run, this);
+  } else if (ifd >= 0) {
+    ::close(ifd);
+    ifd = -1;
+  }
+  enabled.store(true, std::memory_order_release);
+  return true;
+}
+
+void FioStatCache::disable() {
+  enabled.store(false, std::memory_order_release);
+  if (watcher.joinable()) {
+    const char c = 0;
+    while (::write(wakefd[1], &c, 1) < 0 && errno == EINTR) {}
+    watcher.join();
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  if (ifd >= 0) ::close(ifd);
+  if (wakefd[0] >= 0) ::close(wakefd[0]);
+  if (wakefd[1] >= 0) ::close(wakefd[1]);
+  ifd = wakefd[0] = wakefd[1] = -1;
+  wdDirs.clear();
+  dirWd.clear();
+  if (slots) invalidateAll();
+}
+
+// Lock free lookup, false if missing, expired or raced with a writer
+bool FioStatCache::get(const char *path, uint64_t hash, FileStat &st) {
+  FioCacheSlot &sl = slots[hash & (nslots - 1)];
+  uint64_t w[FIOCACHE_WORDS];
+  const uint32_t s1 = sl.seq.load(std::memory_order_acquire);
+  if (s1 & 1) return false;
+  for (size_t i = 0; i < FIOCACHE_WORDS; i++) {
+    w[i] = sl.w[i].load(std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (sl.seq.load(std::memory_order_relaxed) != s1) return false;
+  FioCacheEntry e;
+  memcpy(&e, w, sizeof(e));
+  if (e.hash != hash || e.expires < fioMonotonicMs()) return false;
+  e.path[FILECACHE_PATHMAX] = '\0';
+  if (strcmp(e.path, path) != 0) return false;
+  st = e.st;
+  return true;
+}
+
+// Writes e into sl (mtx must be held)
+void FioStatCache::store(FioCacheSlot &sl, const FioCacheEntry &e) {
+  uint64_t w[FIOCACHE_WORDS];
+  memset(w, 0, sizeof(w));
+  memcpy(w, &e, sizeof(e));
+  const uint32_t s = sl.seq.load(std::memory_order_relaxed);
+  sl.seq.store(s + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < FIOCACHE_WORDS; i++) {
+    sl.w[i].store(w[i], std::memory_order_relaxed);
+  }
+  sl.seq.store(s + 2, std::memory_order_release);
+}
+
+// Inserts st unless an invalidation happened since generation g was read
+void FioStatCache::put(const char *path, uint64_t hash, const FileStat &st,
+                       uint64_t g) {
+  std::lock_guard<std::mutex> lock(mtx);
+  if (!enabled || gen.load(std::memory_order_acquire) != g) return;
+  FioCacheEntry e;
+  memset(&e, 0, sizeof(e));
+  e.hash = hash;
+  e.expires = fioMonotonicMs() + ttl;
+  e.st = st;
+  strncpy(e.path, path, FILECACHE_PATHMAX);
+  store(slots[hash & (nslots - 1)], e);
+}
+
+// Invalidates the entry of path (mtx must be held)
+void FioStatCache::invalidate(const std::string &path) {
+  const uint64_t hash = fioPathHash(path.c_str());
+  FioCacheSlot &sl = slots[hash & (nslots - 1)];
+  uint64_t w[FIOCACHE_WORDS];
+  for (size_t i = 0; i < FIOCACHE_WORDS; i++) {
+    w[i] = sl.w[i].load(std::memory_order_relaxed);
+  }
+  FioCacheEntry e;
+  memcpy(&e, w, sizeof(e));
+  e.path[FILECACHE_PATHMAX] = '\0';
+  if (e.hash != hash || path != e.path) return;
+  memset(&e, 0, sizeof(e));
+  store(sl, e);
+  invalidations.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Empties all slots (mtx must be held)
+void FioStatCache::invalidateAll() {
+  FioCacheEntry e;
+  memset(&e, 0, sizeof(e));
+  for (size_t i = 0; i < nslots; i++) {
+    if (slots[i].w[0].load(std::memory_order_relaxed) != 0) {
+      store(slots[i], e);
+      invalidations.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  gen.fetch_add(1, std::memory_order_release);
+}
+
+// Watches the directory of path, so changes of path raise events
+void FioStatCache::watchParent(const char *path) {
+  std::lock_guard<std::mutex> lock(mtx);
+  if (ifd < 0) return;
+  const std::string p(path);
+  const size_t pos = p.rfind('/');
+  const std::string dir = (pos == std::string::npos) ? std::string()
+                          : p.substr(0, pos == 0 ? 1 : pos);
+  if (dirWd.count(dir)) return;
+  const uint32_t mask = IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE
+                        | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                        | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+  const int wd = inotify_add_watch(ifd, dir.empty() ? "." : dir.c_str(), mask);
+  if (wd < 0) return; // entries of this directory rely on the ttl
+  dirWd[dir] = wd;
+  wdDirs[wd].push_back(dir);
+}
+
+// Watcher thread: invalidates entries on inotify events
+void FioStatCache::run() {
+  alignas(struct inotify_event) char buf[16384];
+  struct pollfd fds[2];
+  fds[0].fd = ifd;
+  fds[0].events = POLLIN;
+  fds[1].fd = wakefd[0];
+  fds[1].events = POLLIN;
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (fds[1].revents) break;
+    const ssize_t len = ::read(ifd, buf, sizeof(buf));
+    if (len <= 0) continue;
+    std::lock_guard<std::mutex> lock(mtx);
+    for (ssize_t i = 0; i < len; ) {
+      const struct inotify_event *ev = (const struct inotify_event *)(buf + i);
+      i += sizeof(struct inotify_event) + ev->len;
+      if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        invalidateAll();
+      } else if (ev->mask & IN_IGNORED) {
+        std::vector<std::string> &dirs = wdDirs[ev->wd];
+        for (size_t k = 0; k < dirs.size(); k++) {
+          dirWd.erase(dirs[k]);
+        }
+        wdDirs.erase(ev->wd);
+        invalidateAll();
+      } else if (ev->len > 0) {
+        std::map<int, std::vector<std::string> >::iterator it =
+          wdDirs.find(ev->wd);
+        if (it == wdDirs.end()) continue;
+        for (size_t k = 0; k < it->second.size(); k++) {
+          const std::string &dir = it->second[k];
+          if (dir.empty()) {
+            invalidate(ev->name);
+          } else if (dir[dir.size() - 1] == '/') {
+            invalidate(dir + ev->name);
+          } else {
+            invalidate(dir + "/" + ev->name);
+          }
+        }
+      }
+    }
+    gen.fetch_add(1, std::memory_order_release);
+  }
+}
+
+// Enables the metadata cache in front of fileExists, fileSize(path),
+// fileType and fileModificationTime. Entries are invalidated by inotify
+// events of their parent directory and expire after ttlMs milliseconds
+// in any case (changes behind symbolic links are only seen by the ttl).
+// slots is rounded up to a power of two and used on the first call only.
+// Returns true if successfull, otherwise false.
+bool fileCacheEnable(int ttlMs /* =1000 */, size_t slots /* =4096 */) {
+  return fioStatCache().enable(ttlMs, slots);
+}
+
+// Disables the metadata cache and stops the watcher thread
+void fileCacheDisable() {
+  fioStatCache().disable();
+}
+
+// Returns true if the metadata cache is enabled
+bool fileCacheEnabled() {
+  return fioStatCache().enabled.load(std::memory_order_relaxed);
+}
+
+// Returns the hit, miss and invalidation counters of the metadata cache
+FileCacheStats fileCacheStats() {
+  FioStatCache &c = fioStatCache();
+  FileCacheStats ret;
+  ret.hits = ret.misses = 0;
+  for (int i = 0; i < FIOCACHE_COUNTERS; i++) {
+    ret.hits += c.counters[i].hits.load(std::memory_order_relaxed);
+    ret.misses += c.counters[i].misses.load(std::memory_order_relaxed);
+  }
+  ret.invalidations = c.invalidations.load(std::memory_order_relaxed);
+  return ret;
+}
+
+// Like fileStat, but answered from the metadata cache if it is enabled.
+// Missing files are cached as well (st.type is FILETYPE_ERROR).
+bool fileStatCached(const char *fullpath, FileStat &st) {
+  FioStatCache &c = fioStatCache();
+  const size_t len = strSize(fullpath);
+  if (!c.enabled.load(std::memory_order_acquire) || len == 0
+      || len > FILECACHE_PATHMAX) {
+    return fileStat(fullpath, st);
+  }
+  static std::atomic<unsigned int> nextCounter(0);
+  static thread_local unsigned int ci = nextCounter++ % FIOCACHE_COUNTERS;
+  const uint64_t hash = fioPathHash(fullpath);
+  if (c.get(fullpath, hash, st)) {
+    c.counters[ci].hits.fetch_add(1, std::memory_order_relaxed);
+    return (st.type != FILETYPE_ERROR);
+  }
+  c.counters[ci].misses.fetch_add(1, std::memory_order_relaxed);
+  // watch first, so no change after the stat can be missed
+  c.watchParent(fullpath);
+  const uint64_t g = c.gen.load(std::memory_order_acquire);
+  const bool ret = fileStat(fullpath, st);
+  c.put(fullpath, hash, st, g);
+  return ret;
+}
+#endif
+
+// Creates an empty (closed) view
+FileView::FileView()
+  : m_open(false), m_base(0), m_mapLen(0), m_data(0), m_size(0) {
+}
+
+// Unmaps the view
+FileView::~FileView() {
+  close();
+}
+
+// Maps len bytes from offset of the file fullpath.
+// If len is zero, then the view reaches up to the end of the file.
+// Returns true if successfull, otherwise false.
+bool FileView::open(const char *fullpath, int64_t offset /* =0 */,
+                    int64_t len /* =0 */) {
+  FIO_STAT_CALL(FIOSTAT_FILEVIEW);
+  close();
+  if (strSize(fullpath) == 0) FIO_STAT_RETURN(false);
+#ifdef __linux__
+  int fd = ::open(fullpath, O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+  if (fd < 0) FIO_STAT_RETURN(false);
+  bool ret = map(fd, offset, len);
+  ::close(fd); // the mapping stays valid
+#elif defined(_WIN32) || defined(WIN32)
+  HANDLE hFile = CreateFileW(utf8_to_wstring(fullpath).c_str(), GENERIC_READ,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (hFile == INVALID_HANDLE_VALUE) FIO_STAT_RETURN(false);
+  bool ret = map(hFile, offset, len);
+  CloseHandle(hFile);
+#endif
+  FIO_STAT_RETURN(ret);
+}
+
+// Maps len bytes from offset of the file opened with fileOpen.
+// The file position of fp is not changed and fp may be closed afterwards.
+bool FileView::open(FILE *fp, int64_t offset /* =0 */, int64_t len /* =0 */) {
+  FIO_STAT_CALL(FIOSTAT_FILEVIEW);
+  close();
+  if (!fp) FIO_STAT_RETURN(false);
+#ifdef __linux__
+  FIO_STAT_RETURN(map(fileno(fp), offset, len));
+#elif defined(_WIN32) || defined(WIN32)
+  FIO_STAT_RETURN(map((HANDLE)_get_osfhandle(_fileno(fp)), offset, len));
+#endif
+}
+
+#ifdef __linux__
+bool FileView::map(int fd, int64_t offset, int64_t len) {
+  ststat64 st_buf;
+  if (fstat64(fd, &st_buf) != 0) return false;
+  const int64_t fsize = st_buf.st_size;
+  if (offset < 0 || len < 0 || offset > fsize) return false;
+  if (len == 0) {
+    len = fsize - offset;
+  } else if (len > fsize - offset) {
+    return false;
+  }
+  if ((uint64_t)len > (uint64_t)SIZE_MAX) return false;
+  m_open = true;
+  if (len == 0) return true; // empty window, nothing to map
+  // mmap needs a page aligned file offset
+  const int64_t pgsize = sysconf(_SC_PAGESIZE);
+  const int64_t delta = offset % pgsize;
+  void *p = mmap64(0, (size_t)(len + delta), PROT_READ, MAP_SHARED, fd,
+                   offset - delta);
+  if (p == MAP_FAILED) {
+    m_open = false;
+    return false;
+  }
+  m_base = p;
+  m_mapLen = (size_t)(len + delta);
+  m_data = (const uint8_t *)p + delta;
+  m_size = len;
+  return true;
+}
+#elif defined(_WIN32) || defined(WIN32)
+bool FileView::map(HANDLE hFile, int64_t offset, int64_t len) {
+  if (hFile == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER fs;
+  if (!GetFileSizeEx(hFile, &fs)) return false;
+  const int64_t fsize = fs.QuadPart;
+  if (offset < 0 || len < 0 || offset > fsize) return false;
+  if (len == 0) {
+    len = fsize - offset;
+  } else if (len > fsize - offset) {
+    return false;
+  }
+  if ((uint64_t)len > (uint64_t)SIZE_MAX) return false;
+  m_open = true;
+  if (len == 0) return true; // empty window, nothing to map
+  HANDLE hMap = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!hMap) {
+    m_open = false;
+    return false;
+  }
+  // MapViewOfFile needs an offset aligned to the allocation granularity
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  const int64_t delta = offset % si.dwAllocationGranularity;
+  const uint64_t moff = (uint64_t)(offset - delta);
+  void *p = MapViewOfFile(hMap, FILE_MAP_READ, (DWORD)(moff >> 32),
+                          (DWORD)(moff & 0xFFFFFFFF), (SIZE_T)(len + delta));
+  CloseHandle(hMap); // the view keeps the mapping alive
+  if (!p) {
+    m_open = false;
+    return false;
+  }
+  m_base = p;
+  m_mapLen = (size_t)(len + delta);
+  m_data = (const uint8_t *)p + delta;
+  m_size = len;
+  return true;
+}
+#endif
+
+// Unmaps the view (does nothing if the view is not open)
+void FileView::close() {
+  if (m_base) {
+#ifdef __linux__
+    munmap(m_base, m_mapLen);
+#elif defined(_WIN32) || defined(WIN32)
+    UnmapViewOfFile(m_base);
+#endif
+  }
+  m_open = false;
+  m_base = 0;
+  m_mapLen = 0;
+  m_data = 0;
+  m_size = 0;
+}
+
+// Gives the kernel a hint about the access pattern (FILEVIEW_...).
+// On windows the hints are accepted but ignored.
+bool FileView::advise(int advice) {
+  if (!m_open) return false;
+  if (!m_base) return true;
+#ifdef __linux__
+  int a;
+  switch(advice) {
+  case FILEVIEW_NORMAL:     a = MADV_NORMAL; break;
+  case FILEVIEW_SEQUENTIAL: a = MADV_SEQUENTIAL; break;
+  case FILEVIEW_RANDOM:     a = MADV_RANDOM; break;
+  case FILEVIEW_WILLNEED:   a = MADV_WILLNEED; break;
+  case FILEVIEW_DONTNEED:   a = MADV_DONTNEED; break;
+  default: return false;
+  }
+  return (madvise(m_base, m_mapLen, a) == 0);
+#elif defined(_WIN32) || defined(WIN32)
+  return (advice >= FILEVIEW_NORMAL && advice <= FILEVIEW_DONTNEED);
+#endif
+}
+
+// Creates a closed reader with a buffer of bufsize bytes
+FileReader::FileReader(size_t bufsize /* =FILEBUFFEREDSIZE */)
+  : m_buf(0), m_cap(bufsize < 64 ? 64 : bufsize), m_pos(0), m_end(0),
+    m_filePos(0), m_fp(0), m_fd(-1), m_seekable(false),
+    m_status(FIO_ERROR), m_errno(0) {
+}
+
+// Releases the buffer and syncs the file position (see close)
+FileReader::~FileReader() {
+  close();
+  free(m_buf);
+}
+
+// Starts reading at the current position of the file fp
+// Returns true if successfull, otherwise false. On linux fp must be
+// seekable: the bytes stdio buffered from a pipe could not be recovered,
+// open such streams by descriptor before their first stdio read.
+bool FileReader::open(FILE *fp) {
+  close();
+  if (!fp) return false;
+  const int64_t pos = ftello64(fp);
+#ifdef __linux__
+  if (pos < 0) {
+    m_errno = ESPIPE;
+    return false;
+  }
+  fflush(fp);
+  m_fd = fileno(fp);
+#endif
+  m_fp = fp;
+  return start(pos);
+}
+
+// Starts reading at the current position of the file descriptor fd
+// Returns true if successfull, otherwise false.
+bool FileReader::open(int fd) {
+  close();
+  if (fd < 0) return false;
+  m_fd = fd;
+#ifdef __linux__
+  return start(lseek64(fd, 0, SEEK_CUR));
+#elif defined(_WIN32) || defined(WIN32)
+  return start(_lseeki64(fd, 0, SEEK_CUR));
+#endif
+}
+
+bool FileReader::start(int64_t pos) {
+  if (!m_buf) {
+    m_buf = (uint8_t *)malloc(m_cap);
+  }
+  m_seekable = (pos >= 0);
+  m_filePos = m_seekable ? pos : 0;
+  m_pos = m_end = 0;
+  m_status = FIO_OK;
+  m_errno = 0;
+  if (!m_buf) {
+    fail(FIO_ERROR, ENOMEM);
+    return false;
+  }
+  return true;
+}
+
+// Stops reading. The position of the underlying file is set to tell(),
+// so stdio or descriptor reads continue right after the last parsed byte.
+void FileReader::close() {
+  if (m_fp || m_fd >= 0) {
+    if (m_seekable) {
+      if (m_fp) {
+        fseeko64(m_fp, tell(), SEEK_SET);
+      } else {
+#ifdef __linux__
+        lseek64(m_fd, tell(), SEEK_SET);
+#elif defined(_WIN32) || defined(WIN32)
+        _lseeki64(m_fd, tell(), SEEK_SET);
+#endif
+      }
+    }
+  }
+  m_fp = 0;
+  m_fd = -1;
+  m_pos = m_end = 0;
+  m_filePos = 0;
+  m_status = FIO_ERROR;
+}
+
+// Latches the first error and drains the buffer
+void FileReader::fail(int status, int err) {
+  if (m_status == FIO_OK) {
+    m_status = status;
+    m_errno = err;
+  }
+  m_pos = m_end;
+}
+
+// Reads up to n bytes at m_filePos. Returns the bytes read or -1.
+int64_t FileReader::fill(void *dst, size_t n) {
+  FIO_STAT_XFER(FIOSTAT_FILEREADER);
+  int64_t rc;
+  do {
+#ifdef __linux__
+    if (m_seekable) {
+      rc = pread64(m_fd, dst, n, m_filePos);
+    } else {
+      rc = ::read(m_fd, dst, n);
+    }
+#elif defined(_WIN32) || defined(WIN32)
+    if (n > FILEIOMAXCHUNK) n = FILEIOMAXCHUNK;
+    if (m_fp) {
+      rc = fread(dst, 1, n, m_fp);
+      if (rc == 0 && ferror(m_fp)) rc = -1;
+    } else {
+      rc = _read(m_fd, dst, (unsigned int)n);
+    }
+#endif
+  } while (rc < 0 && errno == EINTR);
+  if (rc > 0) {
+    m_filePos += rc;
+  }
+  FIO_STAT_RETURN(rc);
+}
+
+// Ensures that at least need bytes (need <= buffer size) are buffered
+bool FileReader::refill(size_t need) {
+  if (m_status != FIO_OK) return false;
+  // keep the unread rest at the front of the buffer
+  const size_t rest = m_end - m_pos;
+  if (rest > 0 && m_pos > 0) {
+    memmove(m_buf, m_buf + m_pos, rest);
+  }
+  m_pos = 0;
+  m_end = rest;
+  while (m_end < need) {
+    const int64_t rc = fill(m_buf + m_end, m_cap - m_end);
+    if (rc <= 0) {
+      fail(rc == 0 ? FIO_EOF : FIO_ERROR, rc == 0 ? 0 : errno);
+      return false;
+    }
+    m_end += rc;
+  }
+  return true;
+}
+
+// Reads n bytes into dst. Large reads bypass the buffer.
+// Returns true if successfull, otherwise false (status is latched).
+bool FileReader::readBytes(void *dst, size_t n) {
+  if (m_status != FIO_OK) return false;
+  if (!dst && n > 0) {
+    fail(FIO_ERROR, EINVAL);
+    return false;
+  }
+  uint8_t *d = (uint8_t *)dst;
+  size_t avail = m_end - m_pos;
+  if (n <= avail) {
+    memcpy(d, m_buf + m_pos, n);
+    m_pos += n;
+    return true;
+  }
+  memcpy(d, m_buf + m_pos, avail);
+  m_pos = m_end = 0;   // the buffer no longer ends at m_filePos
+  d += avail;
+  n -= avail;
+  if (n < m_cap) {
+    if (!refill(n)) return false;
+    memcpy(d, m_buf, n);
+    m_pos = n;
+    return true;
+  }
+  while (n > 0) {
+    const int64_t rc = fill(d, n);
+    if (rc <= 0) {
+      fail(rc == 0 ? FIO_EOF : FIO_ERROR, rc == 0 ? 0 : errno);
+      return false;
+    }
+    d += rc;
+    n -= rc;
+  }
+  return true;
+}
+
+// Skips n bytes forward (or backward if n is negative)
+bool FileReader::skip(int64_t n) {
+  if (m_status == FIO_ERROR) return false;
+  if (m_status == FIO_OK && n >= 0
+      && (uint64_t)n <= (uint64_t)(m_end - m_pos)) {
+    m_pos += n;
+    return true;
+  }
+  return seek(tell() + n);
+}
+
+// Sets the read position to pos (bytes from the start of the file).
+// Non seekable streams can only be moved forward. Clears FIO_EOF, an
+// error stays latched.
+bool FileReader::seek(int64_t pos) {
+  if (m_status == FIO_ERROR) return false;
+  m_status = FIO_OK;
+  // target inside the buffer
+  const int64_t bufStart = m_filePos - (int64_t)m_end;
+  if (pos >= bufStart && pos <= m_filePos) {
+    m_pos = pos - bufStart;
+    return true;
+  }
+  if (pos < 0 || (!m_seekable && pos < tell())) {
+    fail(FIO_ERROR, EINVAL);
+    return false;
+  }
+  if (!m_seekable) {
+    // consume the stream up to pos
+    int64_t n = pos - tell();
+    while (n > 0) {
+      m_pos = m_end;
+      const size_t k = (n > (int64_t)m_cap) ? m_cap : (size_t)n;
+      if (!refill(k)) return false;
+      m_pos = k;
+      n -= k;
+    }
+    return true;
+  }
+#if defined(_WIN32) || defined(WIN32)
+  int64_t rc = m_fp ? fseeko64(m_fp, pos, SEEK_SET)
+                    : (_lseeki64(m_fd, pos, SEEK_SET) < 0 ? -1 : 0);
+  if (rc != 0) {
+    fail(FIO_ERROR, errno);
+    return false;
+  }
+#endif
+  m_filePos = pos;
+  m_pos = m_end = 0;
+  return true;
+}
+
+
+// Creates a closed writer with a buffer of bufsize bytes, which is flushed
+// in multiples of align bytes (align=0 or 1 disables the alignment).
+FileWriter::FileWriter(size_t bufsize /* =FILEBUFFEREDSIZE */,
+                       size_t align /* =4096 */)
+  : m_buf(0), m_cap(bufsize < 64 ? 64 : bufsize), m_align(align),
+    m_len(m_cap), m_filePos(0), m_fp(0), m_fd(-1), m_seekable(false),
+    m_status(FIO_ERROR), m_errno(0),
+    m_errorOffset(-1) {
+  if (m_align < 1 || m_align > m_cap / 2) m_align = 1;
+}
+
+// Flushes the buffer (see close) and releases it
+FileWriter::~FileWriter() {
+  close();
+  free(m_buf);
+}
+
+// Starts writing at the current position of the file fp
+// Returns true if successfull, otherwise false.
+bool FileWriter::open(FILE *fp) {
+  close();
+  if (!fp) return false;
+  if (fflush(fp) != 0) return false;
+  m_fp = fp;
+  const int64_t pos = ftello64(fp);
+#ifdef __linux__
+  m_fd = fileno(fp);
+  if (pos >= 0) lseek64(m_fd, pos, SEEK_SET);
+#endif
+  return start(pos);
+}
+
+// Starts writing at the current position of the file descriptor fd
+// Returns true if successfull, otherwise false.
+bool FileWriter::open(int fd) {
+  close();
+  if (fd < 0) return false;
+  m_fd = fd;
+#ifdef __linux__
+  return start(lseek64(fd, 0, SEEK_CUR));
+#elif defined(_WIN32) || defined(WIN32)
+  return start(_lseeki64(fd, 0, SEEK_CUR));
+#endif
+}
+
+bool FileWriter::start(int64_t pos) {
+  if (!m_buf) {
+    m_buf = (uint8_t *)malloc(m_cap);
+  }
+  m_seekable = (pos >= 0);
+  m_filePos = m_seekable ? pos : 0;
+  m_len = 0;
+  m_status = FIO_OK;
+  m_errno = 0;
+  m_errorOffset = -1;
+  if (!m_buf) {
+    m_status = FIO_ERROR;
+    m_errno = ENOMEM;
+    m_errorOffset = m_filePos;
+    m_len = m_cap;
+    return false;
+  }
+  return true;
+}
+
+// Flushes the buffer and stops writing. The position of a FILE* is moved
+// to the end of the written data.
+// Returns true if all data was written, otherwise false.
+bool FileWriter::close() {
+  bool ret = true;
+  if (m_fp || m_fd >= 0) {
+    ret = flush();
+    if (m_fp && m_seekable) {
+      fseeko64(m_fp, m_filePos, SEEK_SET);
+    }
+  }
+  m_fp = 0;
+  m_fd = -1;
+  m_len = m_cap; // inline writes take the slow path and fail
+  if (m_status == FIO_OK) {
+    m_status = FIO_ERROR; // writes on a closed writer fail
+  }
+  return ret;
+}
+
+// Writes n bytes unbuffered and records the first error. After an error
+// the buffer counts as full, so the inline writes fail as well.
+bool FileWriter::put(const uint8_t *p, size_t n) {
+  FIO_STAT_IO(FIOSTAT_FILEWRITER, n);
+  while (n > 0) {
+    const size_t chunk = (n > FILEIOMAXCHUNK) ? FILEIOMAXCHUNK : n;
+    int64_t rc;
+#ifdef __linux__
+    rc = ::write(m_fd, p, chunk);
+#elif defined(_WIN32) || defined(WIN32)
+    if (m_fp) {
+      rc = fwrite(p, 1, chunk, m_fp);
+      if (rc == 0) rc = -1;
+    } else {
+      rc = _write(m_fd, p, (unsigned int)chunk);
+    }
+#endif
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) {
+      m_status = FIO_ERROR;
+      m_errno = (rc == 0) ? EIO : errno;
+      m_errorOffset = m_filePos;
+      m_len = m_cap;
+      FIO_STAT_RETURN(false);
+    }
+    p += rc;
+    n -= rc;
+    m_filePos += rc;
+  }
+  FIO_STAT_RETURN(true);
+}
+
+// Makes room for need bytes. Only whole align blocks are written
+// if that frees enough space.
+bool FileWriter::drain(size_t need) {
+  if (m_status != FIO_OK) return false;
+  size_t n = m_len;
+  if (m_align > 1) {
+    const size_t head = (size_t)(m_filePos % m_align);
+    const size_t k = ((head + m_len) / m_align) * m_align;
+    if (k > head && m_cap - (m_len - (k - head)) >= need) {
+      n = k - head;
+    }
+  }
+  if (!put(m_buf, n)) return false;
+  m_len -= n;
+  if (m_len > 0) {
+    memmove(m_buf, m_buf + n, m_len);
+  }
+  return true;
+}
+
+// Writes n bytes from src. Large blocks bypass the buffer.
+// Returns true if successfull, otherwise false (status is latched).
+bool FileWriter::writeBytes(const void *src, size_t n) {
+  if (m_status != FIO_OK) return false;
+  if (!src && n > 0) {
+    m_status = FIO_ERROR;
+    m_errno = EINVAL;
+    m_errorOffset = m_filePos + (int64_t)m_len;
+    m_len = m_cap;
+    return false;
+  }
+  if (m_cap - m_len >= n) {
+    memcpy(m_buf + m_len, src, n);
+    m_len += n;
+    return true;
+  }
+  if (n >= m_cap) {
+    if (!flush()) return false;
+    return put((const uint8_t *)src, n);
+  }
+  if (!drain(n)) return false;
+  memcpy(m_buf + m_len, src, n);
+  m_len += n;
+  return true;
+}
+
+// Writes all buffered bytes
+// Returns true if successfull, otherwise false.
+bool FileWriter::flush() {
+  if (m_status != FIO_OK) return false;
+  if (!put(m_buf, m_len)) return false;
+  m_len = 0;
+  return true;
+}
+
+#if defined(_WIN32) || defined(WIN32)
+// ReadFile/WriteFile move the file pointer of a synchronous handle even
+// with an OVERLAPPED offset, so the positional calls save and restore it
+// and are serialized by this lock.
+static SRWLOCK fioPositionalLock = SRWLOCK_INIT;
+#endif
+
+// Reads up to len bytes at offset of the file descriptor fd into dst.
+// The file position is neither used nor changed (pread; on windows it is
+// restored and the calls are serialized).
+// Returns the number of bytes read (short on end of file) or -1 on errors.
+int64_t fileReadAt(int fd, int64_t offset, void *dst, int64_t len) {
+  FIO_STAT_XFER(FIOSTAT_FILEREADAT);
+  if (fd < 0 || offset < 0 || len < 0 || (!dst && len > 0)) {
+    FIO_STAT_RETURN(-1);
+  }
+  uint8_t *p = (uint8_t *)dst;
+  int64_t n = 0;
+#if defined(_WIN32) || defined(WIN32)
+  AcquireSRWLockExclusive(&fioPositionalLock);
+  const int64_t saved = _lseeki64(fd, 0, SEEK_CUR);
+#endif
+  while (n < len) {
+    const size_t chunk = (len - n > FILEIOMAXCHUNK) ? FILEIOMAXCHUNK
+                                                    : (size_t)(len - n);
+#ifdef __linux__
+    const ssize_t rc = pread64(fd, p + n, chunk, offset + n);
+    if (rc < 0 && errno == EINTR) continue;
+#elif defined(_WIN32) || defined(WIN32)
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)(offset + n);
+    ov.OffsetHigh = (DWORD)((offset + n) >> 32);
+    DWORD got = 0;
+    int64_t rc = got;
+    if (ReadFile((HANDLE)_get_osfhandle(fd), p + n, (DWORD)chunk, &got,
+                 &ov)) {
+      rc = got;
+    } else if (GetLastError() != ERROR_HANDLE_EOF) {
+      rc = -1;
+    }
+#endif
+    if (rc < 0) {
+      n = -1;
+      break;
+    }
+    if (rc == 0) break;
+    n += rc;
+  }
+#if defined(_WIN32) || defined(WIN32)
+  if (saved >= 0) _lseeki64(fd, saved, SEEK_SET);
+  ReleaseSRWLockExclusive(&fioPositionalLock);
+#endif
+  FIO_STAT_RETURN(n);
+}
+
+// Writes len bytes from src at offset of the file descriptor fd.
+// The file position is neither used nor changed (pwrite; on windows it is
+// restored and the calls are serialized).
+// Returns true if successfull, otherwise false.
+bool fileWriteAt(int fd, int64_t offset, const void *src, int64_t len) {
+  FIO_STAT_IO(FIOSTAT_FILEWRITEAT, len);
+  if (fd < 0 || offset < 0 || len < 0 || (!src && len > 0)) {
+    FIO_STAT_RETURN(false);
+  }
+  const uint8_t *p = (const uint8_t *)src;
+  int64_t n = 0;
+  bool ret = true;
+#if defined(_WIN32) || defined(WIN32)
+  AcquireSRWLockExclusive(&fioPositionalLock);
+  const int64_t saved = _lseeki64(fd, 0, SEEK_CUR);
+#endif
+  while (n < len) {
+    const size_t chunk = (len - n > FILEIOMAXCHUNK) ? FILEIOMAXCHUNK
+                                                    : (size_t)(len - n);
+#ifdef __linux__
+    const ssize_t rc = pwrite64(fd, p + n, chunk, offset + n);
+    if (rc < 0 && errno == EINTR) continue;
+#elif defined(_WIN32) || defined(WIN32)
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)(offset + n);
+    ov.OffsetHigh = (DWORD)((offset + n) >> 32);
+    DWORD put = 0;
+    const int64_t rc = WriteFile((HANDLE)_get_osfhandle(fd), p + n,
+                                 (DWORD)chunk, &put, &ov) ? put : -1;
+#endif
+    if (rc <= 0) {
+      ret = false;
+      break;
+    }
+    n += rc;
+  }
+#if defined(_WIN32) || defined(WIN32)
+  if (saved >= 0) _lseeki64(fd, saved, SEEK_SET);
+  ReleaseSRWLockExclusive(&fioPositionalLock);
+#endif
+  FIO_STAT_RETURN(ret);
+}
+
+// Opens the file fullpath for positional reads (and writes if writable,
+// the file is created if needed). Returns true if successfull, otherwise
+// false.
+bool FilePositional::open(const char *fullpath,
+                          bool writable /* =false */) {
+  close();
+  if (strSize(fullpath) == 0) return false;
+#ifdef __linux__
+  m_fd = ::open(fullpath, (writable ? O_RDWR | O_CREAT : O_RDONLY)
+                          | O_LARGEFILE | O_CLOEXEC, 0666);
+#elif defined(_WIN32) || defined(WIN32)
+  m_fd = _wopen(utf8_to_wstring(fullpath).c_str(),
+                (writable ? _O_RDWR | _O_CREAT : _O_RDONLY) | _O_BINARY,
+                _S_IREAD | _S_IWRITE);
+#endif
+  m_own = (m_fd >= 0);
+  return m_own;
+}
+
+// Uses the descriptor of fp (from fileOpen); pending stdio output is
+// flushed first. fp must stay open while this object is used.
+bool FilePositional::open(FILE *fp) {
+  close();
+  if (!fp || fflush(fp) != 0) return false;
+  return open(fileno(fp));
+}
+
+// Uses the file descriptor fd, which must stay open while this object
+// is used
+bool FilePositional::open(int fd) {
+  close();
+  if (fd < 0) return false;
+  m_fd = fd;
+  return true;
+}
+
+// Closes the file if it was opened by open(fullpath)
+void FilePositional::close() {
+  if (m_own) {
+#ifdef __linux__
+    ::close(m_fd);
+#elif defined(_WIN32) || defined(WIN32)
+    _close(m_fd);
+#endif
+  }
+  m_fd = -1;
+  m_own = false;
+}
+
+// Returns the file size in bytes or -1 on errors
+int64_t FilePositional::size() const {
+  ststat64 st_buf;
+  if (m_fd < 0 || fstat64(m_fd, &st_buf) != 0) return -1;
+  return st_buf.st_size;
+}
+
+// Most ranges (and iovecs) in one request of fileLoadRanges
+#define FIORANGEMAXVEC 512
+
+// Sorts the non empty ranges by offset (order) and groups them into
+// requests [first, last) of order: a range joins the request before it if
+// it starts at most maxGap bytes behind its end and does not overlap it.
+static void fioRangeGroups(FileRange *ranges, size_t count, int64_t maxGap,
+                           std::vector<size_t> &order,
+                           std::vector<std::pair<size_t, size_t> > &groups) {
+  order.clear();
+  groups.clear();
+  for (size_t i = 0; i < count; i++) {
+    ranges[i].result = (ranges[i].length == 0) ? 0 : -1;
+    if (ranges[i].length > 0) order.push_back(i);
+  }
+  std::sort(order.begin(), order.end(), [ranges](size_t a, size_t b) {
+    return ranges[a].offset < ranges[b].offset;
+  });
+  size_t first = 0;
+  int64_t end = 0;
+  for (size_t k = 0; k < order.size(); k++) {
+    const FileRange &r = ranges[order[k]];
+    const bool join = k > first && r.offset >= end && r.offset - end <= maxGap
+                      && k - first < FIORANGEMAXVEC
+                      && r.offset + r.length - ranges[order[first]].offset
+                         <= FILEIOMAXCHUNK;
+    if (k > first && !join) {
+      groups.push_back(std::make_pair(first, k));
+      first = k;
+    }
+    end = r.offset + r.length;
+  }
+  if (first < order.size()) {
+    groups.push_back(std::make_pair(first, order.size()));
+  }
+}
+
+// Sets the results of the ranges [first, last) of order after got bytes
+// were read from the offset of the first one (got < 0: error). With src
+// the bytes are copied from that staging buffer into the ranges.
+static void fioRangeScatter(FileRange *ranges, const size_t *order,
+                            size_t first, size_t last, int64_t got,
+                            const uint8_t *src) {
+  const int64_t start = ranges[order[first]].offset;
+  for (size_t k = first; k < last; k++) {
+    FileRange &r = ranges[order[k]];
+    if (got < 0) {
+      r.result = -1;
+      continue;
+    }
+    int64_t n = got - (r.offset - start);
+    if (n < 0) n = 0;
+    if (n > r.length) n = r.length;
+    if (src && n > 0) memcpy(r.dst, src + (r.offset - start), n);
+    r.result = n;
+  }
+}
+
+// Reads many (offset, length) ranges of the file descriptor fd into their
+// dst buffers. The ranges are sorted and ranges with gaps of at most
+// maxGap bytes are read together in one preadv request (the gaps go to a
+// scratch buffer), so clustered lookups need few system calls. The file
+// position is not used. Every range gets its result.
+// Returns the number of read requests or -1 on errors.
+int64_t fileLoadRanges(int fd, FileRange *ranges, size_t count,
+                       int64_t maxGap /* =FILERANGEGAP */) {
+  FIO_STAT_CALL(FIOSTAT_FILELOADRANGES);
+  if (fd < 0 || (!ranges && count > 0)) FIO_STAT_RETURN(-1);
+  for (size_t i = 0; i < count; i++) {
+    if (ranges[i].offset < 0 || ranges[i].length < 0
+        || (!ranges[i].dst && ranges[i].length > 0)) {
+      FIO_STAT_RETURN(-1);
+    }
+  }
+  if (maxGap < 0) maxGap = 0;
+  std::vector<size_t> order;
+  std::vector<std::pair<size_t, size_t> > groups;
+  fioRangeGroups(ranges, count, maxGap, order, groups);
+  bool err = false;
+#ifdef __linux__
+  fioBuffer scratch(maxGap > 0 ? (size_t)maxGap : 1);
+  std::vector<struct iovec> vec;
+  for (size_t g = 0; g < groups.size(); g++) {
+    const size_t first = groups[g].first;
+    const size_t last = groups[g].second;
+    const int64_t start = ranges[order[first]].offset;
+    int64_t pos = start;
+    vec.clear();
+    for (size_t k = first; k < last; k++) {
+      const FileRange &r = ranges[order[k]];
+      if (r.offset > pos) {
+        struct iovec gap = { &scratch[0], (size_t)(r.offset - pos) };
+        vec.push_back(gap);
+      }
+      struct iovec v = { r.dst, (size_t)r.length };
+      vec.push_back(v);
+      pos = r.offset + r.length;
+    }
+    int64_t got = 0;
+    size_t i = 0;
+    while (i < vec.size()) {
+      const ssize_t rc = preadv64(fd, &vec[i], (int)(vec.size() - i),
+                                  start + got);
+      if (rc < 0 && errno == EINTR) continue;
+      if (rc <= 0) {
+        if (rc < 0) got = -1;
+        break;
+      }
+      got += rc;
+      // advance over the filled buffers
+      size_t adv = rc;
+      while (i < vec.size() && adv >= vec[i].iov_len) {
+        adv -= vec[i].iov_len;
+        i++;
+      }
+      if (i < vec.size()) {
+        vec[i].iov_base = (uint8_t *)vec[i].iov_base + adv;
+        vec[i].iov_len -= adv;
+      }
+    }
+    if (got < 0) err = true;
+    fioRangeScatter(ranges, &order[0], first, last, got, 0);
+  }
+#elif defined(_WIN32) || defined(WIN32)
+  fioBuffer stage;
+  for (size_t g = 0; g < groups.size(); g++) {
+    const size_t first = groups[g].first;
+    const size_t last = groups[g].second;
+    const FileRange &a = ranges[order[first]];
+    const FileRange &b = ranges[order[last - 1]];
+    const int64_t span = b.offset + b.length - a.offset;
+    int64_t got;
+    if (last - first == 1) {
+      got = fileReadAt(fd, a.offset, a.dst, a.length);
+      fioRangeScatter(ranges, &order[0], first, last, got, 0);
+    } else {
+      stage.resize(span);
+      got = fileReadAt(fd, a.offset, &stage[0], span);
+      fioRangeScatter(ranges, &order[0], first, last, got, &stage[0]);
+    }
+    if (got < 0) err = true;
+  }
+#endif
+  FIO_STAT_RETURN(err ? -1 : (int64_t)groups.size());
+}
+
+// Like fileLoadRanges(fd), for a file opened with fileOpen. The stream
+// position is not changed.
+int64_t fileLoadRanges(FILE *fp, FileRange *ranges, size_t count,
+                       int64_t maxGap /* =FILERANGEGAP */) {
+  FIO_STAT_CALL(FIOSTAT_FILELOADRANGES);
+  if (!fp || fflush(fp) != 0) FIO_STAT_RETURN(-1);
+  FIO_STAT_RETURN(fileLoadRanges(fileno(fp), ranges, count, maxGap));
+}
+
+// Streams fp from its current position (see next)
+FileChunks::FileChunks(FILE *fp, size_t chunkSize /* =FILECHUNKSIZE */,
+                       size_t overlap /* =0 */)
+  : m_fp(fp), m_chunkSize(chunkSize), m_overlap(overlap), m_cur(0),
+    m_filePos(fp ? ftello64(fp) : 0), m_status(FIO_OK), m_errno(0) {
+  m_bufs[0] = m_bufs[1] = 0;
+  memset(&m_chunk, 0, sizeof(m_chunk));
+  if (!fp || chunkSize == 0) {
+    m_status = FIO_ERROR;
+    m_errno = EINVAL;
+  }
+}
+
+// Releases the buffers
+FileChunks::~FileChunks() {
+  free(m_bufs[0]);
+  free(m_bufs[1]);
+}
+
+// Reads the next chunk into the other buffer, after the overlap bytes of
+// the current one. Returns false at the end of the file (status FIO_EOF)
+// or on errors (FIO_ERROR, see error()).
+bool FileChunks::next() {
+  if (m_status != FIO_OK) return false;
+  if (!m_bufs[0]) {
+    m_bufs[0] = (uint8_t *)malloc(m_overlap + m_chunkSize);
+    m_bufs[1] = (uint8_t *)malloc(m_overlap + m_chunkSize);
+    if (!m_bufs[0] || !m_bufs[1]) {
+      m_status = FIO_ERROR;
+      m_errno = ENOMEM;
+      return false;
+    }
+  }
+  uint8_t *buf = m_bufs[m_cur ^ 1];
+  const size_t keep = (m_chunk.size < m_overlap) ? m_chunk.size : m_overlap;
+  if (keep > 0) memcpy(buf, m_chunk.data + m_chunk.size - keep, keep);
+  const int64_t n = fileReadBytes(m_fp, buf + keep, m_chunkSize);
+  if (n <= 0) {
+    m_status = (n < 0) ? FIO_ERROR : FIO_EOF;
+    m_errno = (n < 0) ? errno : 0;
+    return false;
+  }
+  m_cur ^= 1;
+  m_chunk.data = buf;
+  m_chunk.size = keep + (size_t)n;
+  m_chunk.overlap = keep;
+  m_chunk.offset = m_filePos - (int64_t)keep;
+  m_filePos += n;
+  return true;
+}
+
+// Calls cb for every chunk of fp from its current position (see
+// FileChunks); cb returns false to stop. Memory use is bounded by
+// 2 * (overlap + chunkSize) bytes whatever the file size.
+// Returns the number of new bytes passed to cb or -1 on errors.
+int64_t fileForEachChunk(FILE *fp, size_t chunkSize,
+                         const FileChunkCallback &cb,
+                         size_t overlap /* =0 */) {
+  FileChunks chunks(fp, chunkSize, overlap);
+  int64_t n = 0;
+  while (chunks.next()) {
+    n += chunks.chunk().size - chunks.chunk().overlap;
+    if (!cb(chunks.chunk())) break;
+  }
+  return chunks.ok() ? n : -1;
+}
+
+#ifdef __linux__
+// Creates a closed reader; buffers chunks of bufsize bytes are read ahead
+FilePrefetchReader::FilePrefetchReader(
+    size_t bufsize /* =FILECHUNKSIZE */, int buffers /* =FILEPREFETCHBUFS */)
+  : m_cap(bufsize < 4096 ? 4096 : bufsize),
+    m_count(buffers < 2 ? 2 : buffers), m_bufs(0), m_sizes(0), m_fp(0),
+    m_fd(-1), m_start(0), m_pos(0), m_filled(0), m_consumed(0),
+    m_holding(false), m_done(false), m_stop(false), m_endStatus(FIO_EOF),
+    m_status(FIO_ERROR), m_errno(0) {
+}
+
+// Stops the worker and releases the buffers
+FilePrefetchReader::~FilePrefetchReader() {
+  close();
+  if (m_bufs) {
+    for (int i = 0; i < m_count; i++) {
+      free(m_bufs[i]);
+    }
+  }
+  delete[] m_bufs;
+  delete[] m_sizes;
+}
+
+// Starts reading ahead at the current position of fp (from fileOpen).
+// Returns true if successfull, otherwise false. fp must be seekable: the
+// bytes stdio buffered from a pipe could not be recovered, open such
+// streams by descriptor before their first stdio read.
+bool FilePrefetchReader::open(FILE *fp) {
+  close();
+  if (!fp) return false;
+  const int64_t pos = ftello64(fp);
+  if (pos < 0) {
+    m_errno = ESPIPE;
+    return false;
+  }
+  if (fflush(fp) != 0) return false;
+  m_fp = fp;
+  m_fd = fileno(fp);
+  return start(pos);
+}
+
+// Starts reading ahead at the current position of the file descriptor fd
+// Returns true if successfull, otherwise false.
+bool FilePrefetchReader::open(int fd) {
+  close();
+  if (fd < 0) return false;
+  m_fd = fd;
+  return start(lseek64(fd, 0, SEEK_CUR));
+}
+
+bool FilePrefetchReader::start(int64_t pos) {
+  if (!m_bufs) {
+    m_bufs = new uint8_t *[m_count]();
+    m_sizes = new size_t[m_count];
+    for (int i = 0; i < m_count; i++) {
+      m_bufs[i] = (uint8_t *)malloc(m_cap);
+      if (!m_bufs[i]) {
+        for (int j = 0; j < i; j++) {
+          free(m_bufs[j]);
+        }
+        delete[] m_bufs;
+        delete[] m_sizes;
+        m_bufs = 0;
+        m_sizes = 0;
+        m_fp = 0;
+        m_fd = -1;
+        m_errno = ENOMEM;
+        return false;
+      }
+    }
+  }
+  m_start = (pos >= 0) ? pos : -1;
+  m_pos = (pos >= 0) ? pos : 0;
+  m_filled = m_consumed = 0;
+  m_holding = m_done = m_stop = false;
+  m_endStatus = FIO_EOF;
+  m_status = FIO_OK;
+  m_errno = 0;
+  m_thread = std::thread(&FilePrefetchReader::worker, this);
+  return true;
+}
+
+// Stops the worker. The position of the underlying file is set right
+// after the last chunk handed out.
+void FilePrefetchReader::close() {
+  if (m_fd < 0) return;
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_stop = true;
+  }
+  m_freeCv.notify_all();
+  m_thread.join();
+  if (m_start >= 0) {
+    if (m_fp) {
+      fseeko64(m_fp, m_pos, SEEK_SET);
+    } else {
+      lseek64(m_fd, m_pos, SEEK_SET);
+    }
+  }
+  m_fp = 0;
+  m_fd = -1;
+  m_status = FIO_ERROR;
+}
+
+// Gives the previous chunk back and returns the next one in c (valid
+// until the next call); waits only if the worker is behind. Returns false
+// at the end of the file (status FIO_EOF) or on errors (FIO_ERROR).
+bool FilePrefetchReader::next(FileChunk &c) {
+  if (m_status != FIO_OK) return false;
+  std::unique_lock<std::mutex> lock(m_mtx);
+  if (m_holding) {
+    m_consumed++;
+    m_holding = false;
+    m_freeCv.notify_one();
+  }
+  while (m_filled == m_consumed && !m_done) {
+    m_fullCv.wait(lock);
+  }
+  if (m_filled == m_consumed) {
+    m_status = m_endStatus;
+    return false;
+  }
+  const int i = (int)(m_consumed % m_count);
+  c.data = m_bufs[i];
+  c.size = m_sizes[i];
+  c.overlap = 0;
+  c.offset = m_pos;
+  m_pos += m_sizes[i];
+  m_holding = true;
+  return true;
+}
+
+// Worker thread: fills free buffers in file order
+void FilePrefetchReader::worker() {
+  if (m_start >= 0) posix_fadvise(m_fd, m_start, 0, POSIX_FADV_SEQUENTIAL);
+  int64_t pos = (m_start >= 0) ? m_start : 0;
+  while (true) {
+    uint64_t seq;
+    {
+      std::unique_lock<std::mutex> lock(m_mtx);
+      while (!m_stop && m_filled - m_consumed >= (uint64_t)m_count) {
+        m_freeCv.wait(lock);
+      }
+      if (m_stop) return;
+      seq = m_filled;
+    }
+    // the kernel fetches the next chunk while this one is copied
+    if (m_start >= 0) readahead(m_fd, pos + m_cap, m_cap);
+    uint8_t *buf = m_bufs[seq % m_count];
+    size_t n = 0;
+    int err = 0;
+    while (n < m_cap) {
+      const ssize_t rc = (m_start >= 0)
+                         ? pread64(m_fd, buf + n, m_cap - n, pos + n)
+                         : ::read(m_fd, buf + n, m_cap - n);
+      if (rc < 0 && errno == EINTR) continue;
+      if (rc <= 0) {
+        if (rc < 0) err = errno;
+        break;
+      }
+      n += rc;
+    }
+    pos += n;
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (n > 0) {
+      m_sizes[seq % m_count] = n;
+      m_filled++;
+    }
+    if (n < m_cap) {
+      m_done = true;
+      m_endStatus = err ? FIO_ERROR : FIO_EOF;
+      m_errno = err;
+    }
+    m_fullCv.notify_one();
+    if (m_done) return;
+  }
+}
+
+// Creates a closed writer with buffers of bufsize bytes. syncEvery > 0
+// starts the writeback every syncEvery bytes (sync_file_range).
+FileFlushWriter::FileFlushWriter(size_t bufsize /* =FILECHUNKSIZE */,
+                                 int buffers /* =FILEFLUSHBUFS */,
+                                 int64_t syncEvery /* =0 */)
+  : m_cap(bufsize < 4096 ? 4096 : bufsize),
+    m_count(buffers < 2 ? 2 : buffers), m_syncEvery(syncEvery), m_bufs(0),
+    m_sizes(0), m_cur(0), m_len(m_cap), m_fp(0), m_fd(-1),
+    m_seekable(false), m_filePos(0), m_queued(0), m_written(0), m_stop(false),
+    m_status(FIO_ERROR), m_errno(0) {
+}
+
+// Writes the rest (see close) and releases the buffers
+FileFlushWriter::~FileFlushWriter() {
+  close();
+  if (m_bufs) {
+    for (int i = 0; i < m_count; i++) {
+      free(m_bufs[i]);
+    }
+  }
+  delete[] m_bufs;
+  delete[] m_sizes;
+}
+
+// Starts writing at the current position of fp (from fileOpen).
+// Returns true if successfull, otherwise false.
+bool FileFlushWriter::open(FILE *fp) {
+  close();
+  if (!fp || fflush(fp) != 0) return false;
+  m_fp = fp;
+  m_fd = fileno(fp);
+  return start(ftello64(fp));
+}
+
+// Starts writing at the current position of the file descriptor fd
+// Returns true if successfull, otherwise false.
+bool FileFlushWriter::open(int fd) {
+  close();
+  if (fd < 0) return false;
+  m_fd = fd;
+  return start(lseek64(fd, 0, SEEK_CUR));
+}
+
+bool FileFlushWriter::start(int64_t pos) {
+  if (!m_bufs) {
+    m_bufs = new uint8_t *[m_count]();
+    m_sizes = new size_t[m_count];
+    for (int i = 0; i < m_count; i++) {
+      m_bufs[i] = (uint8_t *)malloc(m_cap);
+      if (!m_bufs[i]) {
+        for (int j = 0; j < i; j++) {
+          free(m_bufs[j]);
+        }
+        delete[] m_bufs;
+        delete[] m_sizes;
+        m_bufs = 0;
+        m_sizes = 0;
+        m_fp = 0;
+        m_fd = -1;
+        m_errno = ENOMEM;
+        return false;
+      }
+    }
+  }
+  m_seekable = (pos >= 0);
+  m_filePos = m_seekable ? pos : 0;
+  m_queued = m_written = 0;
+  m_cur = m_bufs[0];
+  m_len = 0;
+  m_stop = false;
+  m_status = FIO_OK;
+  m_errno = 0;
+  m_thread = std::thread(&FileFlushWriter::worker, this, m_filePos);
+  return true;
+}
+
+// Writes the buffered bytes, waits for the worker and stops it. The
+// position of the underlying file is set after the last byte.
+// Returns true if all bytes were written, otherwise false.
+bool FileFlushWriter::close() {
+  if (m_fd < 0) return true;
+  bool ret = flush();
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_stop = true;
+  }
+  m_queuedCv.notify_one();
+  m_thread.join();
+  if (m_seekable) {
+    if (m_fp) {
+      fseeko64(m_fp, m_filePos, SEEK_SET);
+    } else {
+      lseek64(m_fd, m_filePos, SEEK_SET);
+    }
+  }
+  if (m_status != FIO_OK) ret = false;
+  m_fp = 0;
+  m_fd = -1;
+  m_cur = 0;
+  m_len = m_cap; // typed writes take the slow path and fail
+  m_status = FIO_ERROR;
+  return ret;
+}
+
+// Copies n bytes from src into the buffers; full buffers go to the worker.
+// Returns false after a write error of the worker.
+bool FileFlushWriter::writeBytes(const void *src, size_t n) {
+  if (!m_cur || (!src && n > 0)) return false;
+  const uint8_t *p = (const uint8_t *)src;
+  while (n > 0) {
+    if (m_len == m_cap && !submit()) return false;
+    const size_t k = (n < m_cap - m_len) ? n : m_cap - m_len;
+    memcpy(m_cur + m_len, p, k);
+    m_len += k;
+    p += k;
+    n -= k;
+  }
+  return m_status == FIO_OK;
+}
+
+// Hands the current buffer to the worker and waits for a free one
+// (backpressure). Returns false after a write error.
+bool FileFlushWriter::submit() {
+  std::unique_lock<std::mutex> lock(m_mtx);
+  if (m_len > 0) {
+    m_sizes[m_queued % m_count] = m_len;
+    m_queued++;
+    m_filePos += m_len;
+    m_len = 0;
+    m_queuedCv.notify_one();
+  }
+  while (m_queued - m_written >= (uint64_t)m_count) {
+    m_writtenCv.wait(lock);
+  }
+  m_cur = m_bufs[m_queued % m_count];
+  return m_status == FIO_OK;
+}
+
+// Hands the buffered bytes to the worker and waits until all are written.
+// Returns true if successfull, otherwise false.
+bool FileFlushWriter::flush() {
+  if (!m_cur) return false;
+  submit();
+  std::unique_lock<std::mutex> lock(m_mtx);
+  while (m_written < m_queued) {
+    m_writtenCv.wait(lock);
+  }
+  return m_status == FIO_OK;
+}
+
+// Worker thread: writes the queued buffers in order from file offset pos
+// and starts the writeback every m_syncEvery bytes
+void FileFlushWriter::worker(int64_t pos) {
+  int64_t synced = pos;    // writeback started up to here
+  int64_t prevSync = pos;  // start of the window before
+  while (true) {
+    uint64_t seq;
+    bool failed;
+    {
+      std::unique_lock<std::mutex> lock(m_mtx);
+      while (!m_stop && m_written == m_queued) {
+        m_queuedCv.wait(lock);
+      }
+      if (m_written == m_queued) return;
+      seq = m_written;
+      failed = (m_status != FIO_OK);
+    }
+    const uint8_t *buf = m_bufs[seq % m_count];
+    const size_t len = m_sizes[seq % m_count];
+    size_t n = 0;
+    int err = 0;
+    while (n < len && !failed) {
+      const ssize_t rc = m_seekable
+                         ? pwrite64(m_fd, buf + n, len - n, pos + n)
+                         : ::write(m_fd, buf + n, len - n);
+      if (rc < 0 && errno == EINTR) continue;
+      if (rc <= 0) {
+        err = (rc < 0) ? errno : EIO;
+        break;
+      }
+      n += rc;
+    }
+    pos += len;
+    if (m_seekable && m_syncEvery > 0 && !err && !failed
+        && pos - synced >= m_syncEvery) {
+      // start the writeback of the new window, wait for the one before
+      sync_file_range(m_fd, synced, pos - synced, SYNC_FILE_RANGE_WRITE);
+      if (synced > prevSync) {
+        sync_file_range(m_fd, prevSync, synced - prevSync,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                        | SYNC_FILE_RANGE_WAIT_AFTER);
+      }
+      prevSync = synced;
+      synced = pos;
+    }
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (err && m_status == FIO_OK) {
+      m_status = FIO_ERROR;
+      m_errno = err;
+    }
+    m_written++;
+    m_writtenCv.notify_one();
+  }
+}
+#endif
+
+
+#ifdef __linux__
+// One request of FileAsync
+struct FioAsyncReq {
+  int fd;
+  bool isWrite;
+  bool closeFd;       // close fd after completion (loadFile, saveFile)
+  uint8_t *buf;
+  size_t len;
+  size_t done;        // bytes transferred so far
+  int64_t offset;
+  struct iovec iov;
+  FileAsyncCallback cb;
+};
+
+FileAsync::FileAsync()
+  : m_engine(FILEASYNC_NONE), m_pending(0), m_inflight(0), m_depth(0),
+    m_ringFd(-1), m_sqPtr(0), m_sqLen(0), m_cqPtr(0), m_cqLen(0), m_sqes(0),
+    m_sqesLen(0), m_sqHead(0), m_sqTail(0), m_sqMask(0), m_sqArray(0),
+    m_cqHead(0), m_cqTail(0), m_cqMask(0), m_cqes(0), m_toSubmit(0),
+    m_stop(false) {
+}
+
+// Waits for all requests and stops the engine
+FileAsync::~FileAsync() {
+  close();
+}
+
+// Starts the engine with up to depth requests in flight. io_uring is used
+// if useUring is true and the kernel supports it, otherwise threads
+// threads do the I/O. Returns true if successfull, otherwise false.
+bool FileAsync::open(unsigned int depth /* =32 */, int threads /* =4 */,
+                     bool useUring /* =true */) {
+  close();
+  if (depth < 1) depth = 1;
+  if (depth > 4096) depth = 4096;
+  m_depth = depth;
+  if (useUring && uringOpen(depth)) {
+    m_engine = FILEASYNC_URING;
+    return true;
+  }
+  if (threads < 1) threads = 1;
+  m_stop = false;
+  for (int i = 0; i < threads; i++) {
+    m_threads.push_back(std::thread(&FileAsync::worker, this));
+  }
+  m_engine = FILEASYNC_THREADS;
+  return true;
+}
+
+// Waits for all requests and stops the engine
+void FileAsync::close() {
+  if (m_engine == FILEASYNC_NONE) return;
+  drain();
+  if (m_engine == FILEASYNC_URING) {
+    uringClose();
+  } else {
+    {
+      std::lock_guard<std::mutex> lock(m_mtx);
+      m_stop = true;
+    }
+    m_workCv.notify_all();
+    for (size_t i = 0; i < m_threads.size(); i++) {
+      m_threads[i].join();
+    }
+    m_threads.clear();
+  }
+  m_engine = FILEASYNC_NONE;
+}
+
+#ifdef FIO_HAVE_URING
+bool FileAsync::uringOpen(unsigned int depth) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  const int fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+  if (fd < 0) return false;
+  m_ringFd = fd;
+  m_sqLen = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  m_cqLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single) {
+    if (m_cqLen > m_sqLen) m_sqLen = m_cqLen;
+    m_cqLen = 0;
+  }
+  m_sqPtr = mmap(0, m_sqLen, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (m_sqPtr == MAP_FAILED) {
+    m_sqPtr = 0;
+    uringClose();
+    return false;
+  }
+  if (single) {
+    m_cqPtr = m_sqPtr;
+  } else {
+    m_cqPtr = mmap(0, m_cqLen, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (m_cqPtr == MAP_FAILED) {
+      m_cqPtr = 0;
+      uringClose();
+      return false;
+    }
+  }
+  m_sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+  m_sqes = mmap(0, m_sqesLen, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (m_sqes == MAP_FAILED) {
+    m_sqes = 0;
+    uringClose();
+    return false;
+  }
+  uint8_t *sq = (uint8_t *)m_sqPtr;
+  uint8_t *cq = (uint8_t *)m_cqPtr;
+  m_sqHead = (unsigned int *)(sq + p.sq_off.head);
+  m_sqTail = (unsigned int *)(sq + p.sq_off.tail);
+  m_sqMask = (unsigned int *)(sq + p.sq_off.ring_mask);
+  m_sqArray = (unsigned int *)(sq + p.sq_off.array);
+  m_cqHead = (unsigned int *)(cq + p.cq_off.head);
+  m_cqTail = (unsigned int *)(cq + p.cq_off.tail);
+  m_cqMask = (unsigned int *)(cq + p.cq_off.ring_mask);
+  m_cqes = cq + p.cq_off.cqes;
+  m_toSubmit = 0;
+  if (m_depth > p.sq_entries) m_depth = p.sq_entries;
+  return true;
+}
+
+void FileAsync::uringClose() {
+  if (m_sqes) munmap(m_sqes, m_sqesLen);
+  if (m_cqPtr && m_cqPtr != m_sqPtr) munmap(m_cqPtr, m_cqLen);
+  if (m_sqPtr) munmap(m_sqPtr, m_sqLen);
+  if (m_ringFd >= 0) ::close(m_ringFd);
+  m_sqes = m_cqPtr = m_sqPtr = 0;
+  m_ringFd = -1;
+}
+#else
+bool FileAsync::uringOpen(unsigned int depth) {
+  return false;
+}
+
+void FileAsync::uringClose() {
+}
+#endif
+
+// Thread pool engine: takes requests and completes them with pread/pwrite
+void FileAsync::worker() {
+  while (true) {
+    FioAsyncReq *r;
+    {
+      std::unique_lock<std::mutex> lock(m_mtx);
+      while (!m_stop && m_work.empty()) {
+        m_workCv.wait(lock);
+      }
+      if (m_work.empty()) return;
+      r = m_work.front();
+      m_work.pop_front();
+    }
+    int64_t res = 0;
+    while (r->done < r->len) {
+      const size_t chunk = (r->len - r->done > FILEIOMAXCHUNK)
+                           ? FILEIOMAXCHUNK : r->len - r->done;
+      const ssize_t rc = r->isWrite
+        ? pwrite64(r->fd, r->buf + r->done, chunk, r->offset + r->done)
+        : pread64(r->fd, r->buf + r->done, chunk, r->offset + r->done);
+      if (rc < 0 && errno == EINTR) continue;
+      if (rc <= 0) {
+        res = (rc < 0) ? -errno : 0;
+        break;
+      }
+      r->done += rc;
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_mtx);
+      m_done.push_back(std::make_pair(r, (r->done > 0 || res == 0)
+                                         ? (int64_t)r->done : res));
+    }
+    m_doneCv.notify_one();
+  }
+}
+
+// Hands r to the engine (a slot must be free)
+bool FileAsync::push(FioAsyncReq *r) {
+  if (m_engine == FILEASYNC_THREADS) {
+    {
+      std::lock_guard<std::mutex> lock(m_mtx);
+      m_work.push_back(r);
+    }
+    m_workCv.notify_one();
+    m_inflight++;
+    return true;
+  }
+#ifdef FIO_HAVE_URING
+  const unsigned int tail = *m_sqTail;
+  const unsigned int idx = tail & *m_sqMask;
+  struct io_uring_sqe *sqe = (struct io_uring_sqe *)m_sqes + idx;
+  memset(sqe, 0, sizeof(*sqe));
+  size_t chunk = r->len - r->done;
+  if (chunk > FILEIOMAXCHUNK) chunk = FILEIOMAXCHUNK;
+  r->iov.iov_base = r->buf + r->done;
+  r->iov.iov_len = chunk;
+  sqe->opcode = r->isWrite ? IORING_OP_WRITEV : IORING_OP_READV;
+  sqe->fd = r->fd;
+  sqe->off = r->offset + r->done;
+  sqe->addr = (uint64_t)(uintptr_t)&r->iov;
+  sqe->len = 1;
+  sqe->user_data = (uint64_t)(uintptr_t)r;
+  m_sqArray[idx] = idx;
+  __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+  m_toSubmit++;
+  m_inflight++;
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Releases a request that could not be queued (and the descriptor that
+// loadFile or saveFile opened for it)
+static void fioAsyncDrop(FioAsyncReq *r) {
+  if (r->closeFd) ::close(r->fd);
+  delete r;
+}
+
+// Queues a new request, waiting for a free slot if depth is reached.
+// Completions reaped meanwhile run their callbacks in this call.
+bool FileAsync::queue(FioAsyncReq *r) {
+  FIO_STAT_IO(FIOSTAT_FILEASYNC, r->len);
+  if (m_engine == FILEASYNC_NONE) {
+    fioAsyncDrop(r);
+    FIO_STAT_RETURN(false);
+  }
+  while (m_inflight >= m_depth) {
+    if (reap(1) < 0) {
+      fioAsyncDrop(r);
+      FIO_STAT_RETURN(false);
+    }
+  }
+  m_pending++;
+  if (!push(r)) {
+    m_pending--;
+    fioAsyncDrop(r);
+    FIO_STAT_RETURN(false);
+  }
+  FIO_STAT_RETURN(true);
+}
+
+// Books the result of one transfer. Returns 1 if r is complete.
+int FileAsync::finish(FioAsyncReq *r, int64_t res) {
+  m_inflight--;
+  if (m_engine == FILEASYNC_URING && res > 0) {
+    r->done += res;
+    if (r->done < r->len) {
+      push(r); // short transfer: continue with the rest
+      return 0;
+    }
+  }
+  const int64_t result = (m_engine == FILEASYNC_URING)
+    ? ((res < 0 && r->done == 0) ? res : (int64_t)r->done) : res;
+  if (r->closeFd) ::close(r->fd);
+  m_pending--;
+  if (r->cb) {
+    FIO_STAT_USER();
+    r->cb(result);
+  }
+  delete r;
+  return 1;
+}
+
+// Hands all queued requests to the kernel
+// Returns true if successfull, otherwise false.
+bool FileAsync::submit() {
+#ifdef FIO_HAVE_URING
+  while (m_engine == FILEASYNC_URING && m_toSubmit > 0) {
+    const int rc = (int)syscall(__NR_io_uring_enter, m_ringFd, m_toSubmit, 0,
+                                0, NULL, 0);
+    if (rc < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EBUSY) return true; // retried by reap
+      return false;
+    }
+    m_toSubmit -= rc;
+  }
+#endif
+  return true;
+}
+
+// Completes finished requests, blocking until minComplete are done.
+// Returns the number of completed requests or -1 on errors.
+int FileAsync::reap(size_t minComplete) {
+  int n = 0;
+  if (m_engine == FILEASYNC_THREADS) {
+    std::deque<std::pair<FioAsyncReq *, int64_t> > done;
+    {
+      std::unique_lock<std::mutex> lock(m_mtx);
+      while (m_done.size() < minComplete) {
+        m_doneCv.wait(lock);
+      }
+      done.swap(m_done);
+    }
+    for (size_t i = 0; i < done.size(); i++) {
+      n += finish(done[i].first, done[i].second);
+    }
+    return n;
+  }
+#ifdef FIO_HAVE_URING
+  if (m_engine != FILEASYNC_URING) return -1;
+  while (true) {
+    unsigned int head = *m_cqHead;
+    const unsigned int tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      const struct io_uring_cqe *cqe =
+        (const struct io_uring_cqe *)m_cqes + (head & *m_cqMask);
+      FioAsyncReq *r = (FioAsyncReq *)(uintptr_t)cqe->user_data;
+      const int64_t res = cqe->res;
+      head++;
+      __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+      n += finish(r, res);
+    }
+    if ((size_t)n >= minComplete && m_toSubmit == 0) return n;
+    // submit what is queued and wait for the missing completions
+    const unsigned int want = ((size_t)n < minComplete) ? 1 : 0;
+    const int rc = (int)syscall(__NR_io_uring_enter, m_ringFd, m_toSubmit,
+                                want, want ? IORING_ENTER_GETEVENTS : 0,
+                                NULL, 0);
+    if (rc < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+      return -1;
+    }
+    m_toSubmit -= rc;
+    if ((size_t)n >= minComplete && m_toSubmit == 0) return n;
+  }
+#else
+  return -1;
+#endif
+}
+
+// Runs the callbacks of finished requests without blocking.
+// Returns the number of completed requests or -1 on errors.
+int FileAsync::poll() {
+  if (m_engine == FILEASYNC_NONE) return -1;
+  if (!submit()) return -1;
+  return reap(0);
+}
+
+// Blocks until n requests (at most all pending ones) are completed.
+// Returns the number of completed requests or -1 on errors.
+int FileAsync::wait(size_t n /* =1 */) {
+  if (m_engine == FILEASYNC_NONE) return -1;
+  if (n > m_pending) n = m_pending;
+  return reap(n);
+}
+
+// Blocks until all requests are completed
+void FileAsync::drain() {
+  while (m_pending > 0) {
+    if (wait(m_pending) < 0) break;
+  }
+}
+
+// Reads len bytes at offset from fd into dst. The callback gets the bytes
+// read (less than len at the end of the file) or -errno.
+bool FileAsync::read(int fd, int64_t offset, void *dst, size_t len,
+                     const FileAsyncCallback &cb) {
+  if (fd < 0 || offset < 0 || (!dst && len > 0)) return false;
+  FioAsyncReq *r = new FioAsyncReq();
+  r->fd = fd;
+  r->isWrite = false;
+  r->closeFd = false;
+  r->buf = (uint8_t *)dst;
+  r->len = len;
+  r->done = 0;
+  r->offset = offset;
+  r->cb = cb;
+  return queue(r);
+}
+
+// Writes len bytes from src at offset into fd. The callback gets the
+// bytes written or -errno.
+bool FileAsync::write(int fd, int64_t offset, const void *src, size_t len,
+                      const FileAsyncCallback &cb) {
+  if (fd < 0 || offset < 0 || (!src && len > 0)) return false;
+  FioAsyncReq *r = new FioAsyncReq();
+  r->fd = fd;
+  r->isWrite = true;
+  r->closeFd = false;
+  r->buf = (uint8_t *)src;
+  r->len = len;
+  r->done = 0;
+  r->offset = offset;
+  r->cb = cb;
+  return queue(r);
+}
+
+// Loads the whole file fullpath into buf (sized like fileSize). The
+// callback gets the bytes read (buf is shrunk to them) or -errno.
+// buf must stay valid until the callback ran.
+bool FileAsync::loadFile(const char *fullpath, fioBuffer &buf,
+                         const FileAsyncCallback &cb) {
+  if (strSize(fullpath) == 0) return false;
+  const int fd = ::open(fullpath, O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+  if (fd < 0) return false;
+  ststat64 st_buf;
+  if (fstat64(fd, &st_buf) != 0 || (uint64_t)st_buf.st_size > SIZE_MAX) {
+    ::close(fd);
+    return false;
+  }
+  buf.clear();
+  buf.resize((size_t)st_buf.st_size);
+  fioBuffer *pbuf = &buf;
+  FileAsyncCallback done = [pbuf, cb](int64_t res) {
+    pbuf->resize(res > 0 ? (size_t)res : 0);
+    if (cb) cb(res);
+  };
+  FioAsyncReq *r = new FioAsyncReq();
+  r->fd = fd;
+  r->isWrite = false;
+  r->closeFd = true;
+  r->buf = buf.empty() ? 0 : &buf[0];
+  r->len = buf.size();
+  r->done = 0;
+  r->offset = 0;
+  r->cb = done;
+  return queue(r);
+}
+
+// Saves len bytes from src into the file fullpath (created or truncated
+// like fileOpen(fullpath, "wb")). The callback gets the bytes written or
+// -errno. src must stay valid until the callback ran.
+bool FileAsync::saveFile(const char *fullpath, const void *src, size_t len,
+                         const FileAsyncCallback &cb) {
+  if (strSize(fullpath) == 0 || (!src && len > 0)) return false;
+  const int fd = ::open(fullpath, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE
+                        | O_CLOEXEC, 0666);
+  if (fd < 0) return false;
+  FioAsyncReq *r = new FioAsyncReq();
+  r->fd = fd;
+  r->isWrite = true;
+  r->closeFd = true;
+  r->buf = (uint8_t *)src;
+  r->len = len;
+  r->done = 0;
+  r->offset = 0;
+  r->cb = cb;
+  return queue(r);
+}
+
+// Like fileLoadRanges(fd), but all coalesced requests are handed to async
+// at once, so the device works on them in parallel. A request of one
+// range reads into its buffer, others into a staging buffer. Waits only
+// for its own requests; callbacks of other requests of async that complete
+// meanwhile run in this call.
+// Returns the number of read requests or -1 on errors.
+int64_t fileLoadRanges(FileAsync &async, int fd, FileRange *ranges,
+                       size_t count, int64_t maxGap /* =FILERANGEGAP */) {
+  FIO_STAT_CALL(FIOSTAT_FILELOADRANGES);
+  if (fd < 0 || (!ranges && count > 0)) FIO_STAT_RETURN(-1);
+  for (size_t i = 0; i < count; i++) {
+    if (ranges[i].offset < 0 || ranges[i].length < 0
+        || (!ranges[i].dst && ranges[i].length > 0)) {
+      FIO_STAT_RETURN(-1);
+    }
+  }
+  if (maxGap < 0) maxGap = 0;
+  std::vector<size_t> order;
+  std::vector<std::pair<size_t, size_t> > groups;
+  fioRangeGroups(ranges, count, maxGap, order, groups);
+  std::vector<fioBuffer> stages(groups.size());
+  bool err = false;
+  size_t queued = 0;
+  size_t done = 0;
+  for (size_t g = 0; g < groups.size(); g++) {
+    const size_t first = groups[g].first;
+    const size_t last = groups[g].second;
+    const FileRange &a = ranges[order[first]];
+    const FileRange &b = ranges[order[last - 1]];
+    const int64_t span = b.offset + b.length - a.offset;
+    void *dst = a.dst;
+    const uint8_t *src = 0;
+    if (last - first > 1) {
+      stages[g].resize(span);
+      dst = &stages[g][0];
+      src = &stages[g][0];
+    }
+    const size_t *ord = &order[0];
+    bool *errp = &err;
+    size_t *donep = &done;
+    if (async.read(fd, a.offset, dst, span,
+                   [ranges, ord, first, last, src, errp, donep](int64_t res) {
+                     if (res < 0) *errp = true;
+                     fioRangeScatter(ranges, ord, first, last,
+                                     res < 0 ? -1 : res, src);
+                     (*donep)++;
+                   })) {
+      queued++;
+    } else {
+      err = true;
+    }
+  }
+  while (done < queued) {
+    if (async.wait(1) < 0) {
+      err = true;
+      break;
+    }
+  }
+  FIO_STAT_RETURN(err ? -1 : (int64_t)groups.size());
+}
+#endif
+
+#ifdef __linux__
+FileAppendLog::FileAppendLog()
+  : m_fd(-1), m_ring(0), m_mask(0), m_ready(0), m_head(0), m_tail(0),
+    m_written(0), m_durable(0), m_syncWanted(0), m_errno(0),
+    m_sleeping(false), m_waiters(0), m_stop(false) {
+}
+
+// Writes and syncs all records (see close)
+FileAppendLog::~FileAppendLog() {
+  close();
+}
+
+// Opens (or creates) the log fullpath for appending and starts the flusher.
+// Returns true if successfull, otherwise false.
+bool FileAppendLog::open(const char *fullpath,
+                         const FileLogOptions &opt /* =FileLogOptions() */) {
+  close();
+  if (!fullpath) return false;
+  m_opt = opt;
+  if (m_opt.syncInterval < 1) m_opt.syncInterval = 1;
+  if (m_opt.ringSize > FILELOGRINGMAX) m_opt.ringSize = FILELOGRINGMAX;
+  size_t cap = 4096;
+  while (cap < m_opt.ringSize) cap <<= 1;
+  m_fd = ::open(fullpath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+  if (m_fd < 0) return false;
+  m_ring = (uint8_t *)malloc(cap);
+  m_ready = new (std::nothrow) std::atomic<uint64_t>[cap / 64];
+  if (!m_ring || !m_ready) {
+    close();
+    errno = ENOMEM;
+    return false;
+  }
+  for (size_t i = 0; i < cap / 64; i++) {
+    m_ready[i].store(0, std::memory_order_relaxed);
+  }
+  m_mask = cap - 1;
+  m_head = m_tail = m_written = m_durable = m_syncWanted = 0;
+  m_errno = 0;
+  m_stop = false;
+  m_thread = std::thread(&FileAppendLog::flusher, this);
+  return true;
+}
+
+// Writes all appended records, syncs them (unless FILELOG_SYNC_NONE) and
+// closes the log. No append may run concurrently.
+// Returns true if all records were written, otherwise false.
+bool FileAppendLog::close() {
+  if (m_fd < 0) return true;
+  if (m_thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(m_mtx);
+      m_stop = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+  }
+  const bool closed = (::close(m_fd) == 0);
+  const bool ret = closed && m_errno == 0;
+  m_fd = -1;
+  free(m_ring);
+  m_ring = 0;
+  delete[] m_ready;
+  m_ready = 0;
+  return ret;
+}
+
+// Appends the record src of len bytes; blocks while the ring is full.
+// Returns the ticket of the record (the log bytes up to its end, see
+// wait), or 0 on errors.
+uint64_t FileAppendLog::append(const void *src, uint32_t len) {
+  FIO_STAT_IO(FIOSTAT_FILEAPPENDLOG, len);
+  const uint64_t need = 4 + (uint64_t)len;
+  if (m_fd < 0 || need > m_mask + 1 || (len && !src)) {
+    FIO_STAT_ERROR();
+    return 0;
+  }
+  uint64_t pos = m_head.load(std::memory_order_relaxed);
+  while (true) {
+    if (m_errno.load(std::memory_order_relaxed) != 0) {
+      FIO_STAT_ERROR();
+      return 0;
+    }
+    if (pos + need - m_tail.load(std::memory_order_acquire) > m_mask + 1) {
+      // ring full: let the flusher catch up
+      std::unique_lock<std::mutex> lock(m_mtx);
+      m_waiters++;
+      m_cv.notify_one();
+      m_doneCv.wait_for(lock, std::chrono::milliseconds(1));
+      m_waiters--;
+      lock.unlock();
+      pos = m_head.load(std::memory_order_relaxed);
+      continue;
+    }
+    if (m_head.compare_exchange_weak(pos, pos + need,
+                                     std::memory_order_relaxed)) {
+      break;
+    }
+  }
+  uint8_t prefix[4];
+  if (m_opt.bigEndian) {
+    fioStore<uint32_t, ENDIAN_BIG>(prefix, len);
+  } else {
+    fioStore<uint32_t, ENDIAN_LITTLE>(prefix, len);
+  }
+  copyIn(pos, prefix, 4);
+  copyIn(pos + 4, src, len);
+  const uint64_t i = pos & m_mask;
+  m_ready[i >> 6].fetch_or((uint64_t)1 << (i & 63));
+  if (m_sleeping.load()) wake();
+  return pos + need;
+}
+
+// Blocks until the record of ticket is durable: written with
+// FILELOG_SYNC_NONE, otherwise synced (waiting requests the sync, so it
+// is not delayed by the policy). Returns false on write or sync errors.
+bool FileAppendLog::wait(uint64_t ticket) {
+  if (m_fd < 0) return false;
+  const bool synced = (m_opt.syncPolicy != FILELOG_SYNC_NONE);
+  std::atomic<uint64_t> &done = synced ? m_durable : m_written;
+  if (done.load() >= ticket) return true;
+  if (synced) {
+    uint64_t want = m_syncWanted.load();
+    while (want < ticket && !m_syncWanted.compare_exchange_weak(want, ticket)) {
+    }
+  }
+  std::unique_lock<std::mutex> lock(m_mtx);
+  m_waiters++;
+  m_cv.notify_one();
+  while (done.load() < ticket && m_errno.load() == 0) {
+    m_doneCv.wait(lock);
+  }
+  m_waiters--;
+  return done.load() >= ticket;
+}
+
+// Writes and syncs all records appended so far (also with
+// FILELOG_SYNC_NONE). Returns true if successfull, otherwise false.
+bool FileAppendLog::sync() {
+  if (m_fd < 0) return false;
+  const uint64_t ticket = m_head.load();
+  uint64_t want = m_syncWanted.load();
+  while (want < ticket && !m_syncWanted.compare_exchange_weak(want, ticket)) {
+  }
+  std::unique_lock<std::mutex> lock(m_mtx);
+  m_waiters++;
+  m_cv.notify_one();
+  while (m_durable.load() < ticket && m_errno.load() == 0) {
+    m_doneCv.wait(lock);
+  }
+  m_waiters--;
+  return m_durable.load() >= ticket;
+}
+
+// Copies n bytes from src into the ring at log position pos
+void FileAppendLog::copyIn(uint64_t pos, const void *src, size_t n) {
+  const size_t i = pos & m_mask;
+  const size_t first = (n < m_mask + 1 - i) ? n : m_mask + 1 - i;
+  memcpy(m_ring + i, src, first);
+  memcpy(m_ring, (const uint8_t *)src + first, n - first);
+}
+
+// Copies n bytes at log position pos from the ring into dst
+void FileAppendLog::copyOut(uint64_t pos, void *dst, size_t n) const {
+  const size_t i = pos & m_mask;
+  const size_t first = (n < m_mask + 1 - i) ? n : m_mask + 1 - i;
+  memcpy(dst, m_ring + i, first);
+  memcpy((uint8_t *)dst + first, m_ring, n - first);
+}
+
+// Returns true if a complete record starts at log position pos
+bool FileAppendLog::ready(uint64_t pos) const {
+  const uint64_t i = pos & m_mask;
+  return (m_ready[i >> 6].load() >> (i & 63)) & 1;
+}
+
+// Writes the log bytes [from, to) of the ring (in two parts if it wraps)
+bool FileAppendLog::writeOut(uint64_t from, uint64_t to) {
+  while (from < to) {
+    const size_t i = from & m_mask;
+    size_t n = m_mask + 1 - i;
+    if (n > to - from) n = to - from;
+    if (n > FILEIOMAXCHUNK) n = FILEIOMAXCHUNK;
+    const ssize_t rc = ::write(m_fd, m_ring + i, n);
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) {
+      m_errno = (rc < 0) ? errno : EIO;
+      return false;
+    }
+    from += rc;
+  }
+  return true;
+}
+
+// Wakes the flusher (appends only call it while it sleeps)
+void FileAppendLog::wake() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_cv.notify_one();
+}
+
+// Flusher thread: collects the ready records at the tail, writes them in
+// one go, frees their ring space and syncs by the policy
+void FileAppendLog::flusher() {
+  std::chrono::steady_clock::time_point lastSync
+    = std::chrono::steady_clock::now();
+  uint64_t tail = 0;
+  uint64_t unsynced = 0;  // records written since the last sync
+  while (true) {
+    uint64_t end = tail;
+    uint64_t records = 0;
+    while (end - tail < m_mask + 1 && ready(end)) {
+      const uint64_t i = end & m_mask;
+      m_ready[i >> 6].fetch_and(~((uint64_t)1 << (i & 63)));
+      uint8_t prefix[4];
+      copyOut(end, prefix, 4);
+      end += 4 + (m_opt.bigEndian ? fioLoad<uint32_t, ENDIAN_BIG>(prefix)
+                                  : fioLoad<uint32_t, ENDIAN_LITTLE>(prefix));
+      records++;
+    }
+    if (end > tail) {
+      if (!writeOut(tail, end)) break;
+      tail = end;
+      unsynced += records;
+      m_tail.store(tail, std::memory_order_release);
+      m_written.store(tail);
+    }
+    bool stop;
+    {
+      std::lock_guard<std::mutex> lock(m_mtx);
+      stop = m_stop && m_head.load() == tail;
+    }
+    bool doSync = false;
+    if (m_durable.load() < tail) {
+      switch (m_opt.syncPolicy) {
+      case FILELOG_SYNC_INTERVAL:
+        doSync = (std::chrono::steady_clock::now() - lastSync
+                  >= std::chrono::milliseconds(m_opt.syncInterval));
+        break;
+      case FILELOG_SYNC_EVERY:
+        doSync = (unsynced >= m_opt.syncEvery);
+        break;
+      }
+      doSync |= (m_syncWanted.load() > m_durable.load());
+      doSync |= (stop && m_opt.syncPolicy != FILELOG_SYNC_NONE);
+    }
+    if (doSync) {
+      if (fdatasync(m_fd) != 0) {
+        m_errno = errno;
+        break;
+      }
+      m_durable.store(tail);
+      unsynced = 0;
+      lastSync = std::chrono::steady_clock::now();
+    }
+    if ((records || doSync) && m_waiters.load() > 0) {
+      std::lock_guard<std::mutex> lock(m_mtx);
+      m_doneCv.notify_all();
+    }
+    if (stop) break;
+    if (records) continue;
+    // nothing ready: sleep until an append, a wait or the next interval
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_sleeping.store(true);
+    if (!ready(tail) && !m_stop
+        && !(m_syncWanted.load() > m_durable.load()
+             && m_durable.load() < tail)) {
+      m_cv.wait_for(lock, std::chrono::milliseconds(
+        m_opt.syncPolicy == FILELOG_SYNC_INTERVAL ? m_opt.syncInterval : 100));
+    }
+    m_sleeping.store(false);
+  }
+  // wake everybody up after an error
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_doneCv.notify_all();
+}
+#endif
+
+
+#ifdef __linux__
+// Record of the getdents64 system call
+struct fioDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+
+// Maps d_type to FILETYPE_... (FILETYPE_ERROR if the type is unknown)
+static int fioDirentType(unsigned char t) {
+  switch(t) {
+  case DT_REG: return FILETYPE_FILE;
+  case DT_DIR: return FILETYPE_DIR;
+  case DT_LNK: return FILETYPE_SYMLINK;
+  case DT_UNKNOWN: return FILETYPE_ERROR;
+  default: return FILETYPE_OTHER;
+  }
+}
+
+// Creates a closed listing with a getdents64 buffer of bufsize bytes
+FileDir::FileDir(size_t bufsize /* =65536 */)
+  : m_fd(-1), m_buf(0), m_cap(bufsize < 4096 ? 4096 : bufsize), m_pos(0),
+    m_len(0), m_errno(0) {
+}
+
+FileDir::~FileDir() {
+  close();
+  free(m_buf);
+}
+
+// Opens the directory fullpath
+// Returns true if successfull, otherwise false.
+bool FileDir::open(const char *fullpath) {
+  return openAt(AT_FDCWD, fullpath);
+}
+
+// Opens the directory name relative to the directory descriptor dirfd
+// Returns true if successfull, otherwise false.
+bool FileDir::openAt(int dirfd, const char *name) {
+  close();
+  m_errno = 0;
+  if (strSize(name) == 0) return false;
+  if (!m_buf) {
+    m_buf = (uint8_t *)malloc(m_cap);
+    if (!m_buf) {
+      m_errno = ENOMEM;
+      return false;
+    }
+  }
+  m_fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_LARGEFILE);
+  if (m_fd < 0) {
+    m_errno = errno;
+    return false;
+  }
+  return true;
+}
+
+void FileDir::close() {
+  if (m_fd >= 0) ::close(m_fd);
+  m_fd = -1;
+  m_pos = m_len = 0;
+}
+
+// Returns the next entry ("." and ".." are skipped) in e.
+// Returns false at the end of the directory or on errors (see error()).
+bool FileDir::next(FileDirEntry &e) {
+  if (m_fd < 0) return false;
+  while (true) {
+    if (m_pos >= m_len) {
+      const long n = syscall(SYS_getdents64, m_fd, m_buf, m_cap);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        if (n < 0) m_errno = errno;
+        return false;
+      }
+      m_len = n;
+      m_pos = 0;
+    }
+    const fioDirent64 *d = (const fioDirent64 *)(m_buf + m_pos);
+    m_pos += d->d_reclen;
+    const char *s = d->d_name;
+    if (s[0] == '.' && (s[1] == '\0' || (s[1] == '.' && s[2] == '\0'))) {
+      continue;
+    }
+    e.name = s;
+    e.inode = d->d_ino;
+    e.type = fioDirentType(d->d_type);
+    if (e.type == FILETYPE_ERROR) {
+      // file system without d_type
+      ststat64 st_buf;
+      if (fstatat64(m_fd, s, &st_buf, AT_SYMLINK_NOFOLLOW) == 0) {
+        e.type = fioFileType(st_buf.st_mode);
+      }
+    }
+    return true;
+  }
+}
+
+// Returns the size of the entry e in bytes or -1 on errors
+int64_t FileDir::size(const FileDirEntry &e) const {
+  ststat64 st_buf;
+  if (m_fd < 0 || fstatat64(m_fd, e.name, &st_buf, AT_SYMLINK_NOFOLLOW) != 0) {
+    return -1;
+  }
+  return st_buf.st_size;
+}
+
+// Returns the size of the entry in bytes or -1 on errors
+// (like FileDir::size a symbolic link is not followed)
+int64_t FileWalkEntry::size() const {
+  ststat64 st_buf;
+  if (fstatat64(dirfd, name, &st_buf, AT_SYMLINK_NOFOLLOW) != 0) return -1;
+  return st_buf.st_size;
+}
+
+// Directory still to be listed by fileWalk
+struct FioWalkTask {
+  std::string path;
+  int depth;
+};
+
+// Task queue of one fileWalk thread; the owner works at the back,
+// idle threads steal from the front.
+struct FioWalkQueue {
+  std::mutex mtx;
+  std::deque<FioWalkTask> tasks;
+};
+
+// Walks the directory tree below root and calls visit for every entry.
+// With opt.threads != 1 directories are listed by several threads with
+// work stealing and visit is called concurrently. Directories deeper than
+// opt.maxDepth are not listed. Symbolic links are reported as
+// FILETYPE_SYMLINK unless opt.followLinks is set, then they are resolved
+// and directories are descended once (by device and inode).
+// Returns the number of visited entries or -1 if root can't be listed.
+int64_t fileWalk(const char *root, const FileWalkVisitor &visit,
+                 const FileWalkOptions &opt /* =FileWalkOptions() */) {
+  FIO_STAT_CALL(FIOSTAT_FILEWALK);
+  if (strSize(root) == 0 || !visit) FIO_STAT_RETURN(-1);
+  FileDir probe;
+  if (!probe.open(root)) FIO_STAT_RETURN(-1);
+  probe.close();
+  int threads = opt.threads;
+  if (threads <= 0) {
+    threads = (int)std::thread::hardware_concurrency();
+  }
+  if (threads < 1) threads = 1;
+  std::vector<FioWalkQueue> queues(threads);
+  std::atomic<int64_t> outstanding(1);
+  std::atomic<int64_t> count(0);
+  std::mutex idleMtx;                 // idle threads wait for new tasks
+  std::condition_variable idleCv;
+  uint64_t pushed = 0;                // tasks pushed, guarded by idleMtx
+  std::mutex seenMtx;
+  std::map<std::pair<uint64_t, uint64_t>, bool> seen; // followed directories
+  if (opt.followLinks) {
+    ststat64 st_buf;
+    if (stat64(root, &st_buf) == 0) {
+      seen[std::make_pair((uint64_t)st_buf.st_dev,
+                          (uint64_t)st_buf.st_ino)] = true;
+    }
+  }
+  FioWalkTask first = { root, 0 };
+  queues[0].tasks.push_back(first);
+
+  auto list = [&](const FioWalkTask &t, FioWalkQueue &own) {
+    FileDir dir;
+    if (!dir.open(t.path.c_str())) return;
+    const bool descend = (opt.maxDepth < 0 || t.depth < opt.maxDepth);
+    const bool slash = (t.path[t.path.size() - 1] == '/');
+    std::string path;
+    FileDirEntry de;
+    while (dir.next(de)) {
+      path = t.path;
+      if (!slash) path += '/';
+      path += de.name;
+      FileWalkEntry we;
+      we.path = path.c_str();
+      we.name = de.name;
+      we.type = de.type;
+      we.depth = t.depth;
+      we.dirfd = dir.fd();
+      bool isNewDir = (de.type == FILETYPE_DIR);
+      if (opt.followLinks && (de.type == FILETYPE_DIR
+                              || de.type == FILETYPE_SYMLINK)) {
+        ststat64 st_buf;
+        if (fstatat64(dir.fd(), de.name, &st_buf, 0) == 0) {
+          we.type = fioFileType(st_buf.st_mode);
+          isNewDir = false;
+          if (we.type == FILETYPE_DIR) {
+            std::lock_guard<std::mutex> lock(seenMtx);
+            isNewDir = seen.insert(std::make_pair(std::make_pair(
+                         (uint64_t)st_buf.st_dev, (uint64_t)st_buf.st_ino),
+                         true)).second;
+          }
+        }
+      }
+      count++;
+      bool more;
+      {
+        FIO_STAT_USER();
+        more = visit(we);
+      }
+      if (more && isNewDir && descend) {
+        FioWalkTask sub = { path, t.depth + 1 };
+        outstanding++;
+        {
+          std::lock_guard<std::mutex> lock(own.mtx);
+          own.tasks.push_back(sub);
+        }
+        if (threads > 1) {
+          {
+            std::lock_guard<std::mutex> lock(idleMtx);
+            pushed++;
+          }
+          idleCv.notify_one();
+        }
+      }
+    }
+  };
+
+  auto worker = [&](int id) {
+    FioWalkQueue &own = queues[id];
+    while (true) {
+      FioWalkTask t;
+      bool found = false;
+      uint64_t seenPushed;
+      {
+        std::lock_guard<std::mutex> lock(idleMtx);
+        seenPushed = pushed;
+      }
+      {
+        std::lock_guard<std::mutex> lock(own.mtx);
+        if (!own.tasks.empty()) {
+          t = own.tasks.back();
+          own.tasks.pop_back();
+          found = true;
+        }
+      }
+      for (int k = 1; !found && k < threads; k++) {
+        FioWalkQueue &other = queues[(id + k) % threads];
+        std::lock_guard<std::mutex> lock(other.mtx);
+        if (!other.tasks.empty()) {
+          t = other.tasks.front();
+          other.tasks.pop_front();
+          found = true;
+        }
+      }
+      if (found) {
+        list(t, own);
+        if (--outstanding == 0 && threads > 1) {
+          { std::lock_guard<std::mutex> lock(idleMtx); }
+          idleCv.notify_all();
+        }
+      } else if (outstanding == 0) {
+        break;
+      } else {
+        // sleep until a task is pushed or the last one is done
+        std::unique_lock<std::mutex> lock(idleMtx);
+        idleCv.wait(lock, [&] {
+          return pushed != seenPushed || outstanding == 0;
+        });
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (int t = 1; t < threads; t++) {
+    pool.push_back(std::thread(worker, t));
+  }
+  worker(0);
+  for (size_t t = 0; t < pool.size(); t++) {
+    pool[t].join();
+  }
+  FIO_STAT_RETURN((int64_t)count);
+}
+#endif
+
+
+// ***************
+// Selftest
+// ***************
+
+// For selftest add -DSELFTEST to the compiler
+#ifdef SELFTEST
+void fioPerr(int m=0) {
+  switch(m) {
+  case 0:  fprintf(stderr, "fioSelftest:"); break;
+  case 1:  fprintf(stdout, "fioSelftest [PASSED]\n"); break;
+  case 2:  fprintf(stderr, "fioSelftest [FAILED]\n"); break;
   }
 }
 bool fioSelftest() {
   bool isOk = true;
   {
-    // check version information
-    int exp_val=1;
-    if (FIO_VER!=exp_val) {
+    // check version information
+    int exp_val=1;
+    if (FIO_VER!=exp_val) {
+      fioPerr();
+      fprintf(stderr, " Error: FIO_VER is not %d\n", exp_val);
+      isOk=false;
+    }
+    exp_val=3;
+    if (FIO_REV!=exp_val) {
+      fioPerr();
+      fprintf(stderr, " Error: FIO_REV is not %d\n", exp_val);
+      isOk=false;
+    }
+    const size_t SS=4;
+    const char se[SS]="1.3"; // expected value
+    const char sv[SS]=FIO_VERSTR; // real value
+    for (size_t i=0; i<SS; i++) {
+      if (sv[i]!=se[i]) {
+        fioPerr();
+        fprintf(stderr, " Error: FIO_VERSTR is not '%s'\n", se);
+        isOk=false;
+        break;
+      }
+    }
+  }
+  {
+    // check PATH_SEPARATOR and EOL
+#ifdef __linux__
+    const char ce = '/';
+    const char *se = "\n";
+#elif defined(_WIN32) || defined(WIN32)
+    const char ce = '\\';
+    const char *se = "\r\n";
+#endif
+    if (ce!=PATH_SEPARATOR) {
+      fioPerr();
+      fprintf(stderr, " Error: PATH_SEPARATOR is not '%c'\n", ce);
+      isOk=false;
+    }
+    const char *sv=EOL;
+    if ( (se[0]!=sv[0]) || (se[1]!=sv[1])) {
+      fioPerr();
+#ifdef __linux__
+      fprintf(stderr, " Error: EOL is not '\\n'\n");
+#elif defined(_WIN32) || defined(WIN32)
+      fprintf(stderr, " Error: EOL is not '\\r\\n'\n");
+#endif
+      isOk=false;
+    }
+  }
+  {
+    // check ENDIAN_LITTLE ENDIAN_BIG and FILEIOBUFSIZE
+    if (false != ENDIAN_LITTLE) {
+      fioPerr();
+      fprintf(stderr, " Error: ENDIAN_LITTLE is not 0\n");
+      isOk=false;
+    }
+    if (true != ENDIAN_BIG) {
+      fioPerr();
+      fprintf(stderr, " Error: ENDIAN_LITTLE is not 1\n");
+      isOk=false;
+    }
+    int ie=8192;
+    if (ie != FILEIOBUFSIZE) {
+      fioPerr();
+      fprintf(stderr, " Error: FILEIOBUFSIZE is not %d\n", ie);
+      isOk=false;
+    }
+  }
+  {
+    // check strSize
+    if (0!=strSize(0) || 0!=strSize(NULL)) {
+      fioPerr();
+      fprintf(stderr, " Error: strSize(0) is not 0\n");
+      isOk=false;
+    }
+    if (0!=strSize("")) {
+      fioPerr();
+      fprintf(stderr, " Error: strSize(\"\") is not 0\n");
+      isOk=false;
+    }
+    if (0!=strSize("\0")) {
+      fioPerr();
+      fprintf(stderr, " Error: strSize(\"\\0\") is not 0\n");
+      isOk=false;
+    }
+    if (3!=strSize("foo")) {
+      fioPerr();
+      fprintf(stderr, " Error: strSize(\"foo\") is not 3\n");
+      isOk=false;
+    }
+    if (0!=strSize("\0foo")) {
+      fioPerr();
+      fprintf(stderr, " Error: strSize(\"\\0foo\") is not 0\n");
+      isOk=false;
+    }
+  }
+  {
+    // check isBigEndian against the memory layout
+    uint32_t i=0x01020304;
+    uint8_t c[4];
+    memcpy(c, &i, 4);
+    if (isBigEndian()!=(c[0]==1)) {
+      fioPerr();
+      fprintf(stderr, " Error: isBigEndian is wrong\n");
+      isOk=false;
+    }
+  }
+  {
+    // bswap_u16
+    uint16_t s=0x1122;
+    if (0x2211!=bswap_u16(s)) {
+      fioPerr();
+      fprintf(stderr, " Error: bswap_u16(0x1122) is incorrect\n");
+      isOk=false;
+    }
+    if (s!=bswap_u16(bswap_u16(s))) {
+      fioPerr();
+      fprintf(stderr, " Error: bswap_u16(bswap_u16(0x1122)) is incorrect\n");
+      isOk=false;
+    }
+    if (0!=bswap_u16(0)) {
+      fioPerr();
+      fprintf(stderr, " Error: bswap_u16(0) is incorrect\n");
+      isOk=false;
+    }
+  }
+  {
+    // bswap_u32
+    uint32_t s=0x11223344;
+    if (0x44332211!=bswap_u32(s)) {
+      fioPerr();
+      fprintf(stderr, " Error: bswap_u32(0x11223344) is incorrect\n");
+      isOk=false;
+    }
+    if (0!=bswap_u32(0)) {
+      fioPerr();
+      fprintf(stderr, " Error: bswap_u32(0) is incorrect\n");
+      isOk=false;
+    }
+  }
+  {
+    // bswap_u64 and bswap_64
+    uint64_t s=0x1122334455667788ULL;
+    if (0x8877665544332211ULL!=bswap_u64(s)) {
+      fioPerr();
+      fprintf(stderr, " Error: bswap_u64(0x1122334455667788) is incorrect\n");
+      isOk=false;
+    }
+    if ((int64_t)0x8877665544332211ULL!=bswap_64((int64_t)s)) {
+      fioPerr();
+      fprintf(stderr, " Error: bswap_64(0x1122334455667788) is incorrect\n");
+      isOk=false;
+    }
+  }
+  {
+    // open file that does not exist in read mode
+    const char *fname="fiotst.dat";
+    if (fileExists(fname)) {
+      fioPerr();
+      fprintf(stderr, " Error: fileExists(\"%s\") file exists on start\n", fname);
+      isOk=false;
+    } else {
+      FILE *fp=fileOpen(fname, "rb");
+      if (fp) {
+        fioPerr();
+        fprintf(stderr, " Error: fileOpen(\"%s\") falsely succeeded\n", fname);
+        isOk=false;
+      }
+      // check existance
+      if (fileExists(fname)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileExists(\"%s\") falsely succeeded\n", fname);
+        isOk=false;
+      }
+      time_t rawtime;
+      time(&rawtime);
+      // open file that does not exist in write mode
+      fp=fileOpen(fname, "wb");
+      if (!fp) {
+        fioPerr();
+        fprintf(stderr, " Error: fileOpen(\"%s\") failed\n", fname);
+        isOk=false;
+      }
+      fileClose(fp);
+      // check existance
+      if (!fileExists(fname)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileExists(\"%s\") failed\n", fname);
+        isOk=false;
+      }
+      // file readable
+      if (!fileReadable(fname)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileReadable(\"%s\") failed\n", fname);
+        isOk=false;
+      }
+      // file type (0=normal file)
+      if (0!=fileType(fname)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileType(\"%s\") is wrong\n", fname);
+        isOk=false;
+      }
+      // check file size
+      if (0!=fileSize(fname)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileSize(\"%s\") is not 0\n", fname);
+        isOk=false;
+      }
+      // check modification time
+      time_t mtime=fileModificationTime(fname);
+      if (mtime==0) {
+        fioPerr();
+        fprintf(stderr, " Error: fileModificationTime(\"%s\") failed\n", fname);
+        isOk=false;
+      }
+      time_t tdiff=abs(mtime-rawtime);
+      if (tdiff!=0) {
+        fioPerr();
+        fprintf(stderr, " Error: fileModificationTime(\"%s\") is inaccurate\n"
+                , fname);
+        isOk=false;
+      }
+      // delete file
+      if (!fileDelete(fname)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileDelete(\"%s\") failed\n", fname);
+        isOk=false;
+      }
+      // check existance
+      if (fileExists(fname)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileExists(\"%s\") file exists after delete\n"
+                , fname);
+        isOk=false;
+      }
+      // null string into fileExists
+      if (fileExists(0)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileExists(0) null string file exists\n");
+        isOk=false;
+      }
+      // check file type from deleted file
+      if (-1!=fileType(fname)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileType(\"%s\") is not -1 (file does not exist)\n"
+                , fname);
+        isOk=false;
+      }
+      // check file type from null string
+      if (-1!=fileType(0)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileType(0) is not -1\n");
+        isOk=false;
+      }
+      // check file type from empty string
+      if (-1!=fileType("")) {
+        fioPerr();
+        fprintf(stderr, " Error: fileType("") is not -1\n");
+        isOk=false;
+      }
+      // file close from 0
+      if (EOF!=fileClose(0)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileClose(0) is not EOF\n");
+        isOk=false;
+      }
+      // reopen file fname in write mode
+      fp=fileOpen(fname, "wb");
+      if (!fp) {
+        fioPerr();
+        fprintf(stderr, " Error: fileOpen(\"%s\") reopen failed\n", fname);
+        isOk=false;
+      }
+      uint16_t u16_val=0x2030;
+      // write little endian uint16_t
+      if (!fwrite_u16(fp, ENDIAN_LITTLE, u16_val)) {
+        fioPerr();
+        fprintf(stderr, " Error: fwrite_u16 ENDIAN_LITTLE failed\n");
+        isOk=false;
+      }
+      // write big endian uint16_t
+      if (!fwrite_u16(fp, ENDIAN_BIG, u16_val)) {
+        fioPerr();
+        fprintf(stderr, " Error: fwrite_u16 ENDIAN_BIG failed\n");
+        isOk=false;
+
+      }
+      fileClose(fp);
+      // check file size
+      if (4!=fileSize(fname)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileSize(\"%s\") is not 4\n", fname);
+        isOk=false;
+      }
+      // open for read
+      fp=fileOpen(fname, "rb");
+      if (!fp) {
+        fioPerr();
+        fprintf(stderr, " Error: fileOpen(\"%s\") reopen for read failed\n", fname);
+        isOk=false;
+      }
+      uint16_t val=0;
+      if (!fread_u16(fp, ENDIAN_LITTLE, val)) {
+        fioPerr();
+        fprintf(stderr, " Error: fread_u16 ENDIAN_LITTLE failed\n");
+        isOk=false;
+      }
+      if (val!=u16_val) {
+        fioPerr();
+        fprintf(stderr, " Error: fread_u16 ENDIAN_LITTLE wrong value\n");
+        isOk=false;
+      }
+      if (!fread_u16(fp, ENDIAN_LITTLE, val)) {
+        fioPerr();
+        fprintf(stderr, " Error: fread_u16 next ENDIAN_LITTLE failed\n");
+        isOk=false;
+      }
+      if (bswap_u16(val)!=u16_val) {
+        fioPerr();
+        fprintf(stderr, " Error: fread_u16 next ENDIAN_LITTLE wrong value\n");
+        isOk=false;
+      }
+      rewind(fp);
+      uint32_t val2=0;
+      if (!fread_u32(fp, ENDIAN_LITTLE, val2)){
+        fioPerr();
+        fprintf(stderr, " Error: fread_u32 ENDIAN_LITTLE failed\n");
+        isOk=false;
+      }
+      if (val2!=0x30202030) {
+        fioPerr();
+        fprintf(stderr, " Error: fread_u32 ENDIAN_LITTLE is wrong\n");
+        isOk=false;
+      }
+      fileClose(fp);
+      // delete file
+      if (!fileDelete(fname)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileDelete(\"%s\") failed (delete second time)\n"
+                , fname);
+        isOk=false;
+      }
+      // open for read
+      fp=fileOpen(fname, "wb");
+      if (!fp) {
+        fioPerr();
+        fprintf(stderr, " Error: fileOpen(\"%s\") reopen (2) for write failed\n"
+                , fname);
+        isOk=false;
+      }
+      std::vector<uint8_t> vbuf;
+      for (size_t i=0; i<16; i++) {
+        vbuf.push_back(i);
+      }
+      if (!fileSaveBytes(fp, vbuf)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileSaveBytes failed\n");
+        isOk=false;
+      }
+      fileClose(fp);
+      // check file size
+      if (16!=fileSize(fname)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileSize(\"%s\") is not 16\n", fname);
+        isOk=false;
+      }
+      fp=fileOpen(fname, "rb");
+      if (fp) {
+        uint64_t val3=0;
+        if (!fread_u64(fp, ENDIAN_LITTLE, val3)) {
+          fioPerr();
+          fprintf(stderr, " Error: fread_u64 ENDIAN_LITTLE is wrong\n");
+          isOk=false;
+        }
+        if (val3!=0x0706050403020100) {
+          fioPerr();
+          fprintf(stderr, " Error: fread_u64 ENDIAN_LITTLE is wrong\n");
+          isOk=false;
+        }
+        rewind(fp);
+        if (!fread_u64(fp, ENDIAN_BIG, val3)) {
+          fioPerr();
+          fprintf(stderr, " Error: fread_u64 ENDIAN_BIG is wrong\n");
+          isOk=false;
+        }
+        if (val3!=0x0001020304050607) {
+          fioPerr();
+          fprintf(stderr, " Error: fread_u64 ENDIAN_BIG is wrong\n");
+          isOk=false;
+        }
+        rewind(fp);
+        vbuf.clear();
+        vbuf = fileLoadBytes(fp);
+        if (16!=vbuf.size()) {
+          fioPerr();
+          fprintf(stderr, " Error: fileLoadBytes has too few bytes\n");
+          isOk=false;
+        }
+        /* fioPerr(); */
+        /* fprintf(stderr, " Error: fileSaveBytes failed\n"); */
+        /* isOk=false; */
+        fclose(fp);
+        fp=fileOpen(fname, "rb");
+        if (fp) {
+          // read 4 bytes
+          vbuf.clear();
+          vbuf = fileLoadBytes(fp, 4);
+          if (4!=vbuf.size()) {
+            fioPerr();
+            fprintf(stderr, " Error: fileLoadBytes has wrong size (not 4)\n");
+            isOk=false;
+          }
+          if (vbuf[0]!=0 || vbuf[1]!=1 || vbuf[2]!=2 || vbuf[3]!=3) {
+            fioPerr();
+            fprintf(stderr, " Error: fileLoadBytes result has wrong values\n");
+            isOk=false;
+          }
+          // read 4 bytes again
+          vbuf.clear();
+          vbuf = fileLoadBytes(fp, 4);
+          if (4!=vbuf.size()) {
+            fioPerr();
+            fprintf(stderr, " Error: fileLoadBytes has wrong size (not 4)\n");
+            isOk=false;
+          }
+          if (vbuf[0]!=4 || vbuf[1]!=5 || vbuf[2]!=6 || vbuf[3]!=7) {
+            fioPerr();
+            fprintf(stderr, " Error: fileLoadBytes result has wrong values\n");
+            isOk=false;
+          }
+          fclose(fp);
+        }
+      }
+
+      fileDelete(fname);
+    }
+  }
+  {
+    // FileView
+    const char *fname="fiotst.dat";
+    FILE *fp=fileOpen(fname, "wb");
+    std::vector<uint8_t> vbuf;
+    for (size_t i=0; i<32; i++) {
+      vbuf.push_back(i);
+    }
+    if (!fp || !fileSaveBytes(fp, vbuf)) {
       fioPerr();
-      fprintf(stderr, " Error: FIO_VER is not %d\n", exp_val);
+      fprintf(stderr, " Error: FileView test file could not be written\n");
       isOk=false;
     }
-    exp_val=3;
-    if (FIO_REV!=exp_val) {
+    fileClose(fp);
+    FileView fv;
+    if (!fv.open(fname) || 32!=fv.size()) {
       fioPerr();
-      fprintf(stderr, " Error: FIO_REV is not %d\n", exp_val);
+      fprintf(stderr, " Error: FileView::open(\"%s\") failed\n", fname);
+      isOk=false;
+    } else if (fv.data()[0]!=0 || fv.data()[31]!=31) {
+      fioPerr();
+      fprintf(stderr, " Error: FileView::data has wrong values\n");
       isOk=false;
     }
-    const size_t SS=4;
-    const char se[SS]="1.3"; // expected value
-    const char sv[SS]=FIO_VERSTR; // real value
-    for (size_t i=0; i<SS; i++) {
-      if (sv[i]!=se[i]) {
+    if (!fv.advise(FILEVIEW_SEQUENTIAL)) {
+      fioPerr();
+      fprintf(stderr, " Error: FileView::advise failed\n");
+      isOk=false;
+    }
+    // window at an unaligned offset
+    fp=fileOpen(fname, "rb");
+    if (!fv.open(fp, 5, 4) || 4!=fv.size() || fv.data()[0]!=5
+        || fv.data()[3]!=8) {
+      fioPerr();
+      fprintf(stderr, " Error: FileView::open(fp, 5, 4) is wrong\n");
+      isOk=false;
+    }
+    fileClose(fp);
+    // window beyond the end of the file
+    if (fv.open(fname, 30, 4) || fv.isOpen() || 0!=fv.size()) {
+      fioPerr();
+      fprintf(stderr, " Error: FileView::open(\"%s\", 30, 4) falsely succeeded\n"
+              , fname);
+      isOk=false;
+    }
+    fv.close();
+    fileDelete(fname);
+  }
+  {
+    // fileReadBytes and fileLoadBytes with a reusable buffer
+    const char *fname="fiotst.dat";
+    FILE *fp=fileOpen(fname, "wb");
+    std::vector<uint8_t> vbuf;
+    for (size_t i=0; i<32; i++) {
+      vbuf.push_back(i);
+    }
+    fileSaveBytes(fp, vbuf);
+    fileClose(fp);
+    fp=fileOpen(fname, "rb");
+    if (fp) {
+      // mixed with buffered stdio reads
+      uint8_t u8=0;
+      uint8_t raw[4]={0, 0, 0, 0};
+      fread_u8(fp, u8);
+      if (4!=fileReadBytes(fp, raw, 4) || raw[0]!=1 || raw[3]!=4) {
         fioPerr();
-        fprintf(stderr, " Error: FIO_VERSTR is not '%s'\n", se);
+        fprintf(stderr, " Error: fileReadBytes result has wrong values\n");
+        isOk=false;
+      }
+      if (!fread_u8(fp, u8) || u8!=5) {
+        fioPerr();
+        fprintf(stderr, " Error: fread_u8 after fileReadBytes is wrong\n");
+        isOk=false;
+      }
+      // rest of the file
+      fioBuffer fbuf;
+      if (26!=fileLoadBytes(fp, fbuf) || 26!=fbuf.size() || fbuf[0]!=6) {
+        fioPerr();
+        fprintf(stderr, " Error: fileLoadBytes(fp, buf) is wrong\n");
+        isOk=false;
+      }
+      // short read reports the number of bytes read
+      rewind(fp);
+      if (32!=fileLoadBytes(fp, fbuf, 40) || 32!=fbuf.size()
+          || fbuf[31]!=31) {
+        fioPerr();
+        fprintf(stderr, " Error: fileLoadBytes(fp, buf, 40) is not 32\n");
+        isOk=false;
+      }
+      if (0!=fileReadBytes(fp, raw, 4)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileReadBytes at end of file is not 0\n");
+        isOk=false;
+      }
+      fileClose(fp);
+    }
+    fileDelete(fname);
+  }
+  {
+    // fileWriteBytes and fileWriteGather mixed with stdio writes
+    const char *fname="fiotst.dat";
+    FILE *fp=fileOpen(fname, "wb");
+    if (fp) {
+      const uint8_t head[3]={1, 2, 3};
+      const uint8_t body[5]={4, 5, 6, 7, 8};
+      fwrite_u8(fp, 0);
+      if (!fileWriteBytes(fp, head, 3)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileWriteBytes failed\n");
+        isOk=false;
+      }
+      fioIoVec iov[3]={ {head, 3}, {body, 0}, {body, 5} };
+      if (!fileWriteGather(fp, iov, 3)) {
+        fioPerr();
+        fprintf(stderr, " Error: fileWriteGather failed\n");
+        isOk=false;
+      }
+      fwrite_u8(fp, 9);
+      fileClose(fp);
+    }
+    const uint8_t exp_val[13]={0, 1, 2, 3, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    fp=fileOpen(fname, "rb");
+    std::vector<uint8_t> vbuf=fileLoadBytes(fp);
+    fileClose(fp);
+    bool isEqual=(13==vbuf.size());
+    for (size_t i=0; isEqual && i<13; i++) {
+      isEqual=(exp_val[i]==vbuf[i]);
+    }
+    if (!isEqual) {
+      fioPerr();
+      fprintf(stderr, " Error: fileWriteGather wrote wrong values\n");
+      isOk=false;
+    }
+    fileDelete(fname);
+  }
+  {
+    // bswap_u*_array (odd sizes exercise the scalar tail)
+    const size_t N=67;
+    uint16_t a16[N];
+    uint32_t a32[N];
+    uint64_t a64[N];
+    for (size_t i=0; i<N; i++) {
+      a16[i]=(uint16_t)(0x0102*i);
+      a32[i]=(uint32_t)(0x01020304*i);
+      a64[i]=0x0102030405060708ULL*i;
+    }
+    bswap_u16_array(a16, N);
+    bswap_u32_array(a32, N);
+    bswap_u64_array(a64, N);
+    for (size_t i=0; i<N; i++) {
+      if (a16[i]!=bswap_u16((uint16_t)(0x0102*i))
+          || a32[i]!=bswap_u32((uint32_t)(0x01020304*i))
+          || a64[i]!=bswap_u64(0x0102030405060708ULL*i)) {
+        fioPerr();
+        fprintf(stderr, " Error: bswap_u*_array is wrong at %d\n", (int)i);
         isOk=false;
         break;
       }
     }
   }
   {
-    // check PATH_SEPARATOR and EOL
-#ifdef __linux__
-    const char ce = '/';
-    const char *se = "\n";
-#elif defined(_WIN32) || defined(WIN32)
-    const char ce = '\\';
-    const char *se = "\r\n";
-#endif
-    if (ce!=PATH_SEPARATOR) {
+    // fread_*_array and fwrite_*_array
+    const char *fname="fiotst.dat";
+    const size_t N=37;
+    uint16_t u16[N];
+    int32_t i32[N];
+    float f32[N];
+    uint64_t u64[N];
+    double f64[N];
+    for (size_t i=0; i<N; i++) {
+      u16[i]=(uint16_t)(0x1122+i);
+      i32[i]=-(int32_t)(0x11223344+i);
+      f32[i]=1.5f*i;
+      u64[i]=0x1122334455667788ULL+i;
+      f64[i]=-2.25*i;
+    }
+    FILE *fp=fileOpen(fname, "wb");
+    if (!fwrite_u16_array(fp, ENDIAN_BIG, u16, N)
+        || !fwrite_i32_array(fp, ENDIAN_BIG, i32, N)
+        || !fwrite_f32_array(fp, ENDIAN_LITTLE, f32, N)
+        || !fwrite_u64_array(fp, ENDIAN_BIG, u64, N)
+        || !fwrite_f64_array(fp, ENDIAN_BIG, f64, N)) {
       fioPerr();
-      fprintf(stderr, " Error: PATH_SEPARATOR is not '%c'\n", ce);
+      fprintf(stderr, " Error: fwrite_*_array failed\n");
       isOk=false;
     }
-    const char *sv=EOL;
-    if ( (se[0]!=sv[0]) || (se[1]!=sv[1])) {
+    fileClose(fp);
+    if ((int64_t)(N*26)!=fileSize(fname)) {
+      fioPerr();
+      fprintf(stderr, " Error: fwrite_*_array wrote wrong size\n");
+      isOk=false;
+    }
+    uint16_t r16[N];
+    int32_t ri32[N];
+    float rf32[N];
+    uint64_t r64[N];
+    double rf64[N];
+    fp=fileOpen(fname, "rb");
+    uint16_t first=0;
+    if (!fread_u16(fp, ENDIAN_BIG, first) || first!=0x1122) {
+      fioPerr();
+      fprintf(stderr, " Error: fwrite_u16_array ENDIAN_BIG is wrong\n");
+      isOk=false;
+    }
+    rewind(fp);
+    if (!fread_u16_array(fp, ENDIAN_BIG, r16, N)
+        || !fread_i32_array(fp, ENDIAN_BIG, ri32, N)
+        || !fread_f32_array(fp, ENDIAN_LITTLE, rf32, N)
+        || !fread_u64_array(fp, ENDIAN_BIG, r64, N)
+        || !fread_f64_array(fp, ENDIAN_BIG, rf64, N)) {
+      fioPerr();
+      fprintf(stderr, " Error: fread_*_array failed\n");
+      isOk=false;
+    }
+    if (fread_u16_array(fp, ENDIAN_BIG, r16, 1)) {
+      fioPerr();
+      fprintf(stderr, " Error: fread_u16_array falsely succeeded at end\n");
+      isOk=false;
+    }
+    fileClose(fp);
+    for (size_t i=0; i<N; i++) {
+      if (r16[i]!=u16[i] || ri32[i]!=i32[i] || rf32[i]!=f32[i]
+          || r64[i]!=u64[i] || rf64[i]!=f64[i]) {
+        fioPerr();
+        fprintf(stderr, " Error: fread_*_array wrong value at %d\n", (int)i);
+        isOk=false;
+        break;
+      }
+    }
+    fileDelete(fname);
+  }
+  {
+    // FileReader
+    const char *fname="fiotst.dat";
+    const size_t N=100;
+    FILE *fp=fileOpen(fname, "wb");
+    for (size_t i=0; i<N; i++) {
+      fwrite_u8(fp, (uint8_t)i);
+      fwrite_u16(fp, ENDIAN_BIG, (uint16_t)(1000+i));
+      fwrite_u32(fp, ENDIAN_LITTLE, (uint32_t)(100000+i));
+      fwrite_u64(fp, ENDIAN_BIG, 10000000000ULL+i);
+    }
+    fileClose(fp);
+    fp=fileOpen(fname, "rb");
+    FileReader rd(64); // small buffer to straddle refills
+    if (!rd.open(fp)) {
+      fioPerr();
+      fprintf(stderr, " Error: FileReader::open failed\n");
+      isOk=false;
+    }
+    bool isEqual=true;
+    for (size_t i=0; i<N; i++) {
+      isEqual=isEqual && (uint8_t)i==rd.readU8();
+      isEqual=isEqual && (uint16_t)(1000+i)==rd.readU16(ENDIAN_BIG);
+      isEqual=isEqual && (uint32_t)(100000+i)==rd.readU32(ENDIAN_LITTLE);
+      isEqual=isEqual && 10000000000ULL+i==rd.readU64(ENDIAN_BIG);
+    }
+    if (!isEqual || !rd.ok() || (int64_t)(N*15)!=rd.tell()) {
+      fioPerr();
+      fprintf(stderr, " Error: FileReader typed reads are wrong\n");
+      isOk=false;
+    }
+    // seek back, skip and read bytes larger than the buffer
+    uint8_t raw[120];
+    if (!rd.seek(15) || !rd.skip(3) || 100001!=rd.readU32(ENDIAN_LITTLE)
+        || !rd.readBytes(raw, sizeof(raw)) || raw[8]!=2 || 22+120!=rd.tell()) {
+      fioPerr();
+      fprintf(stderr, " Error: FileReader seek/skip/readBytes is wrong\n");
+      isOk=false;
+    }
+    // reading past the end latches FIO_EOF
+    rd.seek(N*15-2);
+    if (0!=rd.readU32(ENDIAN_LITTLE) || FIO_EOF!=rd.status()
+        || 0!=rd.readU8() || rd.ok()) {
       fioPerr();
+      fprintf(stderr, " Error: FileReader status is not FIO_EOF at end\n");
+      isOk=false;
+    }
+    // seek clears FIO_EOF; a seek back into the bytes of a bypassed
+    // readBytes reads the file, not a stale buffer
+    uint8_t big[300];
+    if (!rd.seek(0) || !rd.ok() || 0!=rd.readU8()
+        || !rd.readBytes(big, sizeof(big)) || !rd.seek(250)
+        || big[249]!=rd.readU8() || !rd.ok()) {
+      fioPerr();
+      fprintf(stderr, " Error: FileReader::seek after FIO_EOF is wrong\n");
+      isOk=false;
+    }
 #ifdef __linux__
-      fprintf(stderr, " Error: EOL is not '\\n'\n");
-#elif defined(_WIN32) || defined(WIN32)
-      fprintf(stderr, " Error: EOL is not '\\r\\n'\n");
+    // stdio may have buffered bytes of a pipe, such a FILE* is refused
+    FILE *pp=popen("echo fio", "r");
+    FileReader prd;
+    if (pp && prd.open(pp)) {
+      fioPerr();
+      fprintf(stderr, " Error: FileReader::open accepts a pipe FILE*\n");
+      isOk=false;
+    }
+    if (pp) pclose(pp);
 #endif
+    // the FILE* continues after the last parsed byte
+    rd.open(fp);
+    rd.seek(15);
+    rd.readU8();
+    rd.close();
+    uint16_t u16=0;
+    if (!fread_u16(fp, ENDIAN_BIG, u16) || 1001!=u16) {
+      fioPerr();
+      fprintf(stderr, " Error: FileReader::close did not sync the file\n");
       isOk=false;
     }
+    fileClose(fp);
+    fileDelete(fname);
   }
   {
-    // check ENDIAN_LITTLE ENDIAN_BIG and FILEIOBUFSIZE
-    if (false != ENDIAN_LITTLE) {
+    // FileWriter
+    const char *fname="fiotst.dat";
+    const size_t N=100;
+    FILE *fp=fileOpen(fname, "wb");
+    fwrite_u8(fp, 0xAA); // buffered stdio data before the writer
+    FileWriter wr(64, 16); // small buffer to force aligned flushes
+    if (!wr.open(fp)) {
       fioPerr();
-      fprintf(stderr, " Error: ENDIAN_LITTLE is not 0\n");
+      fprintf(stderr, " Error: FileWriter::open failed\n");
       isOk=false;
     }
-    if (true != ENDIAN_BIG) {
+    for (size_t i=0; i<N; i++) {
+      wr.writeU8((uint8_t)i);
+      wr.writeU16(ENDIAN_BIG, (uint16_t)(1000+i));
+      wr.writeU32(ENDIAN_LITTLE, (uint32_t)(100000+i));
+      wr.writeU64(ENDIAN_BIG, 10000000000ULL+i);
+    }
+    uint8_t raw[100];
+    for (size_t i=0; i<sizeof(raw); i++) {
+      raw[i]=(uint8_t)i;
+    }
+    wr.writeBytes(raw, 10);
+    wr.writeBytes(raw, sizeof(raw)); // larger than the buffer
+    uint8_t *p=wr.reserve(3);
+    if (p) {
+      p[0]=7; p[1]=8; p[2]=9;
+    }
+    if (!p || !wr.ok() || (int64_t)(1+N*15+113)!=wr.tell() || !wr.close()) {
       fioPerr();
-      fprintf(stderr, " Error: ENDIAN_LITTLE is not 1\n");
+      fprintf(stderr, " Error: FileWriter writes failed\n");
       isOk=false;
     }
-    int ie=8192;
-    if (ie != FILEIOBUFSIZE) {
+    fwrite_u8(fp, 0xBB); // stdio continues after the writer
+    fileClose(fp);
+    fp=fileOpen(fname, "rb");
+    FileReader rd;
+    rd.open(fp);
+    bool isEqual=(0xAA==rd.readU8());
+    for (size_t i=0; i<N; i++) {
+      isEqual=isEqual && (uint8_t)i==rd.readU8();
+      isEqual=isEqual && (uint16_t)(1000+i)==rd.readU16(ENDIAN_BIG);
+      isEqual=isEqual && (uint32_t)(100000+i)==rd.readU32(ENDIAN_LITTLE);
+      isEqual=isEqual && 10000000000ULL+i==rd.readU64(ENDIAN_BIG);
+    }
+    rd.skip(10+99);
+    isEqual=isEqual && 99==rd.readU8() && 7==rd.readU8();
+    rd.skip(2);
+    isEqual=isEqual && 0xBB==rd.readU8() && rd.ok();
+    rd.close();
+    fileClose(fp);
+    if (!isEqual) {
+      fioPerr();
+      fprintf(stderr, " Error: FileWriter wrote wrong values\n");
+      isOk=false;
+    }
+    // the first error is reported with its offset
+    fp=fileOpen(fname, "rb");
+    FileWriter wr2;
+    wr2.open(fp);
+    wr2.writeU32(ENDIAN_BIG, 1);
+    if (wr2.flush() || wr2.ok() || 0!=wr2.errorOffset() || 0==wr2.error()) {
+      fioPerr();
+      fprintf(stderr, " Error: FileWriter did not report the write error\n");
+      isOk=false;
+    }
+    // later writes are dropped, also on a closed or never opened writer
+    FileWriter wr3;
+    if (wr2.writeU8(1) || wr2.writeU64(ENDIAN_BIG, 1) || wr2.reserve(2)
+        || wr3.writeU32(ENDIAN_BIG, 1) || wr3.writeU8(1) || wr3.reserve(4)) {
+      fioPerr();
+      fprintf(stderr, " Error: FileWriter wrote after an error\n");
+      isOk=false;
+    }
+    wr2.close();
+    if (wr2.writeU16(ENDIAN_BIG, 1)) {
+      fioPerr();
+      fprintf(stderr, " Error: FileWriter wrote after close\n");
+      isOk=false;
+    }
+    fileClose(fp);
+    fileDelete(fname);
+  }
+  {
+    // fread_endian, fwrite_endian and FileReader::read/FileWriter::write
+    const char *fname="fiotst.dat";
+    FILE *fp=fileOpen(fname, "wb");
+    if (!fwrite_endian<float, ENDIAN_BIG>(fp, 1.0f)
+        || !fwrite_endian<int16_t, ENDIAN_LITTLE>(fp, -2)
+        || !fwrite_endian<double, ENDIAN_BIG>(fp, -0.5)) {
+      fioPerr();
+      fprintf(stderr, " Error: fwrite_endian failed\n");
+      isOk=false;
+    }
+    FileWriter wr;
+    wr.open(fp);
+    wr.write<int32_t, ENDIAN_BIG>(-3);
+    wr.close();
+    fileClose(fp);
+    fp=fileOpen(fname, "rb");
+    uint32_t u32=0;
+    if (!fread_u32(fp, ENDIAN_BIG, u32) || 0x3F800000!=u32) {
+      fioPerr();
+      fprintf(stderr, " Error: fwrite_endian<float, ENDIAN_BIG> is wrong\n");
+      isOk=false;
+    }
+    int16_t i16=0;
+    double f64=0;
+    if (!fread_endian<int16_t, ENDIAN_LITTLE>(fp, i16) || -2!=i16
+        || !fread_endian<double, ENDIAN_BIG>(fp, f64) || -0.5!=f64) {
+      fioPerr();
+      fprintf(stderr, " Error: fread_endian is wrong\n");
+      isOk=false;
+    }
+    FileReader rd;
+    rd.open(fp);
+    if (-3!=rd.read<int32_t, ENDIAN_BIG>() || !rd.ok()) {
       fioPerr();
-      fprintf(stderr, " Error: FILEIOBUFSIZE is not %d\n", ie);
+      fprintf(stderr, " Error: FileReader::read<int32_t, ENDIAN_BIG> is wrong\n");
       isOk=false;
     }
+    rd.close();
+    fileClose(fp);
+    fileDelete(fname);
   }
   {
-    // check strSize
-    if (0!=strSize(0) || 0!=strSize(NULL)) {
+    // fileStat and fileStatBatch
+    const char *fname="fiotst.dat";
+    FILE *fp=fileOpen(fname, "wb");
+    fwrite_u32(fp, ENDIAN_BIG, 1);
+    fileClose(fp);
+    FileStat st;
+    if (!fileStat(fname, st) || 4!=st.size || FILETYPE_FILE!=st.type
+        || st.mtime!=fileModificationTime(fname) || st.mtimeNsec<0
+        || st.mtimeNsec>999999999) {
       fioPerr();
-      fprintf(stderr, " Error: strSize(0) is not 0\n");
+      fprintf(stderr, " Error: fileStat(\"%s\") is wrong\n", fname);
       isOk=false;
     }
-    if (0!=strSize("")) {
+    if (!fileStat(".", st) || FILETYPE_DIR!=st.type || FILETYPE_DIR!=fileType(".")) {
       fioPerr();
-      fprintf(stderr, " Error: strSize(\"\") is not 0\n");
+      fprintf(stderr, " Error: fileStat(\".\") is not a directory\n");
       isOk=false;
     }
-    if (0!=strSize("\0")) {
+    if (fileStat("fiotst.none", st) || FILETYPE_ERROR!=st.type) {
       fioPerr();
-      fprintf(stderr, " Error: strSize(\"\\0\") is not 0\n");
+      fprintf(stderr, " Error: fileStat(\"fiotst.none\") falsely succeeded\n");
       isOk=false;
     }
-    if (3!=strSize("foo")) {
-      fioPerr();
-      fprintf(stderr, " Error: strSize(\"foo\") is not 3\n");
-      isOk=false;
+#ifdef __linux__
+    const size_t N=300;
+    std::vector<const char *> paths;
+    for (size_t i=0; i<N; i++) {
+      paths.push_back(i%3==2 ? "fiotst.none" : (i%3==1 ? "." : fname));
     }
-    if (0!=strSize("\0foo")) {
+    std::vector<FileStat> sts(N);
+    if (N-N/3!=fileStatBatch(AT_FDCWD, &paths[0], N, &sts[0], 4)
+        || 4!=sts[0].size || FILETYPE_DIR!=sts[1].type
+        || FILETYPE_ERROR!=sts[N-1].type) {
       fioPerr();
-      fprintf(stderr, " Error: strSize(\"\\0foo\") is not 0\n");
+      fprintf(stderr, " Error: fileStatBatch is wrong\n");
       isOk=false;
     }
+#endif
+    fileDelete(fname);
   }
+#ifdef __linux__
   {
-    // skip -> check isBigEndian
-  }
-  {
-    // bswap_u16
-    uint16_t s=0x1122;
-    if (0x2211!=bswap_u16(s)) {
+    // metadata cache with inotify invalidation
+    const char *fname="fiotst.dat";
+    FILE *fp=fileOpen(fname, "wb");
+    fwrite_u32(fp, ENDIAN_BIG, 1);
+    fileClose(fp);
+    if (!fileCacheEnable(60000) || !fileCacheEnabled()) {
       fioPerr();
-      fprintf(stderr, " Error: bswap_u16(0x1122) is incorrect\n");
+      fprintf(stderr, " Error: fileCacheEnable failed\n");
       isOk=false;
     }
-    if (s!=bswap_u16(bswap_u16(s))) {
+    FileCacheStats cs0=fileCacheStats();
+    fileSize(fname);
+    if (4!=fileSize(fname) || FILETYPE_FILE!=fileType(fname)
+        || !fileExists(fname) || fileExists("fiotst.none")
+        || fileExists("fiotst.none")) {
       fioPerr();
-      fprintf(stderr, " Error: bswap_u16(bswap_u16(0x1122)) is incorrect\n");
+      fprintf(stderr, " Error: cached file functions are wrong\n");
       isOk=false;
     }
-    if (0!=bswap_u16(0)) {
+    FileCacheStats cs1=fileCacheStats();
+    if (cs1.hits-cs0.hits<4 || cs1.misses-cs0.misses!=2) {
       fioPerr();
-      fprintf(stderr, " Error: bswap_u16(0) is incorrect\n");
+      fprintf(stderr, " Error: fileCacheStats has wrong counters\n");
       isOk=false;
     }
-  }
-  {
-    // bswap_u32
-    uint32_t s=0x11223344;
-    if (0x44332211!=bswap_u32(s)) {
+    // the ttl is long, so only inotify can invalidate the entry
+    fp=fileOpen(fname, "ab");
+    fwrite_u32(fp, ENDIAN_BIG, 2);
+    fileClose(fp);
+    int64_t fsize=0;
+    for (int i=0; i<200 && 8!=fsize; i++) {
+      fsize=fileSize(fname);
+      if (8!=fsize) usleep(5000);
+    }
+    if (8!=fsize || fileCacheStats().invalidations==cs1.invalidations) {
       fioPerr();
-      fprintf(stderr, " Error: bswap_u32(0x11223344) is incorrect\n");
+      fprintf(stderr, " Error: fileSize(\"%s\") was not invalidated\n", fname);
       isOk=false;
     }
-    if (0!=bswap_u32(0)) {
+    fileDelete(fname);
+    bool exists=true;
+    for (int i=0; i<200 && exists; i++) {
+      exists=fileExists(fname);
+      if (exists) usleep(5000);
+    }
+    if (exists) {
       fioPerr();
-      fprintf(stderr, " Error: bswap_u32(0) is incorrect\n");
+      fprintf(stderr, " Error: fileExists(\"%s\") after delete is cached\n", fname);
+      isOk=false;
+    }
+    fileCacheDisable();
+    if (fileCacheEnabled()) {
+      fioPerr();
+      fprintf(stderr, " Error: fileCacheDisable failed\n");
       isOk=false;
     }
   }
+#endif
+#ifdef __linux__
   {
-    // bswap_u64
-  }
-  {
-    // open file that does not exist in read mode
+    // FileAsync with io_uring (if available) and with the thread pool
     const char *fname="fiotst.dat";
-    if (fileExists(fname)) {
-      fioPerr();
-      fprintf(stderr, " Error: fileExists(\"%s\") file exists on start\n", fname);
-      isOk=false;
-    } else {
-      FILE *fp=fileOpen(fname, "rb");
-      if (fp) {
-        fioPerr();
-        fprintf(stderr, " Error: fileOpen(\"%s\") falsely succeeded\n", fname);
-        isOk=false;
-      }
-      // check existance
-      if (fileExists(fname)) {
-        fioPerr();
-        fprintf(stderr, " Error: fileExists(\"%s\") falsely succeeded\n", fname);
-        isOk=false;
-      }
-      time_t rawtime;
-      time(&rawtime);
-      // open file that does not exist in write mode
-      fp=fileOpen(fname, "wb");
-      if (!fp) {
-        fioPerr();
-        fprintf(stderr, " Error: fileOpen(\"%s\") failed\n", fname);
-        isOk=false;
-      }
-      fileClose(fp);
-      // check existance
-      if (!fileExists(fname)) {
+    const size_t N=100000;
+    std::vector<uint8_t> vbuf(N);
+    for (size_t i=0; i<N; i++) {
+      vbuf[i]=(uint8_t)(i*7);
+    }
+    for (int k=0; k<2; k++) {
+      FileAsync aio;
+      if (!aio.open(4, 2, k==0) || (k==1 && FILEASYNC_THREADS!=aio.engine())) {
         fioPerr();
-        fprintf(stderr, " Error: fileExists(\"%s\") failed\n", fname);
+        fprintf(stderr, " Error: FileAsync::open failed\n");
         isOk=false;
+        continue;
       }
-      // file readable
-      if (!fileReadable(fname)) {
+      int64_t saved=-1;
+      aio.saveFile(fname, &vbuf[0], N, [&saved](int64_t res) { saved=res; });
+      aio.drain();
+      if ((int64_t)N!=saved || (int64_t)N!=fileSize(fname)) {
         fioPerr();
-        fprintf(stderr, " Error: fileReadable(\"%s\") failed\n", fname);
+        fprintf(stderr, " Error: FileAsync::saveFile failed (engine %d)\n"
+                , aio.engine());
         isOk=false;
       }
-      // file type (0=normal file)
-      if (0!=fileType(fname)) {
-        fioPerr();
-        fprintf(stderr, " Error: fileType(\"%s\") is wrong\n", fname);
-        isOk=false;
+      // more reads than the queue depth
+      const int fd=open(fname, O_RDONLY);
+      uint8_t parts[10][1000];
+      int64_t sum=0;
+      for (int i=0; i<10; i++) {
+        aio.read(fd, i*9000, parts[i], 1000, [&sum](int64_t res) { sum+=res; });
       }
-      // check file size
-      if (0!=fileSize(fname)) {
+      int64_t last=-1;
+      aio.read(fd, N-10, parts[0], 1000, [&last](int64_t res) { last=res; });
+      aio.drain();
+      close(fd);
+      if (10000!=sum || 10!=last || parts[9][1]!=(uint8_t)(81001*7)) {
         fioPerr();
-        fprintf(stderr, " Error: fileSize(\"%s\") is not 0\n", fname);
+        fprintf(stderr, " Error: FileAsync::read is wrong (engine %d)\n"
+                , aio.engine());
         isOk=false;
       }
-      // check modification time
-      time_t mtime=fileModificationTime(fname);
-      if (mtime==0) {
-        fioPerr();
-        fprintf(stderr, " Error: fileModificationTime(\"%s\") failed\n", fname);
-        isOk=false;
+      fioBuffer fbuf;
+      int64_t loaded=-1;
+      aio.loadFile(fname, fbuf, [&loaded](int64_t res) { loaded=res; });
+      while (aio.pending() > 0) {
+        aio.poll();
       }
-      time_t tdiff=abs(mtime-rawtime);
-      if (tdiff!=0) {
+      if ((int64_t)N!=loaded || N!=fbuf.size() || fbuf[N-1]!=vbuf[N-1]) {
         fioPerr();
-        fprintf(stderr, " Error: fileModificationTime(\"%s\") is inaccurate\n"
-                , fname);
+        fprintf(stderr, " Error: FileAsync::loadFile is wrong (engine %d)\n"
+                , aio.engine());
         isOk=false;
       }
-      // delete file
-      if (!fileDelete(fname)) {
+      aio.close();
+      // a request that cannot be queued does not leak its descriptor
+      const int fdBefore=::open(fname, O_RDONLY);
+      ::close(fdBefore);
+      if (aio.loadFile(fname, fbuf, 0) || aio.saveFile(fname, &vbuf[0], 1, 0)
+          || fdBefore!=::open(fname, O_RDONLY)) {
         fioPerr();
-        fprintf(stderr, " Error: fileDelete(\"%s\") failed\n", fname);
+        fprintf(stderr, " Error: FileAsync leaked a descriptor\n");
         isOk=false;
       }
-      // check existance
-      if (fileExists(fname)) {
-        fioPerr();
-        fprintf(stderr, " Error: fileExists(\"%s\") file exists after delete\n"
-                , fname);
-        isOk=false;
+      ::close(fdBefore);
+    }
+    fileDelete(fname);
+  }
+#endif
+  {
+    // fileLoadBytesParallel
+    const char *fname="fiotst.dat";
+    const size_t N=100000+123;
+    std::vector<uint8_t> vbuf(N);
+    for (size_t i=0; i<N; i++) {
+      vbuf[i]=(uint8_t)(i*13);
+    }
+    FILE *fp=fileOpen(fname, "wb");
+    fileSaveBytes(fp, vbuf);
+    fileClose(fp);
+    fp=fileOpen(fname, "rb");
+    std::vector<uint8_t> v1=fileLoadBytesParallel(fp, 0, 4, 4096);
+    if (v1!=vbuf) {
+      fioPerr();
+      fprintf(stderr, " Error: fileLoadBytesParallel result is wrong\n");
+      isOk=false;
+    }
+    // reusable buffer from an offset, short read at the end of the file
+    fseeko64(fp, 1000, SEEK_SET);
+    fioBuffer fbuf;
+    if ((int64_t)(N-1000)!=fileLoadBytesParallel(fp, fbuf, N, 3, 4096)
+        || fbuf[0]!=vbuf[1000] || fbuf[N-1001]!=vbuf[N-1]
+        || (int64_t)N!=ftello64(fp)) {
+      fioPerr();
+      fprintf(stderr, " Error: fileLoadBytesParallel(fp, buf) is wrong\n");
+      isOk=false;
+    }
+    fileClose(fp);
+    fileDelete(fname);
+  }
+#ifdef __linux__
+  {
+    // FileDir and fileWalk
+    mkdir("fiotst.dir", 0755);
+    mkdir("fiotst.dir/sub", 0755);
+    mkdir("fiotst.dir/sub/deep", 0755);
+    const char *files[3]={"fiotst.dir/a.dat", "fiotst.dir/sub/b.dat",
+                          "fiotst.dir/sub/deep/c.dat"};
+    for (int i=0; i<3; i++) {
+      FILE *fp=fileOpen(files[i], "wb");
+      fwrite_u64(fp, ENDIAN_BIG, i);
+      fileClose(fp);
+    }
+    if (symlink("sub", "fiotst.dir/link")!=0) {
+      fioPerr();
+      fprintf(stderr, " Error: symlink for the FileDir test failed\n");
+      isOk=false;
+    }
+    FileDir dir;
+    FileDirEntry de;
+    int found=0;
+    if (!dir.open("fiotst.dir")) {
+      fioPerr();
+      fprintf(stderr, " Error: FileDir::open failed\n");
+      isOk=false;
+    }
+    while (dir.next(de)) {
+      if (0==strcmp(de.name, "a.dat") && FILETYPE_FILE==de.type
+          && 8==dir.size(de)) found|=1;
+      if (0==strcmp(de.name, "sub") && FILETYPE_DIR==de.type) found|=2;
+      if (0==strcmp(de.name, "link") && FILETYPE_SYMLINK==de.type) found|=4;
+      if (de.name[0]=='.') found|=8;
+    }
+    dir.close();
+    if (7!=found) {
+      fioPerr();
+      fprintf(stderr, " Error: FileDir::next entries are wrong\n");
+      isOk=false;
+    }
+    FileWalkOptions opt;
+    std::atomic<int64_t> bytes(0);
+    FileWalkVisitor sumSizes=[&bytes](const FileWalkEntry &e) {
+      if (FILETYPE_FILE==e.type) bytes+=e.size();
+      return true;
+    };
+    if (6!=fileWalk("fiotst.dir", sumSizes, opt) || 24!=bytes) {
+      fioPerr();
+      fprintf(stderr, " Error: fileWalk is wrong\n");
+      isOk=false;
+    }
+    // the size of a link is its own (3 bytes for "sub"), as in FileDir
+    int64_t linkSize=-1;
+    fileWalk("fiotst.dir", [&linkSize](const FileWalkEntry &e) {
+      if (0==strcmp(e.name, "link")) linkSize=e.size();
+      return true;
+    }, opt);
+    if (3!=linkSize) {
+      fioPerr();
+      fprintf(stderr, " Error: FileWalkEntry::size follows the link\n");
+      isOk=false;
+    }
+    opt.maxDepth=0;
+    if (3!=fileWalk("fiotst.dir/", sumSizes, opt)) {
+      fioPerr();
+      fprintf(stderr, " Error: fileWalk with maxDepth 0 is wrong\n");
+      isOk=false;
+    }
+    // follow the link with 4 threads, sub is listed only once
+    opt.maxDepth=-1;
+    opt.followLinks=true;
+    opt.threads=4;
+    bytes=0;
+    if (6!=fileWalk("fiotst.dir", sumSizes, opt) || 24!=bytes) {
+      fioPerr();
+      fprintf(stderr, " Error: fileWalk with followLinks is wrong\n");
+      isOk=false;
+    }
+    if (-1!=fileWalk("fiotst.none", sumSizes, opt)) {
+      fioPerr();
+      fprintf(stderr, " Error: fileWalk(\"fiotst.none\") is not -1\n");
+      isOk=false;
+    }
+    unlink("fiotst.dir/link");
+    for (int i=0; i<3; i++) {
+      fileDelete(files[i]);
+    }
+    rmdir("fiotst.dir/sub/deep");
+    rmdir("fiotst.dir/sub");
+    rmdir("fiotst.dir");
+  }
+#endif
+  {
+    // FileHasher, fileHash and the fused load/save paths
+    FileHasher x(FILEHASH_XXH64);
+    FileHasher c(FILEHASH_CRC32C);
+    c.update("123456789", 9);
+    if (0xEF46DB3751D8E999ULL!=x.digest() || 0xE3069283!=c.digest()) {
+      fioPerr();
+      fprintf(stderr, " Error: FileHasher digest is wrong\n");
+      isOk=false;
+    }
+    std::vector<uint8_t> data(300000);
+    for (size_t i=0; i<data.size(); i++) {
+      data[i]=(uint8_t)(i * 7 + (i >> 9));
+    }
+    // digest of one update equals the digest of odd pieces
+    FileHasher whole[2]={FileHasher(FILEHASH_CRC32C),
+                         FileHasher(FILEHASH_XXH64)};
+    for (int a=0; a<2; a++) {
+      whole[a].update(&data[0], data.size());
+      FileHasher parts(a);
+      for (size_t i=0, k=1; i<data.size(); i+=k, k=k*3+1) {
+        parts.update(&data[i], std::min(k, data.size() - i));
       }
-      // null string into fileExists
-      if (fileExists(0)) {
+      if (whole[a].digest()!=parts.digest()) {
         fioPerr();
-        fprintf(stderr, " Error: fileExists(0) null string file exists\n");
+        fprintf(stderr, " Error: FileHasher(%d) pieces differ\n", a);
         isOk=false;
       }
-      // check file type from deleted file
-      if (-1!=fileType(fname)) {
+    }
+    // the table fallback matches the selected (crc instruction) kernel
+    if (fioCrc32cSlice8(0, &data[1], data.size() - 1)
+        !=fioCrc32cSelect()(0, &data[1], data.size() - 1)) {
+      fioPerr();
+      fprintf(stderr, " Error: CRC-32C kernels differ\n");
+      isOk=false;
+    }
+    FILE *fp=fileOpen("fiotst.dat", "wb");
+    FileHasher hs(FILEHASH_XXH64);
+    if (!fp || !fileSaveBytes(fp, data, 0, &hs)
+        || hs.digest()!=whole[1].digest()) {
+      fioPerr();
+      fprintf(stderr, " Error: fileSaveBytes with hasher failed\n");
+      isOk=false;
+    }
+    fileClose(fp);
+    fp=fileOpen("fiotst.dat", "rb");
+    if (fp) {
+      fioBuffer fbuf;
+      FileHasher hl(FILEHASH_CRC32C);
+      if ((int64_t)data.size()!=fileLoadBytes(fp, fbuf, 0, &hl)
+          || hl.digest()!=whole[0].digest()
+          || 0!=memcmp(&fbuf[0], &data[0], data.size())) {
         fioPerr();
-        fprintf(stderr, " Error: fileType(\"%s\") is not -1 (file does not exist)\n"
-                , fname);
+        fprintf(stderr, " Error: fileLoadBytes with hasher failed\n");
         isOk=false;
       }
-      // check file type from null string
-      if (-1!=fileType(0)) {
+      fseeko64(fp, 0, SEEK_SET);
+      FileHasher hf(FILEHASH_XXH64);
+      if ((int64_t)data.size()!=fileHash(fp, hf)
+          || hf.digest()!=whole[1].digest()) {
         fioPerr();
-        fprintf(stderr, " Error: fileType(0) is not -1\n");
+        fprintf(stderr, " Error: fileHash failed\n");
         isOk=false;
       }
-      // check file type from empty string
-      if (-1!=fileType("")) {
+      fileClose(fp);
+    }
+    fileDelete("fiotst.dat");
+  }
+  {
+    // path based load and save with FILEIO_DIRECT and FILEIO_DROPBEHIND
+    std::vector<uint8_t> data(FILEDIRECTCHUNK + 5000);
+    for (size_t i=0; i<data.size(); i++) {
+      data[i]=(uint8_t)(i * 13 + (i >> 12));
+    }
+    const int modes[3]={FILEIO_BUFFERED, FILEIO_DIRECT, FILEIO_DROPBEHIND};
+    for (int m=0; m<3; m++) {
+      fioBuffer fbuf;
+      if (!fileSaveBytes("fiotst.dat", &data[0], data.size(), modes[m])
+          || (int64_t)data.size()!=fileSize("fiotst.dat")
+          || (int64_t)data.size()!=fileLoadBytes("fiotst.dat", fbuf, modes[m])
+          || 0!=memcmp(&fbuf[0], &data[0], data.size())) {
         fioPerr();
-        fprintf(stderr, " Error: fileType("") is not -1\n");
+        fprintf(stderr, " Error: load/save with ioflags %d failed\n",
+                modes[m]);
         isOk=false;
       }
-      // file close from 0
-      if (EOF!=fileClose(0)) {
+      // short file, smaller than one block
+      if (!fileSaveBytes("fiotst.dat", &data[0], 3, modes[m])
+          || 3!=fileLoadBytes("fiotst.dat", fbuf, modes[m])
+          || fbuf[2]!=data[2]) {
         fioPerr();
-        fprintf(stderr, " Error: fileClose(0) is not EOF\n");
+        fprintf(stderr, " Error: 3 byte load/save with ioflags %d failed\n",
+                modes[m]);
         isOk=false;
       }
-      // reopen file fname in write mode
-      fp=fileOpen(fname, "wb");
-      if (!fp) {
+    }
+    fioBuffer fbuf;
+    if (-1!=fileLoadBytes("fiotst.none", fbuf, FILEIO_DIRECT)) {
+      fioPerr();
+      fprintf(stderr, " Error: fileLoadBytes(\"fiotst.none\") is not -1\n");
+      isOk=false;
+    }
+    fileDelete("fiotst.dat");
+  }
+  {
+    // fileSaveAtomic
+    const char *text="atomic";
+    if (!fileSaveAtomic("fiotst.dat", text, 6)
+        || !fileSaveAtomic("fiotst.dat", text, 3)
+        || 3!=fileSize("fiotst.dat")) {
+      fioPerr();
+      fprintf(stderr, " Error: fileSaveAtomic failed\n");
+      isOk=false;
+    }
+    if (fileSaveAtomic("fiotst.none/fiotst.dat", text, 6)) {
+      fioPerr();
+      fprintf(stderr, " Error: fileSaveAtomic into a missing directory\n");
+      isOk=false;
+    }
+#ifdef __linux__
+    // the permissions of the replaced file are kept
+    ststat64 st_buf;
+    chmod("fiotst.dat", 0604);
+    if (!fileSaveAtomic("fiotst.dat", text, 6)
+        || 0!=stat64("fiotst.dat", &st_buf) || (st_buf.st_mode & 0777)!=0604) {
+      fioPerr();
+      fprintf(stderr, " Error: fileSaveAtomic changed the permissions\n");
+      isOk=false;
+    }
+    // syncfs group commits
+    FileSaveGroup fsGroup(true);
+    if (!fsGroup.save("fiotst.dat", text, 2) || 2!=fileSize("fiotst.dat")) {
+      fioPerr();
+      fprintf(stderr, " Error: FileSaveGroup(true) failed\n");
+      isOk=false;
+    }
+#endif
+    fileDelete("fiotst.dat");
+  }
+#ifdef __linux__
+  {
+    // FileSaveGroup with concurrent saves and with add/commit
+    FileSaveGroup group;
+    std::atomic<int> failed(0);
+    std::vector<std::thread> pool;
+    for (int t=0; t<4; t++) {
+      pool.push_back(std::thread([&group, &failed, t]() {
+        for (int i=0; i<8; i++) {
+          char name[32];
+          snprintf(name, sizeof(name), "fiotst.g%d.dat", t * 8 + i);
+          uint32_t v=t * 8 + i;
+          if (!group.save(name, &v, 4)) failed++;
+        }
+      }));
+    }
+    for (size_t t=0; t<pool.size(); t++) {
+      pool[t].join();
+    }
+    const uint64_t before=group.commits();
+    for (int i=0; i<32; i++) {
+      char name[32];
+      snprintf(name, sizeof(name), "fiotst.g%d.dat", i);
+      uint32_t v=i + 100;
+      if (!group.add(name, &v, 4)) failed++;
+    }
+    if (!group.commit() || before + 1!=group.commits()) failed++;
+    for (int i=0; i<32; i++) {
+      char name[32];
+      snprintf(name, sizeof(name), "fiotst.g%d.dat", i);
+      uint32_t v=0;
+      FILE *fp=fileOpen(name, "rb");
+      if (!fp || 1!=fread(&v, 4, 1, fp) || v!=(uint32_t)i + 100) failed++;
+      fileClose(fp);
+      fileDelete(name);
+    }
+    if (0!=failed || before > 32) {
+      fioPerr();
+      fprintf(stderr, " Error: FileSaveGroup failed\n");
+      isOk=false;
+    }
+    // no temporary files are left over
+    FileDir dir;
+    FileDirEntry de;
+    dir.open(".");
+    while (dir.next(de)) {
+      if (strstr(de.name, ".tmp")) {
         fioPerr();
-        fprintf(stderr, " Error: fileOpen(\"%s\") reopen failed\n", fname);
+        fprintf(stderr, " Error: temporary file %s left over\n", de.name);
         isOk=false;
       }
-      uint16_t u16_val=0x2030;
-      // write little endian uint16_t
-      if (!fwrite_u16(fp, ENDIAN_LITTLE, u16_val)) {
+    }
+  }
+#endif
+  {
+    // instrumentation counters (compiled in with -DFIO_STATS)
+    std::vector<FileStatsCounter> stats;
+#ifdef FIO_STATS
+    fileStatsReset();
+    FILE *fp=fileOpen("fiotst.dat", "wb");
+    fwrite_u32(fp, ENDIAN_BIG, 1);
+    fwrite_u32(fp, ENDIAN_LITTLE, 2);
+    fileClose(fp);
+    fileSize("fiotst.none");
+#ifdef __linux__
+    // counters of ended threads are kept
+    std::thread t([]() { fileExists("fiotst.dat"); });
+    t.join();
+#else
+    fileExists("fiotst.dat");
+#endif
+    if (!fileStatsSnapshot(stats) || FIOSTAT_COUNT!=stats.size()
+        || 2!=stats[FIOSTAT_FWRITE_U32].calls
+        || 8!=stats[FIOSTAT_FWRITE_U32].bytes
+        || 0!=strcmp("fwrite_u32", stats[FIOSTAT_FWRITE_U32].name)
+        || 1!=stats[FIOSTAT_FILESIZE].errors
+        || 1!=stats[FIOSTAT_FILEEXISTS].calls
+        || 0==fileStatsPercentile(stats[FIOSTAT_FILEOPEN], 0.99)) {
+      fioPerr();
+      fprintf(stderr, " Error: fileStatsSnapshot counters are wrong\n");
+      isOk=false;
+    }
+    // nested fio calls are counted once, by the outermost function
+    fp=fileOpen("fiotst.dat", "wb");
+    std::vector<uint8_t> v(100000, 1);
+    fileStatsReset();
+    fileSaveBytes(fp, v);
+    fileClose(fp);
+    fp=fileOpen("fiotst.dat", "rb");
+    fioBuffer buf;
+    fileLoadBytes(fp, buf);
+    fileClose(fp);
+    fileStatsSnapshot(stats);
+    if (1!=stats[FIOSTAT_FILESAVEBYTES].calls
+        || 100000!=stats[FIOSTAT_FILESAVEBYTES].bytes
+        || 0!=stats[FIOSTAT_FILEWRITEBYTES].calls
+        || 0!=stats[FIOSTAT_FILEWRITEGATHER].calls
+        || 1!=stats[FIOSTAT_FILELOADBYTES].calls
+        || 100000!=stats[FIOSTAT_FILELOADBYTES].bytes
+        || 0!=stats[FIOSTAT_FILEREADBYTES].calls
+        || 0!=stats[FIOSTAT_FILESIZE].calls) {
+      fioPerr();
+      fprintf(stderr, " Error: nested calls are counted\n");
+      isOk=false;
+    }
+    // classes, later additions and cached calls are counted too
+    fileStatsReset();
+    fileCopy("fiotst.dat", "fiotst.cpy");
+    fp=fileOpen("fiotst.cpy", "rb");
+    FileReader rd(4096);
+    rd.open(fp);
+    rd.readU32(true);
+    rd.close();
+    uint8_t b4[4];
+    fileReadAt(fileno(fp), 10, b4, 4);
+    fileClose(fp);
+    fileDelete("fiotst.cpy");
+#ifdef __linux__
+    fileCacheEnable();
+    fileModificationTime("fiotst.none");
+    fileCacheDisable();
+    // the fio calls of a visitor are counted, they are not nested
+    FileWalkOptions wo;
+    wo.maxDepth=0;
+    const int64_t visited=fileWalk(".", [](const FileWalkEntry &) {
+      return fileExists("fiotst.none");
+    }, wo);
+#else
+    fileModificationTime("fiotst.none");
+#endif
+    fileStatsSnapshot(stats);
+    if (1!=stats[FIOSTAT_FILECOPY].calls
+        || 100000!=stats[FIOSTAT_FILECOPY].bytes
+        || 1!=stats[FIOSTAT_FILEREADER].calls
+        || 4096!=stats[FIOSTAT_FILEREADER].bytes
+        || 4!=stats[FIOSTAT_FILEREADAT].bytes
+        || 1!=stats[FIOSTAT_FILEMTIME].errors
+#ifdef __linux__
+        || 1!=stats[FIOSTAT_FILEWALK].calls
+        || visited<1 || (uint64_t)visited!=stats[FIOSTAT_FILEEXISTS].calls
+#endif
+        || 0!=strcmp("fileWalk", stats[FIOSTAT_FILEWALK].name)) {
+      fioPerr();
+      fprintf(stderr, " Error: FIO_STATS misses a function\n");
+      isOk=false;
+    }
+    fileStatsReset();
+    fileStatsSnapshot(stats);
+    if (0!=stats[FIOSTAT_FWRITE_U32].calls) {
+      fioPerr();
+      fprintf(stderr, " Error: fileStatsReset failed\n");
+      isOk=false;
+    }
+    fileDelete("fiotst.dat");
+#else
+    if (fileStatsSnapshot(stats) || !stats.empty()) {
+      fioPerr();
+      fprintf(stderr, " Error: fileStatsSnapshot without FIO_STATS\n");
+      isOk=false;
+    }
+#endif
+  }
+  {
+    // fileCopy with every strategy, sparse source and a range
+    FILE *fp=fileOpen("fiotst.dat", "wb");
+    std::vector<uint8_t> block(4096);
+    for (size_t i=0; i<block.size(); i++) {
+      block[i]=(uint8_t)(i * 3 + 1);
+    }
+    fileSaveBytes(fp, block);
+    fseeko64(fp, 1024 * 1024, SEEK_SET); // hole of almost 1 MiB
+    fileSaveBytes(fp, block);
+    fileClose(fp);
+    fioBuffer src, dst;
+    fileLoadBytes("fiotst.dat", src, FILEIO_BUFFERED);
+    FileCopyOptions opt;
+    for (int s=FILECOPY_CLONE; s<=FILECOPY_BUFFER; s++) {
+      opt.strategy=s;
+      int used=FILECOPY_ERROR;
+      if ((int64_t)src.size()!=fileCopy("fiotst.dat", "fiotst.cpy", opt, &used)
+          || used < s || used > FILECOPY_BUFFER
+          || (int64_t)src.size()!=fileLoadBytes("fiotst.cpy", dst,
+                                                 FILEIO_BUFFERED)
+          || 0!=memcmp(&src[0], &dst[0], src.size())) {
         fioPerr();
-        fprintf(stderr, " Error: fwrite_u16 ENDIAN_LITTLE failed\n");
+        fprintf(stderr, " Error: fileCopy with strategy %d failed\n", s);
         isOk=false;
       }
-      // write big endian uint16_t
-      if (!fwrite_u16(fp, ENDIAN_BIG, u16_val)) {
+#ifdef __linux__
+      // the hole is not written
+      ststat64 st_buf;
+      if (0!=stat64("fiotst.cpy", &st_buf)
+          || st_buf.st_blocks * 512 > 512 * 1024) {
         fioPerr();
-        fprintf(stderr, " Error: fwrite_u16 ENDIAN_BIG failed\n");
+        fprintf(stderr, " Error: fileCopy with strategy %d filled the hole\n",
+                s);
         isOk=false;
-
       }
-      fileClose(fp);
-      // check file size
-      if (4!=fileSize(fname)) {
+#endif
+    }
+    opt=FileCopyOptions();
+    opt.offset=1024 * 1024 + 10;
+    opt.length=100;
+    if (100!=fileCopy("fiotst.dat", "fiotst.cpy", opt)
+        || 100!=fileLoadBytes("fiotst.cpy", dst, FILEIO_BUFFERED)
+        || 0!=memcmp(&dst[0], &block[10], 100)) {
+      fioPerr();
+      fprintf(stderr, " Error: fileCopy of a range failed\n");
+      isOk=false;
+    }
+    if (-1!=fileCopy("fiotst.none", "fiotst.cpy")) {
+      fioPerr();
+      fprintf(stderr, " Error: fileCopy(\"fiotst.none\") is not -1\n");
+      isOk=false;
+    }
+#ifdef __linux__
+    // a copy onto itself is refused and leaves src intact
+    if (-1!=fileCopy("fiotst.dat", "fiotst.dat")
+        || (int64_t)src.size()!=fileLoadBytes("fiotst.dat", dst,
+                                               FILEIO_BUFFERED)
+        || 0!=memcmp(&src[0], &dst[0], src.size())) {
+      fioPerr();
+      fprintf(stderr, " Error: fileCopy onto itself is not -1\n");
+      isOk=false;
+    }
+#endif
+    fileDelete("fiotst.cpy");
+    fileDelete("fiotst.dat");
+  }
+  {
+    // FILEIO_SPARSE save/load, FileExtents and fileReserve
+    std::vector<uint8_t> v(1024 * 1024, 0);
+    for (size_t i=0; i<4096; i++) {
+      v[i]=(uint8_t)(i + 1);
+      v[v.size() - 4096 + i]=(uint8_t)(i * 7);
+    }
+    fioBuffer buf;
+    for (int direct=0; direct<2; direct++) {
+      const int flags=FILEIO_SPARSE | (direct ? FILEIO_DIRECT : 0);
+      if (!fileSaveBytes("fiotst.dat", &v[0], v.size(), flags)
+          || (int64_t)v.size()!=fileLoadBytes("fiotst.dat", buf, flags)
+          || 0!=memcmp(&v[0], &buf[0], v.size())) {
         fioPerr();
-        fprintf(stderr, " Error: fileSize(\"%s\") is not 4\n", fname);
+        fprintf(stderr, " Error: FILEIO_SPARSE round trip failed\n");
         isOk=false;
       }
-      // open for read
-      fp=fileOpen(fname, "rb");
-      if (!fp) {
-        fioPerr();
-        fprintf(stderr, " Error: fileOpen(\"%s\") reopen for read failed\n", fname);
-        isOk=false;
+    }
+#ifdef __linux__
+    ststat64 st_buf;
+    if (0!=stat64("fiotst.dat", &st_buf)
+        || st_buf.st_blocks * 512 > 512 * 1024) {
+      fioPerr();
+      fprintf(stderr, " Error: FILEIO_SPARSE did not save a hole\n");
+      isOk=false;
+    }
+#endif
+    FILE *fp=fileOpen("fiotst.dat", "r+b");
+    FileExtents extents;
+    FileExtent e;
+    int64_t data=0, count=0;
+    if (extents.open(fp)) {
+      while (extents.next(e)) {
+        data+=e.length;
+        count++;
       }
-      uint16_t val=0;
-      if (!fread_u16(fp, ENDIAN_LITTLE, val)) {
+    }
+    if (count < 1 || data < 8192 || data > (int64_t)v.size()
+        || ftello64(fp)!=0) {
+      fioPerr();
+      fprintf(stderr, " Error: FileExtents failed\n");
+      isOk=false;
+    }
+    if (!fileReserve(fp, 2 * v.size())
+        || fileSize(fp)!=(int64_t)(2 * v.size())
+        || !fileReserve(fp, v.size())) {
+      fioPerr();
+      fprintf(stderr, " Error: fileReserve failed\n");
+      isOk=false;
+    }
+#ifdef __linux__
+    ststat64 before, after;
+    fstat64(fileno(fp), &before);
+    if (fileReserve(fp, 4 * v.size(), true)) {
+      fstat64(fileno(fp), &after);
+      if (after.st_size!=before.st_size
+          || after.st_blocks <= before.st_blocks) {
         fioPerr();
-        fprintf(stderr, " Error: fread_u16 ENDIAN_LITTLE failed\n");
+        fprintf(stderr, " Error: fileReserve(keepSize) changed the size\n");
         isOk=false;
       }
-      if (val!=u16_val) {
-        fioPerr();
-        fprintf(stderr, " Error: fread_u16 ENDIAN_LITTLE wrong value\n");
-        isOk=false;
+    }
+#endif
+    fileClose(fp);
+    fileDelete("fiotst.dat");
+  }
+#ifdef __linux__
+  {
+    // FileAppendLog with several producers and every sync policy
+    for (int policy=FILELOG_SYNC_NONE; policy<=FILELOG_SYNC_EVERY; policy++) {
+      fileDelete("fiotst.log");
+      FileLogOptions opt;
+      opt.ringSize=4096; // small ring, producers have to wait
+      opt.syncPolicy=policy;
+      opt.syncInterval=5;
+      opt.syncEvery=100;
+      opt.bigEndian=(policy != FILELOG_SYNC_INTERVAL);
+      FileAppendLog log;
+      bool bad=!log.open("fiotst.log", opt);
+      const int threads=4, records=2000;
+      std::atomic<int> failed(0);
+      std::vector<std::thread> pool;
+      for (int t=0; t<threads; t++) {
+        pool.push_back(std::thread([&log, &failed, t]() {
+          uint64_t ticket=0;
+          for (int i=0; i<records; i++) {
+            uint8_t rec[64];
+            const uint32_t len=(uint32_t)(i % 60);
+            memset(rec, t * 16 + (i & 15), len);
+            if (len >= 2) {
+              rec[0]=(uint8_t)t;
+              rec[1]=(uint8_t)(i & 0xff);
+            }
+            const uint64_t next=log.append(rec, len);
+            if (next <= ticket) failed++;
+            ticket=next;
+          }
+          if (!log.wait(ticket)) failed++;
+        }));
       }
-      if (!fread_u16(fp, ENDIAN_LITTLE, val)) {
-        fioPerr();
-        fprintf(stderr, " Error: fread_u16 next ENDIAN_LITTLE failed\n");
-        isOk=false;
+      for (size_t t=0; t<pool.size(); t++) {
+        pool[t].join();
       }
-      if (bswap_u16(val)!=u16_val) {
-        fioPerr();
-        fprintf(stderr, " Error: fread_u16 next ENDIAN_LITTLE wrong value\n");
-        isOk=false;
+      const uint64_t written=log.written();
+      if (!log.sync() || log.durable()!=written || !log.close()) bad=true;
+      // every record is framed and the records of a thread are in order
+      FILE *fp=fileOpen("fiotst.log", "rb");
+      int count=0, last[threads];
+      for (int t=0; t<threads; t++) {
+        last[t]=-1;
       }
-      rewind(fp);
-      uint32_t val2=0;
-      if (!fread_u32(fp, ENDIAN_LITTLE, val2)){
-        fioPerr();
-        fprintf(stderr, " Error: fread_u32 ENDIAN_LITTLE failed\n");
-        isOk=false;
+      uint32_t len;
+      while (fp && fread_u32(fp, opt.bigEndian, len)) {
+        uint8_t rec[64];
+        if (len >= 60 || len!=fread(rec, 1, len, fp)) {
+          bad=true;
+          break;
+        }
+        if (len >= 2) {
+          const int t=rec[0];
+          // records 0 and 1 of every 60 carry no number
+          if (t >= threads
+              || (last[t] >= 0 && (uint8_t)(rec[1] - last[t] - 1) > 2)) {
+            bad=true;
+          }
+          if (t < threads) last[t]=rec[1];
+        }
+        count++;
       }
-      if (val2!=0x30202030) {
+      fileClose(fp);
+      if (bad || failed || count!=threads * records
+          || fileSize("fiotst.log")!=(int64_t)written) {
         fioPerr();
-        fprintf(stderr, " Error: fread_u32 ENDIAN_LITTLE is wrong\n");
+        fprintf(stderr, " Error: FileAppendLog with policy %d failed\n",
+                policy);
         isOk=false;
       }
+    }
+    fileDelete("fiotst.log");
+  }
+#endif
+  {
+    // positional reads and writes of several threads on one descriptor
+    FilePositional pf;
+    bool bad=!pf.open("fiotst.dat", true);
+    const int entries=4096;
+    for (int i=0; i<entries && !bad; i++) {
+      if (!pf.writeU32At(i * 12, true, (uint32_t)i * 7)
+          || !pf.writeU64At(i * 12 + 4, false, (uint64_t)i << 33)) {
+        bad=true;
+      }
+    }
+    int failed=0;
+#ifdef __linux__
+    std::atomic<int> threadFailed(0);
+    std::vector<std::thread> pool;
+    for (int t=0; t<4; t++) {
+      pool.push_back(std::thread([&pf, &threadFailed, t]() {
+        for (int k=0; k<entries; k++) {
+          const int i=(k * 2654435761u + t) % entries;
+          uint32_t a=0;
+          uint64_t b=0;
+          if (!pf.readU32At(i * 12, true, a) || a!=(uint32_t)i * 7
+              || !pf.readU64At(i * 12 + 4, false, b)
+              || b!=(uint64_t)i << 33) {
+            threadFailed++;
+          }
+        }
+      }));
+    }
+    for (size_t t=0; t<pool.size(); t++) {
+      pool[t].join();
+    }
+    failed=threadFailed;
+#endif
+    uint8_t tail[16];
+    uint16_t u16=0;
+    if (bad || failed || pf.size()!=entries * 12
+        || 4!=pf.readAt(entries * 12 - 4, tail, sizeof(tail))
+        || pf.readU16At(entries * 12 - 1, true, u16)
+        || !pf.readU16At(0, false, u16) || u16!=0) {
+      fioPerr();
+      fprintf(stderr, " Error: FilePositional failed\n");
+      isOk=false;
+    }
+    pf.close();
+    // the stream position of a shared FILE* is not moved
+    FILE *fp=fileOpen("fiotst.dat", "rb");
+    uint32_t v=0;
+    fseeko64(fp, 12, SEEK_SET);
+    if (!pf.open(fp) || !pf.readU32At(24, true, v) || v!=14
+        || ftello64(fp)!=12 || !fread_u32(fp, true, v) || v!=7
+        || -1!=fileReadAt(-1, 0, tail, 1)) {
+      fioPerr();
+      fprintf(stderr, " Error: FilePositional(FILE*) failed\n");
+      isOk=false;
+    }
+    pf.close();
+    fileClose(fp);
+    fileDelete("fiotst.dat");
+  }
+  {
+    // fileLoadRanges: clustered ranges are coalesced, results are exact
+    std::vector<uint8_t> v(512 * 1024);
+    for (size_t i=0; i<v.size(); i++) {
+      v[i]=(uint8_t)(i * 31 + (i >> 9));
+    }
+    FILE *fp=fileOpen("fiotst.dat", "wb");
+    fileSaveBytes(fp, v);
+    fileClose(fp);
+    const int count=200;
+    std::vector<FileRange> ranges(count);
+    std::vector<std::vector<uint8_t> > bufs(count);
+    for (int i=0; i<count; i++) {
+      // 4 clusters of nearby ranges in random order, one past the end
+      const int k=(i * 37) % count;
+      ranges[i].offset=(k % 4) * 128 * 1024 + (k / 4) * 1000;
+      ranges[i].length=(k % 7) * 50;
+      if (k==0) { // short read at the end of the file
+        ranges[i].offset=v.size() - 100;
+        ranges[i].length=300;
+      }
+      bufs[i].resize(ranges[i].length + 1);
+      ranges[i].dst=&bufs[i][0];
+    }
+    for (int mode=0; mode<2; mode++) {
+      int64_t requests=-1;
+      fp=fileOpen("fiotst.dat", "rb");
+      if (mode==0) {
+        requests=fileLoadRanges(fp, &ranges[0], count);
+      } else {
+#ifdef __linux__
+        // an unrelated read of an empty pipe (io_uring) stays pending
+        FileAsync async;
+        int fds[2];
+        char pb[4];
+        int64_t pipeRes=0;
+        if (async.open(8) && 0==pipe(fds)) {
+          const bool uring=(FILEASYNC_URING==async.engine());
+          if (uring) {
+            async.read(fds[0], 0, pb, sizeof(pb),
+                       [&pipeRes](int64_t res) { pipeRes=res; });
+            async.submit();
+          }
+          requests=fileLoadRanges(async, fileno(fp), &ranges[0], count);
+          if ((uring ? 1 : 0)!=async.pending()) requests=-1;
+          const ssize_t wc=::write(fds[1], "fio!", 4);
+          async.drain();
+          if (4!=wc || (uring && 4!=pipeRes)) requests=-1;
+          ::close(fds[0]);
+          ::close(fds[1]);
+        }
+#else
+        requests=fileLoadRanges(fp, &ranges[0], count);
+#endif
+      }
       fileClose(fp);
-      // delete file
-      if (!fileDelete(fname)) {
-        fioPerr();
-        fprintf(stderr, " Error: fileDelete(\"%s\") failed (delete second time)\n"
-                , fname);
-        isOk=false;
+      bool bad=(requests < 1 || requests > 10);
+      for (int i=0; i<count && !bad; i++) {
+        const FileRange &r=ranges[i];
+        const int64_t want=(r.offset + r.length > (int64_t)v.size())
+                           ? (int64_t)v.size() - r.offset : r.length;
+        if (r.result!=want
+            || (want > 0 && 0!=memcmp(r.dst, &v[r.offset], want))) {
+          bad=true;
+        }
       }
-      // open for read
-      fp=fileOpen(fname, "wb");
-      if (!fp) {
+      if (bad) {
         fioPerr();
-        fprintf(stderr, " Error: fileOpen(\"%s\") reopen (2) for write failed\n"
-                , fname);
+        fprintf(stderr, " Error: fileLoadRanges (mode %d, %d requests)"
+                " failed\n", mode, (int)requests);
         isOk=false;
       }
-      std::vector<uint8_t> vbuf;
-      for (size_t i=0; i<16; i++) {
-        vbuf.push_back(i);
+    }
+    fileDelete("fiotst.dat");
+  }
+  {
+    // fileForEachChunk and FileChunks with and without overlap
+    std::vector<uint8_t> v(100000);
+    for (size_t i=0; i<v.size(); i++) {
+      v[i]=(uint8_t)(i * 13 + (i >> 8));
+    }
+    FILE *fp=fileOpen("fiotst.dat", "wb");
+    fileSaveBytes(fp, v);
+    fileClose(fp);
+    fp=fileOpen("fiotst.dat", "rb");
+    int64_t next=0;
+    bool bad=false;
+    const int64_t n=fileForEachChunk(fp, 4096, [&](const FileChunk &c) {
+      if (c.offset + (int64_t)c.overlap!=next
+          || c.overlap!=(next ? 10u : 0u)
+          || 0!=memcmp(c.data, &v[c.offset], c.size)) {
+        bad=true;
       }
-      if (!fileSaveBytes(fp, vbuf)) {
+      next=c.offset + c.size;
+      return true;
+    }, 10);
+    if (bad || n!=(int64_t)v.size() || next!=n) {
+      fioPerr();
+      fprintf(stderr, " Error: fileForEachChunk failed\n");
+      isOk=false;
+    }
+    fseeko64(fp, 1000, SEEK_SET);
+    int64_t sum=0, chunks=0;
+    for (const FileChunk &c : FileChunks(fp, 30000)) {
+      if (0!=memcmp(c.data, &v[c.offset], c.size)) bad=true;
+      sum+=c.size;
+      chunks++;
+    }
+    FileChunks empty(fp);
+    if (bad || sum!=(int64_t)v.size() - 1000 || chunks!=4
+        || empty.next() || empty.status()!=FIO_EOF
+        || -1!=fileForEachChunk(fp, 0, [](const FileChunk &) {
+                                  return true; })) {
+      fioPerr();
+      fprintf(stderr, " Error: FileChunks failed\n");
+      isOk=false;
+    }
+    fileClose(fp);
+    fileDelete("fiotst.dat");
+  }
+#ifdef __linux__
+  {
+    // FilePrefetchReader over a FILE*, a file descriptor and a pipe
+    std::vector<uint8_t> v(1000000);
+    for (size_t i=0; i<v.size(); i++) {
+      v[i]=(uint8_t)(i * 7 + (i >> 12));
+    }
+    FILE *fp=fileOpen("fiotst.dat", "wb");
+    fileSaveBytes(fp, v);
+    fileClose(fp);
+    fp=fileOpen("fiotst.dat", "rb");
+    fseeko64(fp, 100, SEEK_SET);
+    FilePrefetchReader rd(65536, 3);
+    FileChunk c;
+    int64_t n=0;
+    bool bad=!rd.open(fp);
+    while (rd.next(c)) {
+      if (c.offset!=100 + n || 0!=memcmp(c.data, &v[c.offset], c.size)) {
+        bad=true;
+      }
+      n+=c.size;
+    }
+    const int status=rd.status();
+    rd.close();
+    if (bad || status!=FIO_EOF || n!=(int64_t)v.size() - 100
+        || ftello64(fp)!=(int64_t)v.size()) {
+      fioPerr();
+      fprintf(stderr, " Error: FilePrefetchReader(FILE*) failed\n");
+      isOk=false;
+    }
+    // stop early, the descriptor position is right after the last chunk
+    lseek64(fileno(fp), 0, SEEK_SET);
+    if (!rd.open(fileno(fp)) || !rd.next(c) || c.size!=65536) bad=true;
+    rd.close();
+    if (bad || lseek64(fileno(fp), 0, SEEK_CUR)!=65536) {
+      fioPerr();
+      fprintf(stderr, " Error: FilePrefetchReader(fd) failed\n");
+      isOk=false;
+    }
+    fileClose(fp);
+    int fds[2];
+    if (0==pipe(fds)) {
+      std::thread writer([&v, &fds]() {
+        size_t done=0;
+        while (done < v.size()) {
+          const ssize_t rc=::write(fds[1], &v[done], v.size() - done);
+          if (rc <= 0) break;
+          done+=rc;
+        }
+        ::close(fds[1]);
+      });
+      n=0;
+      if (rd.open(fds[0])) {
+        while (rd.next(c)) {
+          if (c.offset!=n || 0!=memcmp(c.data, &v[n], c.size)) bad=true;
+          n+=c.size;
+        }
+      }
+      rd.close();
+      writer.join();
+      ::close(fds[0]);
+      if (bad || n!=(int64_t)v.size()) {
         fioPerr();
-        fprintf(stderr, " Error: fileSaveBytes failed\n");
+        fprintf(stderr, " Error: FilePrefetchReader(pipe) failed\n");
         isOk=false;
       }
-      fileClose(fp);
-      // check file size
-      if (16!=fileSize(fname)) {
+    }
+    // a pipe FILE* with bytes in the stdio buffer is refused
+    FILE *pp=popen("echo fio prefetch", "r");
+    if (pp) {
+      const bool isRead=('f'==fgetc(pp) && 'i'==fgetc(pp));
+      if (!isRead || rd.open(pp)) {
         fioPerr();
-        fprintf(stderr, " Error: fileSize(\"%s\") is not 16\n", fname);
+        fprintf(stderr, " Error: FilePrefetchReader accepts a pipe FILE*\n");
         isOk=false;
       }
-      fp=fileOpen(fname, "rb");
-      if (fp) {
-        uint64_t val3=0;
-        if (!fread_u64(fp, ENDIAN_LITTLE, val3)) {
-          fioPerr();
-          fprintf(stderr, " Error: fread_u64 ENDIAN_LITTLE is wrong\n");
-          isOk=false;
-        }
-        if (val3!=0x0706050403020100) {
-          fioPerr();
-          fprintf(stderr, " Error: fread_u64 ENDIAN_LITTLE is wrong\n");
-          isOk=false;
-        }
-        rewind(fp);
-        if (!fread_u64(fp, ENDIAN_BIG, val3)) {
-          fioPerr();
-          fprintf(stderr, " Error: fread_u64 ENDIAN_BIG is wrong\n");
-          isOk=false;
-        }
-        if (val3!=0x0001020304050607) {
-          fioPerr();
-          fprintf(stderr, " Error: fread_u64 ENDIAN_BIG is wrong\n");
-          isOk=false;
-        }
-        rewind(fp);
-        vbuf.clear();
-        vbuf = fileLoadBytes(fp);
-        if (16!=vbuf.size()) {
-          fioPerr();
-          fprintf(stderr, " Error: fileLoadBytes has too few bytes\n");
-          isOk=false;
-        }
-        /* fioPerr(); */
-        /* fprintf(stderr, " Error: fileSaveBytes failed\n"); */
-        /* isOk=false; */
-        fclose(fp);
-        fp=fileOpen(fname, "rb");
-        if (fp) {
-          // read 4 bytes
-          vbuf.clear();
-          vbuf = fileLoadBytes(fp, 4);
-          if (4!=vbuf.size()) {
-            fioPerr();
-            fprintf(stderr, " Error: fileLoadBytes has wrong size (not 4)\n");
-            isOk=false;
-          }
-          if (vbuf[0]!=0 || vbuf[1]!=1 || vbuf[2]!=2 || vbuf[3]!=3) {
-            fioPerr();
-            fprintf(stderr, " Error: fileLoadBytes result has wrong values\n");
-            isOk=false;
-          }
-          // read 4 bytes again
-          vbuf.clear();
-          vbuf = fileLoadBytes(fp, 4);
-          if (4!=vbuf.size()) {
-            fioPerr();
-            fprintf(stderr, " Error: fileLoadBytes has wrong size (not 4)\n");
-            isOk=false;
-          }
-          if (vbuf[0]!=4 || vbuf[1]!=5 || vbuf[2]!=6 || vbuf[3]!=7) {
-            fioPerr();
-            fprintf(stderr, " Error: fileLoadBytes result has wrong values\n");
-            isOk=false;
-          }
-          fclose(fp);
-        }
+      rd.close();
+      pclose(pp);
+    }
+    fileDelete("fiotst.dat");
+  }
+#endif
+#ifdef __linux__
+  {
+    // FileFlushWriter: small pool (backpressure), typed writes, sync range
+    FILE *fp=fileOpen("fiotst.dat", "wb");
+    fwrite_u32(fp, true, 0x12345678);
+    FileFlushWriter wr(4096, 2, 16384);
+    bool bad=!wr.open(fp);
+    std::vector<uint8_t> v(3000);
+    for (size_t i=0; i<v.size(); i++) {
+      v[i]=(uint8_t)(i * 5);
+    }
+    for (int i=0; i<100 && !bad; i++) {
+      if (!wr.writeU32(true, i) || !wr.writeBytes(&v[0], v.size())
+          || !wr.writeU16(false, (uint16_t)i)) {
+        bad=true;
       }
-
-      fileDelete(fname);
+    }
+    const int64_t end=wr.tell();
+    if (!wr.close() || ftello64(fp)!=end || end!=4 + 100 * 3006) bad=true;
+    fileClose(fp);
+    fp=fileOpen("fiotst.dat", "rb");
+    uint32_t u32=0;
+    uint16_t u16=0;
+    std::vector<uint8_t> rec(v.size());
+    if (!fread_u32(fp, true, u32) || u32!=0x12345678) bad=true;
+    for (int i=0; i<100 && !bad; i++) {
+      if (!fread_u32(fp, true, u32) || u32!=(uint32_t)i
+          || v.size()!=fread(&rec[0], 1, rec.size(), fp) || rec!=v
+          || !fread_u16(fp, false, u16) || u16!=i) {
+        bad=true;
+      }
+    }
+    fileClose(fp);
+    if (bad || fileSize("fiotst.dat")!=end) {
+      fioPerr();
+      fprintf(stderr, " Error: FileFlushWriter failed\n");
+      isOk=false;
+    }
+    // write errors are reported (read-only descriptor)
+    fp=fileOpen("fiotst.dat", "rb");
+    FileFlushWriter bad_wr(4096, 2);
+    if (bad_wr.writeU32(true, 1) || bad_wr.writeU8(1)) { // not open
+      fioPerr();
+      fprintf(stderr, " Error: FileFlushWriter wrote while closed\n");
+      isOk=false;
+    }
+    bad_wr.open(fileno(fp));
+    for (int i=0; i<10000; i++) {
+      bad_wr.writeU32(true, i);
+    }
+    if (bad_wr.close() || bad_wr.error()!=EBADF
+        || bad_wr.writeU64(true, 1)) {
+      fioPerr();
+      fprintf(stderr, " Error: FileFlushWriter did not report an error\n");
+      isOk=false;
+    }
+    fileClose(fp);
+    fileDelete("fiotst.dat");
+  }
+#endif
+  {
+    // a swapped array larger than the swap buffer is written in pieces
+    std::vector<uint64_t> big(100000), back(100000);
+    for (size_t i=0; i<big.size(); i++) big[i]=0x0102030405060708ULL*i;
+    const bool be=!isBigEndian();
+    FILE *fp=fileOpen("fiotst.dat", "wb");
+    bool ok=fwrite_u8(fp, 7) && fwrite_u64_array(fp, be, &big[0], big.size());
+    fileClose(fp);
+    fp=fileOpen("fiotst.dat", "rb");
+    uint8_t first=0;
+    ok=ok && fread_u8(fp, first) && 7==first
+       && fread_u64_array(fp, be, &back[0], back.size());
+    fileClose(fp);
+    fileDelete("fiotst.dat");
+    if (!ok || big!=back) {
+      fioPerr();
+      fprintf(stderr, " Error: fwrite_u64_array of a large array is wrong\n");
+      isOk=false;
+    }
+  }
+  {
+    // the vector overloads load the rest of the file and keep short reads
+    std::vector<uint8_t> v(1000);
+    for (size_t i=0; i<v.size(); i++) v[i]=(uint8_t)(i * 11);
+    FILE *fp=fileOpen("fiotst.dat", "wb");
+    fileSaveBytes(fp, v);
+    fileClose(fp);
+    fp=fileOpen("fiotst.dat", "rb");
+    fseeko64(fp, 100, SEEK_SET);
+    std::vector<uint8_t> rest=fileLoadBytes(fp);
+    fseeko64(fp, 900, SEEK_SET);
+    std::vector<uint8_t> tail=fileLoadBytes(fp, 500);
+    fseeko64(fp, 400, SEEK_SET);
+    std::vector<uint8_t> prest=fileLoadBytesParallel(fp);
+    fileClose(fp);
+    fileDelete("fiotst.dat");
+    if (900!=rest.size() || 0!=memcmp(&rest[0], &v[100], 900)
+        || 100!=tail.size() || 0!=memcmp(&tail[0], &v[900], 100)
+        || 600!=prest.size() || 0!=memcmp(&prest[0], &v[400], 600)) {
+      fioPerr();
+      fprintf(stderr, " Error: fileLoadBytes vector of a short read is wrong\n");
+      isOk=false;
     }
   }
   return isOk;